@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "CommitHash.h"
+#include "Tree.h"
+
+using namespace std;
+
+// Times the commit tree queries that commands lean on, over a synthetic
+// history:
+//   treebench [commits [branches [queries]]]
+// Each query is run between a live branch and Master (as when merging a
+// branch), and between two branches picked from all of them. Then the tree
+// is saved, and loaded again as every command does on startup.
+//
+// A branch is forked off Master at even intervals as it grows. It takes
+// commits while it's among the ten newest, and is then merged back into
+// Master, so merge bases lie anywhere from next door (two live branches)
+// to most of the history away (two long-merged ones). Half the commits go
+// to Master.
+//
+// The history and the queries come from a fixed seed, so runs compare.
+
+namespace {
+  typedef chrono::steady_clock Clock;
+
+  double millisecondsBetween(const Clock::time_point& start,
+			     const Clock::time_point& end) {
+    return chrono::duration<double, milli>(end - start).count();
+  }
+
+  const size_t LIVE_BRANCHES = 10;
+  const size_t LOAD_RUNS = 7;
+
+  void buildHistory(Tree& tree, size_t numCommits, size_t numBranches,
+		    mt19937& random, vector<string>& branches) {
+    tree.initialize("Master");
+    branches.push_back("Master");
+    const size_t forkInterval = numCommits / (numBranches + 1) + 1;
+    // The live branches are the last ones in branches
+    size_t firstLive = 1;
+
+    for (size_t commit = 0; commit < numCommits; ++commit) {
+      int mergeParent = Tree::NO_NODE;
+      if (commit % forkInterval == forkInterval - 1 &&
+	  branches.size() <= numBranches) {
+	tree.switchToBranch("Master");
+	branches.push_back("b" + to_string(branches.size()));
+	tree.registerNewBranch(branches.back());
+	if (branches.size() - firstLive > LIVE_BRANCHES) {
+	  mergeParent = tree.getBranchTip(branches[firstLive++]);
+	}
+      }
+
+      const bool onMaster = mergeParent != Tree::NO_NODE ||
+	branches.size() == firstLive || random() % 2 == 0;
+      tree.switchToBranch(onMaster ? "Master" : branches[
+	  firstLive + random() % (branches.size() - firstLive)]);
+      tree.addCommit(CommitHash(to_string(commit)), mergeParent);
+    }
+  }
+}
+
+int main(int argc, char * argv[]) {
+  const size_t numCommits = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  const size_t numBranches = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000;
+  const size_t numQueries = argc > 3 ? strtoul(argv[3], NULL, 10) : 100;
+  mt19937 random(1);
+
+  Tree tree;
+  vector<string> branches;
+  Clock::time_point start = Clock::now();
+  buildHistory(tree, numCommits, numBranches, random, branches);
+  cout << "Built " << numCommits << " commits on " << branches.size() <<
+    " branches (" << tree.getNumNodes() << " nodes) in " <<
+    millisecondsBetween(start, Clock::now()) << "ms." << endl;
+
+  // Summed so the queries can't be optimized away
+  long long checksum = 0;
+  const size_t numLookups = 1000000;
+  start = Clock::now();
+  for (size_t i = 0; i < numLookups; ++i) {
+    checksum += tree.getBranchTip(branches[i % branches.size()]);
+  }
+  cout << "getBranchTip: " << 1000000 *
+    millisecondsBetween(start, Clock::now()) / numLookups << "ns each." <<
+    endl;
+
+  const size_t numLive = min(LIVE_BRANCHES, branches.size() - 1);
+  vector<pair<int, int> > liveQueries;
+  vector<pair<int, int> > anyQueries;
+  for (size_t i = 0; i < numQueries && numLive != 0; ++i) {
+    liveQueries.push_back(make_pair(
+	tree.getBranchTip(branches[branches.size() - 1 - random() % numLive]),
+	tree.getBranchTip("Master")));
+  }
+  for (size_t i = 0; i < numQueries; ++i) {
+    anyQueries.push_back(make_pair(
+	tree.getBranchTip(branches[random() % branches.size()]),
+	tree.getBranchTip(branches[random() % branches.size()])));
+  }
+
+  const pair<const char *, vector<pair<int, int> > *> querySets[] = {
+    make_pair("live branch and Master", &liveQueries),
+    make_pair("any two branches", &anyQueries)
+  };
+  for (const pair<const char *, vector<pair<int, int> > *>& querySet :
+	 querySets) {
+    const vector<pair<int, int> >& queries = *querySet.second;
+    if (queries.empty()) {
+      continue;
+    }
+
+    size_t totalVisited = 0;
+    start = Clock::now();
+    for (const pair<int, int>& query : queries) {
+      size_t visited = 0;
+      checksum += tree.findMergeBase(query.first, query.second, &visited);
+      totalVisited += visited;
+    }
+    cout << "findMergeBase, " << querySet.first << ": " << 1000 *
+      millisecondsBetween(start, Clock::now()) / queries.size() <<
+      "us each, visiting " << totalVisited / queries.size() <<
+      " nodes on average." << endl;
+
+    totalVisited = 0;
+    start = Clock::now();
+    for (const pair<int, int>& query : queries) {
+      size_t visited = 0;
+      checksum += tree.isAncestor(query.first, query.second, &visited);
+      totalVisited += visited;
+    }
+    cout << "isAncestor, " << querySet.first << ": " << 1000 *
+      millisecondsBetween(start, Clock::now()) / queries.size() <<
+      "us each, visiting " << totalVisited / queries.size() <<
+      " nodes on average." << endl;
+  }
+
+  char directory[] = "/tmp/treebenchXXXXXX";
+  if (mkdtemp(directory) == NULL) {
+    cout << "Could not make a directory to save the tree in!" << endl;
+    return 1;
+  }
+  const string nodesFile = string(directory) + "/.tree";
+  const string commitIndexFile = string(directory) + "/.commitIndex";
+  const string branchTipsFile = string(directory) + "/.branchTips";
+  const string branchListFile = string(directory) + "/.branches.txt";
+  const string journalFile = string(directory) + "/.tree.journal";
+  Tree::Files files;
+  files.nodes = nodesFile.c_str();
+  files.commitIndex = commitIndexFile.c_str();
+  files.branchTips = branchTipsFile.c_str();
+  files.branchList = branchListFile.c_str();
+  files.journal = journalFile.c_str();
+
+  start = Clock::now();
+  const bool saved = tree.save(files);
+  cout << "Saved the tree in " << millisecondsBetween(start, Clock::now()) <<
+    "ms." << endl;
+
+  // Loading, finding where we are and looking at a node, as a command does
+  // before anything else
+  vector<double> loadMs;
+  for (size_t run = 0; saved && run < LOAD_RUNS; ++run) {
+    start = Clock::now();
+    Tree loaded;
+    if (!loaded.load(files, "Master", CommitHash::getNullHash())) {
+      cout << "Could not load the tree back!" << endl;
+      break;
+    }
+    checksum += loaded.getCommit(loaded.getCurrentNode());
+    loadMs.push_back(millisecondsBetween(start, Clock::now()));
+
+    // A commit on top should only write a few records
+    if (run == 0) {
+      loaded.addCommit(CommitHash(to_string(numCommits)));
+      start = Clock::now();
+      loaded.save(files);
+      cout << "Saved a commit on top in " <<
+	millisecondsBetween(start, Clock::now()) << "ms." << endl;
+    }
+  }
+  if (!loadMs.empty()) {
+    sort(loadMs.begin(), loadMs.end());
+    cout << "Loaded the tree in " << loadMs[loadMs.size() / 2] <<
+      "ms (median of " << loadMs.size() << " runs)." << endl;
+  }
+
+  remove(files.nodes);
+  remove(files.commitIndex);
+  remove(files.branchTips);
+  remove(files.branchList);
+  rmdir(directory);
+
+  cout << "(checksum " << checksum << ")" << endl;
+  return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef BATCHFILEWRITER
+#define BATCHFILEWRITER
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// Writes many files underneath one root directory (eg. a new commit's
+// directory). Directories are created relative to their parent's fd with
+// mkdirat, and each one is only created once per batch, no matter how many
+// files end up in it.
+class BatchFileWriter {
+ public:
+  struct Stats {
+    size_t mkdirCalls;
+    size_t openCalls;
+    size_t writeCalls;
+    size_t filesCopied;
+    size_t filesCloned;
+    size_t filesLinked;
+    size_t directoriesCreated;
+    size_t filesWritten;
+  };
+
+ private:
+  int rootFd;
+  // Open fds of directories we've already created or opened, relative to the
+  // root ("" being the root itself). Bounded, as there can be a lot of them.
+  std::unordered_map<std::string, int> directoryFds;
+  std::unordered_set<std::string> createdDirectories;
+  Stats stats;
+
+  int getDirectoryFd(const std::string& directory);
+  int openFile(const std::string& path);
+  void closeDirectoryFds();
+
+ public:
+  explicit BatchFileWriter(const std::string& rootDirectory);
+  ~BatchFileWriter();
+  bool isOpen() const;
+  // path is relative to the root directory. Any missing directories along the
+  // way are created.
+  bool writeFile(const std::string& path, const std::string& contents);
+  // Copies sourcePath byte for byte to path (relative to the root directory)
+  bool copyFile(const std::string& sourcePath, const std::string& path);
+  // Makes path another name for sourcePath's file, copying it if it can't
+  bool linkFile(const std::string& sourcePath, const std::string& path);
+  const Stats& getStats() const;
+};
+
+#endif
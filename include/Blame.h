@@ -0,0 +1,88 @@
+#ifndef BLAME
+#define BLAME
+
+#include <string>
+#include <vector>
+
+#include "ChangedPathFilters.h"
+#include "FileDiff.h"
+#include "Manifest.h"
+#include "Tree.h"
+
+// Works out which commit brought in each line of a file, by going back
+// through the commits that changed it, newest first.
+//
+// No version of the file is ever rebuilt. The lines still to be accounted
+// for are kept as an interval map, from ranges of lines in the version
+// being looked at to where those lines are in the file being blamed. Going
+// back through a diff only means splitting those ranges at its hunks: the
+// parts a hunk inserted go down to the diff's commit, and the rest move to
+// where they were in the version before. That costs as much as the number
+// of hunks and ranges, however long the file.
+//
+// Each result is kept in the cache directory, by the file and the commit
+// that wrote the version it's for, so blaming a later version only has to
+// go back as far as the last one blamed. Lines brought in by a merge are put
+// down to the merge, as merges are stored against their first parent.
+class Blame {
+ public:
+  struct Range {
+    unsigned int start;
+    unsigned int length;
+    std::string commit;
+  };
+
+  struct Stats {
+    size_t diffsRead;
+    size_t commitsRead;
+    // The commit a cached blame was picked up from, empty if none was
+    std::string cachedCommit;
+  };
+
+ private:
+  // Lines of the version being looked at, and where they are in the file
+  // being blamed
+  struct Interval {
+    unsigned int start;
+    unsigned int length;
+    unsigned int target;
+  };
+
+  const Tree& tree;
+  const std::string commitDirectory;
+  const std::string cacheDirectory;
+  const Manifest& manifests;
+  const ChangedPathFilters& filters;
+  Stats stats;
+
+  static void addInterval(std::vector<Interval>& intervals,
+			  unsigned int start, unsigned int length,
+			  unsigned int target);
+  static bool carryThroughDiff(const FileDiff& diff, const std::string& commit,
+			       std::vector<Interval>& intervals,
+			       std::vector<Range>& ranges);
+  static bool resolveFromCache(const std::vector<Range>& cached,
+			       const std::vector<Interval>& intervals,
+			       std::vector<Range>& ranges);
+  std::string getCacheFileName(const std::string& path,
+			       const std::string& commit) const;
+  bool readCache(const std::string& path, const std::string& commit,
+		 unsigned int numLines, std::vector<Range>& ranges) const;
+  bool writeCache(const std::string& path, const std::string& commit,
+		  unsigned int numLines,
+		  const std::vector<Range>& ranges) const;
+
+ public:
+  Blame(const Tree& tree, const std::string& commitDirectory,
+	const std::string& cacheDirectory, const Manifest& manifests,
+	const ChangedPathFilters& filters);
+  // Blames the numLines lines of a file as of the commit at node. The
+  // ranges come back in order and cover every line, with neighbouring lines
+  // from the same commit in one range. returns false if the history
+  // couldn't be read or doesn't fit the file.
+  bool run(const std::string& path, int node, unsigned int numLines,
+	   std::vector<Range>& ranges);
+  const Stats& getStats() const;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef BOUNDEDQUEUE
+#define BOUNDEDQUEUE
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <queue>
+#include <utility>
+
+// Blocking queue between two threads that holds at most 'capacity' items, so a
+// fast producer can't run arbitrarily far ahead of its consumer
+template <typename T>
+class BoundedQueue {
+  std::queue<T> items;
+  const size_t capacity;
+  size_t highWaterMark;
+  bool closed;
+  std::mutex mutex;
+  std::condition_variable notEmpty;
+  std::condition_variable notFull;
+
+ public:
+  explicit BoundedQueue(size_t capacity) :
+    capacity(capacity), highWaterMark(0), closed(false) {}
+
+  void push(T item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [this] { return items.size() < capacity; });
+    items.push(std::move(item));
+    if (items.size() > highWaterMark) {
+      highWaterMark = items.size();
+    }
+    notEmpty.notify_one();
+  }
+
+  // returns false once the queue has been closed and emptied
+  bool pop(T& item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+    if (items.empty()) {
+      return false;
+    }
+
+    item = std::move(items.front());
+    items.pop();
+    notFull.notify_one();
+    return true;
+  }
+
+  // No more items will be pushed
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    notEmpty.notify_all();
+  }
+
+  size_t getHighWaterMark() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return highWaterMark;
+  }
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef CHANGEDPATHFILTERS
+#define CHANGEDPATHFILTERS
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "RecordFile.h"
+
+// A Bloom filter for each commit of the paths it added, removed or changed,
+// along with every directory they're in, so that walking the history for
+// one path can pass over the commits that certainly didn't touch it without
+// reading their info files.
+//
+// Filters are sized when the commit is made, for the false positive rate
+// asked for then, and each one records its own size and number of hashes,
+// so changing the rate only affects commits made afterwards. The bits of
+// every filter are appended to one file of words, and an index by commit id
+// says where each commit's are, both mapped in like the commit tree.
+class ChangedPathFilters {
+ public:
+  enum Answer {
+    NOT_CHANGED,
+    MAYBE_CHANGED,
+    // The commit has no filter, as it was made before there were any or
+    // changed too much to have one
+    NO_FILTER
+  };
+
+  struct Summary {
+    size_t commitsWithFilters;
+    // Changed too many paths for a filter to be worth keeping
+    size_t commitsTooLarge;
+    size_t pathsAdded;
+    size_t bitsUsed;
+  };
+
+  static const double DEFAULT_FALSE_POSITIVE_RATE;
+  // Commits changing more paths than this don't get a filter, as they'd
+  // mostly come up anyway
+  static const size_t MAX_PATHS = 2048;
+
+  struct Files {
+    const char * index;
+    const char * words;
+  };
+
+ private:
+  enum Kind : uint8_t {
+    MISSING,
+    FILTER,
+    TOO_LARGE
+  };
+
+  struct Location {
+    uint64_t firstWord;
+    uint32_t numWords;
+    uint32_t numPaths;
+    uint8_t numHashes;
+    Kind kind;
+    uint8_t unused[6];
+  };
+
+  RecordFile<Location> index;
+  RecordFile<uint64_t> words;
+
+  void setLocation(int commit, const Location& location);
+
+ public:
+  ChangedPathFilters();
+  // Missing files just mean no commit has a filter yet
+  bool load(const Files& files);
+  bool save(const Files& files);
+  bool hasUnsavedChanges() const;
+  void add(int commit, const std::vector<std::string>& changedFiles,
+	   double falsePositiveRate);
+  // Whether the commit changed the path, or anything under it if it's a
+  // directory
+  Answer query(int commit, const std::string& path) const;
+  Summary summarize() const;
+};
+
+#endif
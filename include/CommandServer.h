@@ -0,0 +1,92 @@
+#ifndef COMMANDSERVER
+#define COMMANDSERVER
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "Interpretor.h"
+#include "OperationAccumulator.h"
+
+// Keeps a project loaded between commands, serving them over a Unix socket
+// in .kil, so a command costs a round trip rather than a process start and
+// a reload. Clients (vcs <command> and vcs --batch) send their commands to
+// the server when there is one, and run them themselves when there isn't.
+//
+// Commands from different clients run one at a time, on the one accumulator:
+// even status and log fill in its caches as they go. Each client gets a
+// thread of its own for reading its commands and sending back what they
+// printed, so a slow one doesn't hold up the rest.
+//
+// The state is saved after every command. If another process (eg. the
+// interactive vcs, which never goes through the server) changes it, the
+// project is loaded afresh before the next command. The server stops once
+// no client has been connected for the idle timeout, or on SIGINT or
+// SIGTERM, finishing the commands it has been sent first.
+//
+// A client sends a line saying which output format it wants ("text" or
+// "json"), then its commands, one per line, then shuts down its side. The
+// server answers each command with "o <length>\n" and what it printed, and
+// ends with "x <exit status>\n".
+class CommandServer {
+  typedef std::chrono::steady_clock Clock;
+
+  // Enough of a stat to tell whether a file has been written
+  struct FileState {
+    bool exists;
+    ino_t inode;
+    off_t size;
+    long long modifiedNs;
+
+    bool operator!=(const FileState& other) const;
+  };
+
+  const unsigned int idleSeconds;
+  std::unique_ptr<OperationAccumulator> accumulator;
+  // As the project's state was when it was last loaded or saved. Empty if
+  // loading failed, so it's tried again.
+  std::vector<FileState> savedState;
+  // Held while a command runs
+  std::mutex commandMutex;
+  size_t commandsServed;
+
+  std::mutex connectionsMutex;
+  std::map<unsigned int, std::thread> connections;
+  std::vector<unsigned int> finishedConnections;
+  unsigned int nextConnectionId;
+  Clock::time_point lastActive;
+
+  void readState(std::vector<FileState>& state) const;
+  // Runs a command, loading the project afresh first if it has been changed
+  // from outside. Gives what it printed.
+  bool runCommand(Interpretor::OutputFormat format, const std::string& command,
+		  std::string& output);
+  void serve(unsigned int id, int fd);
+  void joinFinishedConnections();
+
+ public:
+  static const char * const SOCKET_FILE;
+  static const unsigned int DEFAULT_IDLE_SECONDS = 300;
+
+  explicit CommandServer(unsigned int idleSeconds);
+  // Serves the project in the current directory until it's been idle for
+  // long enough. returns false if it couldn't start.
+  bool run();
+
+  // A connection to the server for the project in the current directory,
+  // -1 if there isn't one running
+  static int openConnection();
+  // Sends commands (a line each) over a connection from openConnection,
+  // printing what the server sends back, and closes it. returns false if
+  // any of them failed.
+  static bool forward(int fd, const std::string& commands,
+		      Interpretor::OutputFormat format);
+};
+
+#endif
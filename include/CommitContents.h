@@ -0,0 +1,95 @@
+#ifndef COMMITCONTENTS
+#define COMMITCONTENTS
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Line.h"
+
+// The files as they were at some commit, and how to rebuild each of them.
+// Commits only store what changed since their parent, so a file's contents
+// at a commit are the snapshot taken in the commit that added it, with the
+// diffs from every later commit that changed it applied in order.
+//
+// With reverse-delta storage, commits also keep a full copy of each version
+// they write, until it's no longer any branch's latest. Once a copy goes, a
+// note names the commit with the next version, whose diff then takes it
+// back, so older versions are rebuilt from newer ones.
+class CommitContents {
+ public:
+  struct FileVersion {
+    std::string addedIn;
+    // Oldest first
+    std::vector<std::string> modifiedIn;
+
+    // Versions that were built the same way have the same contents
+    bool operator==(const FileVersion& other) const;
+    bool operator!=(const FileVersion& other) const;
+  };
+
+ private:
+  std::string commitDirectory;
+  std::unordered_map<std::string, FileVersion> files;
+
+ public:
+  explicit CommitContents(const std::string& commitDirectory);
+  // Reads the info of every commit back along the first parents of the given
+  // one. The null hash gives an empty set of files. Returns false if the
+  // history couldn't be read. When paths is given, only those files are
+  // kept track of.
+  bool load(const std::string& commit,
+	    const std::unordered_set<std::string> * paths = NULL);
+  const FileVersion * find(const std::string& path) const;
+  const std::unordered_map<std::string, FileVersion>& getFiles() const;
+  // Safe to call from several threads at once
+  bool readFile(const std::string& path, std::vector<Line>& lines) const;
+
+  // Reads the version of a file built from the snapshot and the first
+  // numDiffs diffs of version. Starts from the newest of those that has a
+  // full copy, or failing that a newer version to go back from, and only
+  // applies the diffs after it.
+  static bool readVersion(const std::string& commitDirectory,
+			  const std::string& path, const FileVersion& version,
+			  size_t numDiffs, std::vector<Line>& lines);
+  // Where a commit keeps the full copies, and the file naming the commit
+  // with the next version once a copy is gone
+  static std::string getFullCopyDirectory(const std::string& commitDirectory,
+					  const std::string& commit);
+  static std::string getNewerVersionFileName(
+      const std::string& commitDirectory, const std::string& path,
+      const std::string& commit);
+  static bool readFullCopy(const std::string& commitDirectory,
+			   const std::string& path, const std::string& commit,
+			   std::vector<Line>& lines);
+
+  // The steps readVersion takes: reads the snapshot a commit took of a file,
+  // then applies the diff to it made by each later commit that changed it
+  static bool readSnapshot(const std::string& commitDirectory,
+			   const std::string& path, const std::string& commit,
+			   std::vector<Line>& lines);
+  static bool applyDiff(const std::string& commitDirectory,
+			const std::string& path, const std::string& commit,
+			std::vector<Line>& lines,
+			bool keepLineNumbers = false);
+  // Takes the file back to how it was before the commit changed it
+  static bool unapplyDiff(const std::string& commitDirectory,
+			  const std::string& path, const std::string& commit,
+			  std::vector<Line>& lines);
+  // Follows the notes from a commit's version to the first newer one with a
+  // full copy, and takes it back from there
+  static bool readFromNewer(const std::string& commitDirectory,
+			    const std::string& path, const std::string& commit,
+			    std::vector<Line>& lines);
+  // Swaps the full copy of the version a commit wrote (and its snapshot, if
+  // it added the file) for a note naming the commit with the next version.
+  // The note goes down first, so the version can always be got back. returns
+  // false if there was no copy to swap.
+  static bool replaceFullCopy(const std::string& commitDirectory,
+			      const std::string& path,
+			      const std::string& commit, bool addedFile,
+			      const std::string& newerCommit);
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef COMMITDIFF
+#define COMMITDIFF
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "CommitContents.h"
+#include "FileDiff.h"
+#include "Line.h"
+#include "Manifest.h"
+
+// Prints the differences between the files of two commits as unified diffs,
+// one file at a time.
+//
+// How each file was built at either commit is worked out from the
+// manifests: a file's entry names the commit that wrote its contents, and
+// that commit's first parent's manifest names the one before, so only the
+// commits that changed the file are read, however many lie between the two.
+//
+// Where both versions were built on the same snapshot, only the diffs they
+// don't share are applied to their last common version, keeping track of
+// where each line came from. The lines both versions kept line them up, and
+// just what lies between them is left to the diff engine. This is never
+// more work than rebuilding both versions, which applies the same diffs
+// (and the shared ones twice), and then diffing them whole, which is what
+// happens when the versions have nothing in common to build on.
+class CommitDiff {
+ public:
+  struct Stats {
+    size_t filesComposed;
+    size_t filesDiffedWhole;
+    size_t commitsRead;
+  };
+
+ private:
+  struct CommitFiles {
+    std::string parent;
+    std::string manifest;
+    std::unordered_set<std::string> addedFiles;
+  };
+
+  struct FileVersions {
+    std::string path;
+    bool inFirst;
+    bool inSecond;
+    CommitContents::FileVersion first;
+    CommitContents::FileVersion second;
+  };
+
+  const std::string commitDirectory;
+  const Manifest& manifests;
+  std::unordered_map<std::string, CommitFiles> commits;
+  Stats stats;
+
+  const CommitFiles * readCommit(const std::string& commit);
+  bool findVersion(const std::string& commit, const std::string& path,
+		   CommitContents::FileVersion& version, bool& exists);
+  bool findVersionsFromHistory(const std::string& first,
+			       const std::string& second,
+			       std::vector<FileVersions *>& files) const;
+  bool readVersion(const std::string& path,
+		   const CommitContents::FileVersion& version,
+		   std::vector<Line>& lines) const;
+  bool compose(const FileVersions& file, std::vector<Line>& firstLines,
+	       FileDiff& diff) const;
+  bool printFile(const FileVersions& file, std::ostream& output);
+
+ public:
+  CommitDiff(const std::string& commitDirectory, const Manifest& manifests);
+  // Prints the differences in the given files, in the order given. returns
+  // false if the history couldn't be read.
+  bool print(const std::string& first, const std::string& second,
+	     const std::vector<std::string>& files, std::ostream& output);
+  const Stats& getStats() const;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef COMMITINFO
+#define COMMITINFO
+
+#include <string>
+#include <vector>
+
+// What a commit's info file (.commits/<hash>/<hash>.txt) says about it. The
+// files it lists are relative to its (first) parent: added files are
+// snapshotted in the commit's directory, and modified files have a diff there.
+class CommitInfo {
+ public:
+  std::string hash;
+  std::string message;
+  std::string branch;
+  // ROOT for the first commit
+  std::string parent;
+  // Only set for merges, which are stored relative to their first parent
+  std::string mergeParent;
+  // The commit's manifest, empty for commits made before manifests were
+  std::string manifest;
+  std::vector<std::string> children;
+  std::vector<std::string> addedFiles;
+  std::vector<std::string> removedFiles;
+  std::vector<std::string> modifiedFiles;
+
+  static std::string getFileName(const std::string& commitDirectory,
+				 const std::string& hash);
+  bool read(const std::string& fileName);
+};
+
+#endif
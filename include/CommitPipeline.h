@@ -0,0 +1,142 @@
+#ifndef COMMITPIPELINE
+#define COMMITPIPELINE
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "BatchFileWriter.h"
+#include "BoundedQueue.h"
+#include "FileDiff.h"
+#include "Line.h"
+#include "StatCache.h"
+
+// Works out what has changed in a set of files and, when committing, writes
+// the changes out. Each file passes through four stages, each on its own
+// thread and connected by bounded queues:
+//   reader  - stats the file, reads it and the version it's compared against
+//   differ  - runs the diff engine
+//   encoder - serializes the diff into the form it's stored in
+//   writer  - writes diffs and snapshots of added files into the commit,
+//             and full copies of what it wrote when asked to keep them
+// so reading one file and writing out another overlap with diffing a third.
+class CommitPipeline {
+ public:
+  enum Outcome {
+    // Stat data matches the index
+    UNCHANGED,
+    // Contents match the last commit, but the index needs refreshing
+    CONTENTS_UNCHANGED,
+    MODIFIED,
+    REMOVED,
+    ADDED,
+    // Could not be snapshotted
+    FAILED,
+    // The last committed version could not be rebuilt to diff against
+    NO_PREVIOUS_VERSION
+  };
+
+  struct Result {
+    std::string path;
+    Outcome outcome;
+    struct stat info;
+    std::string hash;
+    std::shared_ptr<FileDiff> diff;
+  };
+
+  struct StageStats {
+    std::string name;
+    size_t itemsProcessed;
+    double busyMs;
+    // Idle, with nothing to work on
+    double waitingForInputMs;
+    // Idle, with the next stage's queue full
+    double waitingForOutputMs;
+  };
+
+  struct Stats {
+    size_t queueDepth;
+    std::vector<StageStats> stages;
+    // Most items each queue held at once
+    std::vector<size_t> queueHighWaterMarks;
+  };
+
+  static const size_t DEFAULT_QUEUE_DEPTH = 16;
+
+ private:
+  struct Item {
+    std::string path;
+    bool isAddedFile;
+    Outcome outcome;
+    struct stat info;
+    std::string hash;
+    std::vector<Line> previousFile;
+    std::vector<Line> newFile;
+    std::shared_ptr<FileDiff> diff;
+    std::string encodedDiff;
+    std::string encodedFullCopy;
+  };
+
+  typedef BoundedQueue<std::unique_ptr<Item> > ItemQueue;
+
+  const StatCache& statCache;
+  const std::function<bool(const std::string&, std::string&)>
+    readCommittedHash;
+  const std::function<bool(const std::string&, std::vector<Line>&)>
+    readPreviousVersion;
+  // Creates the commit's directory the first time something needs writing
+  // into it, and returns its path. Empty when only looking for changes.
+  std::function<std::string()> getCommitDirectory;
+  std::string commitDirectory;
+  std::unique_ptr<BatchFileWriter> writer;
+  // Likewise for where the full copies go; empty unless they're kept
+  std::function<std::string()> getFullCopyDirectory;
+  std::unique_ptr<BatchFileWriter> fullCopyWriter;
+
+  const size_t queueDepth;
+  ItemQueue readQueue;
+  ItemQueue diffQueue;
+  ItemQueue encodeQueue;
+  std::vector<Result> * results;
+  Stats stats;
+
+  void runReader(const std::vector<std::string>& addedFiles,
+		 const std::vector<std::string>& trackedFiles);
+  void runDiffer();
+  void runEncoder();
+  void runWriter();
+  void readItem(Item& item) const;
+  void writeItem(Item& item);
+  BatchFileWriter * getWriter();
+  BatchFileWriter * getFullCopyWriter();
+
+ public:
+  // readCommittedHash gives the hash of a file's contents as of the last
+  // commit, which saves rebuilding it to compare against when the stat cache
+  // has nothing on the file. Both it and readPreviousVersion are only ever
+  // called from the reader's thread.
+  CommitPipeline(const StatCache& statCache,
+		 std::function<bool(const std::string&, std::string&)>
+		 readCommittedHash,
+		 std::function<bool(const std::string&, std::vector<Line>&)>
+		 readPreviousVersion,
+		 size_t queueDepth = DEFAULT_QUEUE_DEPTH);
+  // Examines trackedFiles, and when getCommitDirectory is given, snapshots
+  // addedFiles and writes out the changes. When getFullCopyDirectory is given
+  // too, the new version of every added or modified file also goes there
+  // whole. Results come back in the same order the files were given in,
+  // added files first.
+  void run(const std::vector<std::string>& addedFiles,
+	   const std::vector<std::string>& trackedFiles,
+	   std::function<std::string()> getCommitDirectory,
+	   std::function<std::string()> getFullCopyDirectory,
+	   std::vector<Result>& results);
+  const Stats& getStats() const;
+  // returns false if nothing was written
+  bool getWriteStats(BatchFileWriter::Stats& writeStats) const;
+};
+
+#endif
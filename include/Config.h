@@ -0,0 +1,25 @@
+#ifndef CONFIG
+#define CONFIG
+
+#include <map>
+#include <string>
+
+// The repository's settings, kept as name=value lines. Settings that were
+// never set aren't in the file, and whoever asks for them supplies the
+// default.
+class Config {
+  std::map<std::string, std::string> values;
+  bool dirty;
+
+ public:
+  Config();
+  // A missing file just means nothing has been set
+  bool read(const char * fileName);
+  bool save(const char * fileName);
+  bool hasUnsavedChanges() const;
+  std::string get(const std::string& name,
+		  const std::string& defaultValue) const;
+  void set(const std::string& name, const std::string& value);
+};
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef CONTENTHASH
+#define CONTENTHASH
+
+#include <string>
+#include <vector>
+
+#include "Line.h"
+
+// 64-bit FNV-1a hash of a file's contents, taken line by line so that it
+// agrees with how the rest of KIL compares files (a missing final newline does
+// not make two files differ).
+class ContentHash {
+ public:
+  static std::string ofLines(const std::vector<Line>& lines);
+  static std::string ofLines(const std::vector<std::string>& lines);
+  // returns false if the file could not be read
+  static bool ofFile(const char * fileName, std::string& hash);
+};
+
+#endif
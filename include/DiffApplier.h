@@ -3,18 +3,34 @@
 
 #include "FileDiff.h"
 
+#include <climits>
 #include <queue>
 #include <vector>
 
 class DiffApplier {
  public:
-  static void applyDiff(const std::vector<Line>& originalFile,
-			const FileDiff& diff, std::vector<Line>& newFile);
+  static const unsigned int INSERTED_LINE = UINT_MAX;
+
+  // returns false if the diff doesn't fit the original file.
+  // Lines are numbered by their place in the new file, unless
+  // keepLineNumbers is set, in which case lines carried over from the
+  // original keep their numbers and inserted ones are numbered
+  // INSERTED_LINE, so that after a chain of diffs each line says where in
+  // the first file it came from.
+  static bool applyDiff(const std::vector<Line>& originalFile,
+			const FileDiff& diff, std::vector<Line>& newFile,
+			bool keepLineNumbers = false);
+  // The other way round: rebuilds the original file from the new one. Diffs
+  // keep the text of the lines they delete, so any diff can be undone.
+  // returns false if the diff doesn't fit the new file.
+  static bool unapplyDiff(const std::vector<Line>& newFile,
+			  const FileDiff& diff,
+			  std::vector<Line>& originalFile);
   // Base file gives the original file, and acts as an output parameter
   // containing the final result
-  static void applyManyDiffs(std::vector<Line>& baseFile, const FileDiff& diff1,
+  static bool applyManyDiffs(std::vector<Line>& baseFile, const FileDiff& diff1,
 			     const FileDiff& diff2);
-  static void applyManyDiffs(std::vector<Line>& baseFile,
+  static bool applyManyDiffs(std::vector<Line>& baseFile,
 			     std::queue<FileDiff>& diffsToApply);
 };
 
@@ -12,7 +12,7 @@ enum ElementType {
 };
 
 class DiffElement {
-  const ElementType type;
+  ElementType type;
   std::vector<std::string> lines;
   // starting line is the line in the previous file this change occurs on
   unsigned int baseStartingLine;
@@ -20,10 +20,15 @@ class DiffElement {
  public:
   // constructor
   DiffElement(const ElementType type, const std::vector<Line>& linesToAdd);
+  DiffElement(const ElementType type, const unsigned int baseStartingLine,
+	      const std::vector<std::string>& lines);
   unsigned int getNumLines() const;
   const std::vector<std::string>& getLines() const;
   unsigned int getBaseStartingLine() const;
   void print(std::ostream& os) const;
+  // Reads back what print wrote
+  static bool read(std::istream& is, const ElementType type,
+		   std::vector<DiffElement>& elements);
 };
 
 #endif
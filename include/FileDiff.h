@@ -7,14 +7,19 @@
 #include "DiffElement.h"
 
 class FileDiff {
-  const std::vector<DiffElement> insertions;
-  const std::vector<DiffElement> deletions;
+  std::vector<DiffElement> insertions;
+  std::vector<DiffElement> deletions;
  public:
+  FileDiff();
   FileDiff(const std::vector<DiffElement> insertions,
 	   const std::vector<DiffElement> deletions);
   const std::vector<DiffElement>& getDeletions() const;
   const std::vector<DiffElement>& getInsertions() const;
   void print(const std::string& path) const;
+  void print(std::ostream& os) const;
+  // Reads back a diff written out by print
+  bool read(const std::string& path);
+  bool read(std::istream& is);
   bool isEmptyDiff() const;
   size_t getNumInsertions() const;
   size_t getNumDeletions() const;
@@ -4,9 +4,13 @@
 #include <string>
 #include <vector>
 
+#include <sys/stat.h>
+
 class FileSystemInterface {
 public:
   static bool fileExists(const char * fileName);
+  // returns false if the file doesn't exist
+  static bool getFileInfo(const char * fileName, struct stat& info);
   static const int createDirectory(const char * dirName);
   static const std::string appendPath(
       const std::string& firstPart, const std::string& secondPart);
@@ -14,6 +18,22 @@ public:
       const std::string& fileName, std::vector<std::string>& directories);
   static void createDirectories(
       const std::string& pathToDirectories, const std::vector<std::string> directories);
+  // Removes the directories leading to fileName, deepest first, for as long
+  // as they're empty
+  static void removeEmptyDirectories(const std::string& fileName);
+  // The names in a directory, other than . and ..; returns false if it
+  // couldn't be read
+  static bool listDirectory(const std::string& directory,
+			    std::vector<std::string>& names);
+  // Every file anywhere under a directory, by its path from there
+  static bool listFilesUnder(const std::string& directory,
+			     std::vector<std::string>& files);
+  // Removes a directory and everything in it
+  static bool removeDirectory(const std::string& directory);
+  // Copies the whole of sourceFd into destinationFd without bringing the data
+  // into userspace where possible. Where the filesystem supports it the copy
+  // shares the source's blocks (a copy-on-write reflink), and cloned is set.
+  static bool copyFileContents(int sourceFd, int destinationFd, bool& cloned);
 };
 
 #endif
@@ -0,0 +1,48 @@
+#ifndef FILEWATCHER
+#define FILEWATCHER
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Uses inotify to keep a live set of paths that may have changed since they
+// were last found to match the last commit, so that status doesn't have to
+// look at every tracked file.
+//
+// Until the first full scan has been done, or whenever events have been lost
+// (the inotify queue overflowed, or a watched directory went away), the
+// watcher can't vouch for anything and callers need to fall back to a full
+// rescan.
+class FileWatcher {
+  int inotifyFd;
+  std::unordered_map<int, std::string> directoriesByWatch;
+  std::unordered_set<std::string> watchedDirectories;
+  std::unordered_set<std::string> changedPaths;
+  bool needsFullRescan;
+
+  void watchDirectory(const std::string& directory);
+  // Whether the directories the path is in are all being watched
+  bool isWatched(const std::string& path) const;
+  // Stops watching a directory and everything under it
+  void forgetDirectory(const std::string& directory);
+  void processEvents();
+
+ public:
+  FileWatcher();
+  ~FileWatcher();
+  bool start();
+  void stop();
+  bool isRunning() const;
+  // Makes sure the directory containing the given path is watched
+  void watchPath(const std::string& path);
+  // Fills in the paths that may have changed. Returns false if a full rescan
+  // is needed instead.
+  bool getChangedPaths(std::vector<std::string>& paths);
+  // Called once a path has been found to match the last commit
+  void markClean(const std::string& path);
+  void markChanged(const std::string& path);
+  void finishFullRescan();
+};
+
+#endif
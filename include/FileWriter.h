@@ -9,6 +9,10 @@
 class FileWriter {
  public:
   static void writeFile(const char * fileName, const std::vector<std::string>& lines);
+  // Writes the lines under a temporary name and renames that into place, so
+  // the file is never seen half written. Creates any missing directories.
+  static bool replaceFile(const std::string& fileName,
+			  const std::vector<std::string>& lines);
 };
 
 #endif
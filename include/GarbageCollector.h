@@ -0,0 +1,87 @@
+#ifndef GARBAGECOLLECTOR
+#define GARBAGECOLLECTOR
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "CommitInfo.h"
+#include "Tree.h"
+
+// Clears out what no branch can get back to any more, eg. the commits a
+// reset moved a branch back past. Commits in the history of a branch tip (or
+// of one of the extra commits given) are kept; every other commit goes, with
+// its full copies, notes and cached blames, and so does every manifest
+// directory no kept commit refers to.
+//
+// With reverse-delta storage, a kept version may only be got back through a
+// commit that's going; it's given a full copy of its own first. Full copies
+// of versions that are no longer any branch's latest, and that a newer
+// version can be taken back to, are swapped for notes, as the commit that
+// made the newer version would have done had the branches been where they
+// are now.
+//
+// Working out what's kept is done whole on every run, with the reading
+// spread over a thread per core. Removing things is done a piece at a time,
+// stopping once the time budget runs out, in an order that leaves every kept
+// version readable wherever it stops, so the next run carries on from there.
+class GarbageCollector {
+ public:
+  struct Stats {
+    size_t reachableCommits;
+    size_t unreachableCommits;
+    size_t commitsRemoved;
+    size_t objectsRemoved;
+    // Kept versions that were given full copies, as the newer versions they
+    // were got back from were going
+    size_t versionsRebuilt;
+    // Ones that couldn't be, whose newer versions are kept until they are
+    size_t versionsUnreadable;
+    size_t fullCopiesReplaced;
+    double markMs;
+    double totalMs;
+    // false if it stopped for the time budget
+    bool finished;
+  };
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  const Tree& tree;
+  const std::string commitDirectory;
+  const std::string objectDirectory;
+  const std::string blameDirectory;
+  Clock::time_point start;
+  unsigned int budgetMs;
+  Stats stats;
+
+  // The info of every kept commit, by hash
+  std::unordered_map<std::string, CommitInfo> reachable;
+  // The manifest directories they refer to
+  std::unordered_set<std::string> objects;
+
+  bool outOfTime() const;
+  bool markCommits(const std::vector<std::string>& keep,
+		   std::vector<std::string>& tips);
+  bool markObjects();
+  void findUnreachableCommits(std::vector<std::string>& unreachable) const;
+  bool rebuildVersions();
+  bool removeChildren(const std::string& parent,
+		      const std::unordered_set<std::string>& children) const;
+  bool removeCommits(const std::vector<std::string>& unreachable);
+  bool removeObjects();
+  bool replaceFullCopies(const std::vector<std::string>& tips);
+
+ public:
+  GarbageCollector(const Tree& tree, const std::string& commitDirectory,
+		   const std::string& objectDirectory,
+		   const std::string& blameDirectory);
+  // A budgetMs of 0 means there's no limit. returns false if the history
+  // couldn't be read, in which case nothing is removed.
+  bool run(const std::vector<std::string>& keep, unsigned int budgetMs);
+  const Stats& getStats() const;
+};
+
+#endif
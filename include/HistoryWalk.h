@@ -0,0 +1,57 @@
+#ifndef HISTORYWALK
+#define HISTORYWALK
+
+#include <string>
+
+#include "ChangedPathFilters.h"
+#include "CommitInfo.h"
+#include "Manifest.h"
+#include "Tree.h"
+
+// Walks back from a node along first parents, handing out one commit at a
+// time. Nothing is read ahead: each commit's info is only read once the walk
+// gets to it, so how long the first one takes doesn't depend on how much
+// history lies behind it.
+//
+// Given a path, only the commits that added, removed or changed it (or,
+// for a directory, anything under it) are handed out. Commits whose
+// changed-path filter rules the path out are passed over unread. Where the
+// path is a file in a commit's manifest, the entry names the commit that
+// last wrote it, so the walk jumps straight there rather than looking at
+// every commit in between.
+class HistoryWalk {
+ public:
+  struct Stats {
+    size_t commitsRead;
+    // Passed over on the word of their filters
+    size_t commitsSkipped;
+    // Let through by their filters without having touched the path
+    size_t falsePositives;
+  };
+
+ private:
+  const Tree& tree;
+  const std::string commitDirectory;
+  const Manifest& manifests;
+  const ChangedPathFilters * filters;
+  const std::string path;
+  // The next node to look at, NO_NODE once the walk is over
+  int node;
+  bool readFailed;
+  Stats stats;
+
+  bool touchesPath(const CommitInfo& info) const;
+
+ public:
+  HistoryWalk(const Tree& tree, const std::string& commitDirectory,
+	      const Manifest& manifests, int start,
+	      const std::string& path = "",
+	      const ChangedPathFilters * filters = NULL);
+  // returns false once there are no more commits, or if one couldn't be
+  // read, which failed() tells apart
+  bool next(CommitInfo& commit);
+  bool failed() const;
+  const Stats& getStats() const;
+};
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef INTEGRITYCHECK
+#define INTEGRITYCHECK
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ChangedPathFilters.h"
+#include "CommitInfo.h"
+#include "Manifest.h"
+#include "Tree.h"
+
+// Checks everything the history of the branches depends on:
+//  - every commit's info is there, and agrees with the commit tree and with
+//    its parents' and children's
+//  - every manifest directory is there, well formed, and matches its hash
+//  - each commit's manifest changes just the files it says it changed, and
+//    its changed path filter has them all
+//  - every version of every file can be rebuilt, and comes out with the hash
+//    its manifest gives. Full copies have to match the versions rebuilt, and
+//    so do the versions reverse-delta notes take newer ones back to.
+//
+// Each version is rebuilt once, from the one before it, so the work is the
+// size of the history rather than its square. Every step is spread over a
+// thread per core, sharing nothing but counters and the list of problems.
+class IntegrityCheck {
+ public:
+  struct Progress {
+    std::string step;
+    size_t done;
+    size_t total;
+  };
+  // Called every so often while a step runs, from a thread of its own, and
+  // once more with finished set when it's done
+  typedef std::function<void(const Progress& progress, bool finished)>
+    ProgressReporter;
+
+  struct Stats {
+    size_t commitsChecked;
+    size_t directoriesChecked;
+    size_t versionsChecked;
+    // Stored, but in the history of no branch (gc removes them)
+    size_t unreachableCommits;
+    double totalMs;
+  };
+
+ private:
+  static const size_t NO_PARENT = static_cast<size_t>(-1);
+
+  struct Commit {
+    int node;
+    std::string hash;
+    // Its first parent in the commit tree, by index into commits
+    size_t parent;
+    bool readable;
+    CommitInfo info;
+  };
+
+  // A version of a file, as written by a commit
+  struct Version {
+    std::string commit;
+    bool added;
+  };
+
+  const Tree& tree;
+  const std::string commitDirectory;
+  const std::string objectDirectory;
+  const ChangedPathFilters& filters;
+  // Those in the history of a branch tip, in the order of their nodes
+  std::vector<Commit> commits;
+  std::unordered_map<std::string, size_t> commitsByHash;
+  std::mutex problemsMutex;
+  std::vector<std::string> problems;
+  Stats stats;
+
+  void addProblem(const std::string& problem);
+  void runStep(const std::string& name, size_t numItems,
+	       const ProgressReporter& report,
+	       const std::function<void(size_t)>& work);
+  void checkCommit(Commit& commit);
+  void checkChildren();
+  void checkDirectories(const ProgressReporter& report);
+  void checkChanges(const Commit& commit);
+  // The commit whose version of the file the commit changed, empty if its
+  // parent doesn't have the file
+  std::string findPreviousVersion(const Commit& commit,
+				  const std::string& path,
+				  const Manifest& manifest) const;
+  void checkVersions(const std::string& path,
+		     const std::vector<Version>& versions);
+  void countUnreachableCommits();
+
+ public:
+  IntegrityCheck(const Tree& tree, const std::string& commitDirectory,
+		 const std::string& objectDirectory,
+		 const ChangedPathFilters& filters);
+  void run(const ProgressReporter& report);
+  // In order
+  const std::vector<std::string>& getProblems() const;
+  const Stats& getStats() const;
+};
+
+#endif
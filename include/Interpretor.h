@@ -1,6 +1,8 @@
 #ifndef INTERPRETOR
 #define INTERPRETOR
 
+#include <functional>
+#include <iostream>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -8,6 +10,17 @@
 #include "OperationAccumulator.h"
 
 class Interpretor {
+ public:
+  // TEXT prints what each command has to say as it goes. JSON_LINES prints
+  // one JSON object per command once it's done:
+  //   {"command": "...", "ok": true, "branch": "...", "output": ["...", ...]}
+  // with ok false if the command was rejected or reported that it failed.
+  enum OutputFormat {
+    TEXT,
+    JSON_LINES
+  };
+
+ private:
   enum ErrorMessage {
     UNRECOGNIZED_COMMAND,
     NOT_ENOUGH_ARGS,
@@ -17,14 +30,30 @@ class Interpretor {
     PROJECT_UNINITIALIZED,
     INVALID_COMMIT_MESSAGE,
     NOTHING_TO_COMMIT,
-    UNRECOGNIZED_OPTION
+    UNRECOGNIZED_OPTION,
+    UNRESOLVED_CONFLICTS
   };
 
   std::map<ErrorMessage, const char *> errorMessages;
   
   OperationAccumulator& accumulator;
+  const OutputFormat format;
+  // Set when a command is rejected, for execute's result
+  mutable bool failed;
+  // Set while running commands that don't come from a person at the
+  // terminal, so nothing stops to ask them anything or redraws in place
+  mutable bool inBatch;
+
+  // Where to print that a command was rejected
+  std::ostream& failure() const;
+  // Runs an operation, printing its output in the chosen format. An empty
+  // command (loading or saving) only gets a JSON record if it printed
+  // something. returns false if anything failed.
+  bool record(const std::string& command,
+	      const std::function<void()>& operation) const;
 
   bool parseInit(std::istringstream& input) const;
+  bool parseClone(std::istringstream& input) const;
   bool parseFirstCommand(const std::string& command) const;
   void parseCommand(const std::string& command) const;
   void parseAdd(std::istringstream& input) const;
@@ -32,13 +61,42 @@ class Interpretor {
   void parseCommit(std::string command, std::istringstream& input) const;
   void parseStatus(std::istringstream& input) const;
   void parseCheckout(std::istringstream& input) const;
+  void parseWatch(std::istringstream& input) const;
+  void parseStats(std::istringstream& input) const;
+  void parseDebug(std::istringstream& input) const;
+  void parseDiff(std::istringstream& input) const;
+  void parseLog(std::istringstream& input) const;
+  void parseConfig(std::istringstream& input) const;
+  void parseBlame(std::istringstream& input) const;
+  void parseUndo(std::istringstream& input) const;
+  void parseReset(std::istringstream& input) const;
+  void parseGc(std::istringstream& input) const;
+  void parseFsck(std::istringstream& input) const;
+  void parseMerge(std::istringstream& input) const;
+  void parseConflicts(std::istringstream& input) const;
+  void parseResolve(std::istringstream& input) const;
   bool parseWithOrWithoutFlag(
       std::istringstream& input, const std::string& targetFlag,
       std::string& thirdArg, bool& flag) const;
   
  public:
-  Interpretor(OperationAccumulator& accumulator);
+  // batch runs every command as executeBatch would, eg. for a server, whose
+  // terminal (if it has one) has nothing to do with its clients
+  explicit Interpretor(OperationAccumulator& accumulator,
+		       OutputFormat format = TEXT, bool batch = false);
+  // Reads commands from stdin, prompting for each
   void interpret() const;
+
+  // Without prompts: loading and saving the state of the project, and
+  // running commands in between. Each returns false if it failed.
+  bool load() const;
+  bool save() const;
+  bool execute(const std::string& command) const;
+  // A command per line, until the end or q; blank lines and lines starting
+  // with # are skipped. returns false if any command failed.
+  bool executeBatch(std::istream& commands) const;
+  // Reads the next command of a batch. returns false at its end.
+  static bool readCommand(std::istream& commands, std::string& command);
 };
 
 #endif
@@ -0,0 +1,96 @@
+#ifndef MANIFEST
+#define MANIFEST
+
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// The files of a commit as a Merkle tree. Each directory is stored as an
+// object named by the hash of its listing, which gives each of its files by
+// the hash of their contents (and the commit that wrote those contents) and
+// each subdirectory by the hash of its own object; a commit's manifest is the
+// hash of its root directory.
+//
+// A directory's hash changes exactly when something under it does, so a
+// commit's manifest shares every unchanged directory with its parent's, and
+// two manifests are compared by only descending into the directories whose
+// hashes differ.
+class Manifest {
+ public:
+  struct Entry {
+    bool isDirectory;
+    std::string hash;
+    // For files, the commit whose snapshot or diff produced the contents
+    std::string commit;
+  };
+
+  // Entries by name
+  typedef std::map<std::string, Entry> Directory;
+
+  enum ChangeType {
+    ADDED,
+    REMOVED,
+    MODIFIED
+  };
+
+  struct Change {
+    std::string path;
+    ChangeType type;
+  };
+
+ private:
+  typedef std::vector<std::pair<std::string, Entry> > FileEntries;
+
+  std::string objectDirectory;
+  // Objects never change once written, so they can be kept once read.
+  // Elements of an unordered_map stay put as it grows, so pointers into it
+  // stay good. Not safe to use from several threads at once.
+  mutable std::unordered_map<std::string, Directory> directories;
+
+  bool readDirectory(const std::string& hash,
+		     const Directory *& directory) const;
+  bool writeDirectory(const Directory& directory, std::string& hash);
+  bool updateDirectory(const std::string& hash, const FileEntries& files,
+		       bool isRoot, std::string& newHash);
+  bool listFiles(const std::string& hash, const std::string& prefix,
+		 ChangeType type, std::vector<Change>& changes) const;
+  bool compareDirectories(const std::string& first, const std::string& second,
+			  const std::string& prefix,
+			  std::vector<Change>& changes) const;
+
+ public:
+  explicit Manifest(const std::string& objectDirectory);
+  const std::string& getObjectDirectory() const;
+  // Gives the files in a manifest new entries, by path. An entry with an
+  // empty hash removes the file. Only the directories on the way to the
+  // files are written out. An empty root is the manifest with no files in
+  // it.
+  bool update(const std::string& root, const std::map<std::string, Entry>& files,
+	      std::string& newRoot);
+  // returns false if the file isn't in the manifest
+  bool findFile(const std::string& root, const std::string& path,
+		Entry& entry) const;
+  // The files whose contents differ from the first manifest to the second
+  bool compare(const std::string& first, const std::string& second,
+	       std::vector<Change>& changes) const;
+  // Checks that a directory is there, is named by the hash of its listing
+  // and is well formed, and gives the hashes of the directories in it. If
+  // not, problem says what's wrong.
+  bool checkDirectory(const std::string& hash,
+		      std::vector<std::string>& subdirectories,
+		      std::string& problem) const;
+  // Forgets the directories read or written so far, for when objects may
+  // have been removed from under it
+  void clearCache();
+  // Calls visit with the hash of the root and of each directory under it,
+  // only going into the ones it returns true for. returns false if a
+  // directory couldn't be read.
+  bool walkDirectories(
+      const std::string& root,
+      const std::function<bool(const std::string&)>& visit) const;
+};
+
+#endif
@@ -2,24 +2,50 @@
 #define OPERATIONACCUMULATOR
 
 #include <fstream>
+#include <functional>
 #include <map>
+#include <memory>
 #include <string>
 #include <unordered_set>
 #include <vector>
 
+#include "BatchFileWriter.h"
+#include "Blame.h"
+#include "ChangedPathFilters.h"
+#include "CommitContents.h"
 #include "CommitHash.h"
+#include "CommitPipeline.h"
+#include "Config.h"
 #include "FileDiff.h"
+#include "FileWatcher.h"
+#include "HistoryWalk.h"
+#include "Manifest.h"
+#include "PathRegistry.h"
+#include "StatCache.h"
 #include "Tree.h"
+#include "TreeRestore.h"
 
 class OperationAccumulator {
   enum FileName {
     ADDED_FILES,
     BASIC_INFO,
+    BLAME_DIR,
     BRANCH_LIST,
+    BRANCH_TIPS,
     COMMIT_DIR,
+    COMMIT_INDEX,
+    CONFIG_FILE,
+    INDEX_FILE,
     MAIN_DIR,
+    MERGE_FILE,
+    // Where the commit tree was kept before it was stored in binary, only
+    // looked for to say that the project is too old to be read
+    OLD_TREE_FILE,
+    PATH_FILTER_INDEX,
+    PATH_FILTERS,
     TRACKED_FILES,
-    TREE_FILE
+    TREE_FILE,
+    TREE_JOURNAL
   };
   
   bool projectInit;
@@ -30,60 +56,225 @@ class OperationAccumulator {
   Tree tree;
 
   std::map<FileName, const char *> fileNames;
-  std::vector<std::string> trackedFiles;
-  std::vector<std::string> addedFiles;
-  std::unordered_set<std::string> branches;
+  // Storage for the paths in trackedFiles and addedFiles, declared first as
+  // they refer to it
+  PathPool pathPool;
+  PathRegistry trackedFiles;
+  PathRegistry addedFiles;
+  // Lets us skip reading tracked files that haven't changed. Updated by
+  // otherwise read-only queries such as status, hence mutable.
+  mutable StatCache statCache;
+  // Optional, narrows down which tracked files need looking at at all
+  mutable FileWatcher watcher;
+  // The files as of curCommit, worked out the first time they're needed
+  mutable std::unique_ptr<CommitContents> curContents;
+  // Where every commit's manifest lives
+  Manifest manifests;
+  // For passing over commits when looking for the ones that changed a path
+  ChangedPathFilters pathFilters;
+  Config config;
+
+  // A merge that stopped for conflicts to be resolved. Its commit is made by
+  // the next commit once they all have been. mergeCommit is empty when no
+  // merge is in progress.
+  std::string mergeBranch;
+  std::string mergeCommit;
+  std::vector<std::string> unresolvedConflicts;
+
+  // Which pieces of state have changed since they were read in, and so need
+  // to be written back out by saveState
+  bool basicInfoDirty;
+  bool trackedFilesDirty;
+  bool addedFilesDirty;
+  bool mergeStateDirty;
+
+  // What writing out the last commit this session cost, and how the last
+  // run of the commit pipeline went, for 'stats'
+  mutable BatchFileWriter::Stats lastCommitWriteStats;
+  mutable bool haveCommitStats;
+  mutable CommitPipeline::Stats lastPipelineStats;
+  mutable bool lastPipelineWasCommit;
+  mutable bool havePipelineStats;
+  // How the last history walk limited to a path went
+  mutable HistoryWalk::Stats lastWalkStats;
+  mutable bool haveWalkStats;
+  mutable Blame::Stats lastBlameStats;
+  mutable bool haveBlameStats;
+  // Set whenever an operation reports that it failed, for callers that
+  // don't read what it printed (batch mode)
+  mutable bool failed;
   
+  // Where to print that an operation failed
+  std::ostream& failure() const;
   void outputTrackedFiles() const;
   void outputAddedFiles() const;
   bool outputBasicInfo() const;
   bool alreadyTracked(const std::string& fileName) const;
+  bool isTrackedFile(const std::string& fileName) const;
+  bool getFilesToExamine(std::vector<std::string>& files) const;
+  void watchTrackedAndAddedFiles() const;
   void createDiff() const;
   bool readAddedAndTrackedFiles();
   void createNewCommitDirectory(
       const std::string& newCommitDirectoryPath) const;
-  void updateParentCommit(const CommitHash& childHash) const;
+  void updateParentCommit(const CommitHash& parentHash,
+			  const CommitHash& childHash) const;
   std::string calculateFileLocationForHash(const CommitHash& hash) const;
   void writeBasicCommitInfo(std::ofstream& output,
 			    const std::string& newCommitFileName,
 			    const CommitHash& hash,
 			    const std::string& commitMessage) const;
+  void runPipeline(const std::vector<std::string>& addedFilesToCommit,
+		   std::function<std::string()> getCommitDirectory,
+		   std::function<std::string()> getFullCopyDirectory,
+		   std::vector<std::string>& verifiedAddedFiles,
+		   std::vector<std::string>& removedFiles,
+		   std::vector<std::pair<std::string, FileDiff> >& diffs) const;
+  void processPipelineResults(
+      const std::vector<CommitPipeline::Result>& results,
+      std::vector<std::string>& verifiedAddedFiles,
+      std::vector<std::string>& removedFiles,
+      std::vector<std::pair<std::string, FileDiff> >& diffs) const;
   void removeDeletedFilesFromLists(
       const std::vector<std::string>& removedFiles);
-  void writeOutAddedFiles(std::ofstream& output,
-			  const std::vector<std::string>& addedFiles,
-			  const std::string& newCommitDirectoryPath) const;
   void getAddedFiles(std::vector<std::string>& verifiedAddedFiles) const;
-  void outputTree() const;
+  Tree::Files getTreeFiles() const;
+  ChangedPathFilters::Files getPathFilterFiles() const;
+  double getPathFilterRate() const;
+  bool usesReverseDeltas() const;
+  // Drops the full copies of the versions a commit's diffs replaced, where
+  // no other branch is still on them
+  void dropReplacedFullCopies(
+      const std::string& commit,
+      const std::vector<std::pair<std::string, FileDiff> >& diffs) const;
+  void addPathFilter(const CommitHash& hash,
+		     const std::vector<std::string>& addedFiles,
+		     const std::vector<std::string>& removedFiles,
+		     const std::vector<std::pair<std::string, FileDiff> >& diffs);
   bool readBasicInfo();
   bool readTree();
-  void outputBranches() const;
-  bool readInBranches();
+  void readStatCache();
+  void readMergeState();
+  void outputMergeState() const;
+  bool hasCurrentCommit() const;
+  // The commit at or above a node, the null hash if there isn't one
+  std::string getCommitAt(int node) const;
+  // returns false if the commit has no manifest
+  bool getManifest(const std::string& commit, std::string& root) const;
+  bool buildCurrentManifest(std::string& root);
+  bool buildCommitManifest(
+      const std::string& commit, const std::string& commitDirectory,
+      const std::vector<std::string>& addedFiles,
+      const std::vector<std::string>& removedFiles,
+      const std::vector<std::pair<std::string, FileDiff> >& diffs,
+      std::string& root);
+  const CommitContents * getCurrentContents() const;
+  // Given the current commit's manifest, reads a full copy of the file
+  // straight off if there is one
+  bool readPreviousVersion(const std::string& fileName,
+			   std::vector<Line>& lines,
+			   const std::string * manifestRoot = NULL) const;
+  // Like readPreviousVersion, but reads the working copy instead when it
+  // still matches
+  bool readCommittedVersion(const std::string& fileName,
+			    std::vector<Line>& lines) const;
+  bool matchesLastCommit(const std::string& fileName) const;
+  // Puts the given files back as they are at a commit, leaving alone those
+  // that already are. Tracked files the commit doesn't have are removed.
+  bool restoreFiles(const std::string& commit,
+		    const std::unordered_set<std::string>& paths,
+		    TreeRestore::Result& result) const;
+  void recordRestoredFiles(const TreeRestore::Result& result);
+  bool isMerging() const;
+  void finishMerge(const std::string& theirBranch,
+		   const std::string& theirCommit,
+		   const std::vector<std::string>& newFiles,
+		   const std::vector<std::string>& conflictedFiles);
   bool cleanState() const;
   bool filesHaveBeenAdded() const;
   bool filesHaveBeenRemovedOrModified() const;
+  // Adds the files touched by every commit from node back to, but not
+  // including, ancestor
+  bool addFilesChangedSince(int node, int ancestor,
+			    std::unordered_set<std::string>& files) const;
+  // Finds the files that may differ between the commits at two nodes
+  bool findChangedFiles(int first, int second,
+			std::unordered_set<std::string>& files) const;
+  std::string describeNode(int node) const;
+  bool findNodes(const std::string& first, const std::string& second,
+		 int& firstNode, int& secondNode) const;
   
 public:
   OperationAccumulator();
   ~OperationAccumulator();
   bool addFile(const std::string& fileName);
   void initializeProject(const std::string& projectName);
-  void saveState() const;
+  // Sets up a new project in the current directory from the one at
+  // sourcePath, sharing its store, and checks out its current commit
+  bool cloneProject(const std::string& sourcePath);
+  void saveState();
   bool initialize();
   bool isInitialized() const;
+  // Whether anything has failed since the last call
+  bool takeFailure();
+  // The files in .kil that are read in by initialize and written out by
+  // saveState, for telling whether another process has changed them
+  std::vector<std::string> getStateFiles() const;
   std::string getCurBranchName() const;
   void calculateRemovalsAndDiffs(
       std::vector<std::string>& removedFiles,
       std::vector<std::pair<std::string, FileDiff> >& diffs) const;
   bool commit(const std::string& commitMessage, const bool addFlag);
   void writeOutCommit(
-      const std::string& commitMessage,
+      const std::string& commitMessage, CommitHash * hash,
       const std::vector<std::string>& addedFiles,
       const std::vector<std::string>& removedFiles,
       const std::vector<std::pair<std::string, FileDiff> >& diffs);
   void getStatus() const;
+  // Against the current commit
+  void printDiff() const;
+  void printDiff(const std::string& first, const std::string& second) const;
+  // Newest first, along the first parents of the current commit. A
+  // maxCommits of 0 prints them all, and an empty path doesn't filter any.
+  // After every pageSize commits (if not 0), carries on only if showNextPage
+  // says to.
+  void printLog(size_t maxCommits, const std::string& path, size_t pageSize,
+		std::function<bool()> showNextPage) const;
+  // Which commit each line of the file as of the current commit came from
+  void blame(const std::string& fileName) const;
   void createNewBranch(const std::string& newBranchName);
   void switchBranch(const std::string& branchName);
+  // Puts a tracked file, or every one given an empty name, back as it was at
+  // the last commit. Added files just stop being added.
+  void undo(const std::string& fileName);
+  // Moves the current branch back to a commit in its history. hard puts the
+  // files back as they were there too; otherwise they're left as they are,
+  // and show up as changed.
+  void reset(const std::string& branchOrCommit, bool hard);
+  // Removes the commits no branch leads back to, and whatever only they
+  // use. Stops after budgetMs, if it isn't 0.
+  void collectGarbage(unsigned int budgetMs);
+  // Checks that the whole history of every branch is there and can be
+  // read back, and prints whatever is wrong. Progress is only redrawn in
+  // place if redrawProgress is set and the output is a terminal.
+  void checkIntegrity(bool redrawProgress) const;
+  void printStats() const;
+  void printMergeBase(const std::string& first,
+		      const std::string& second) const;
+  void printIsAncestor(const std::string& ancestor,
+		       const std::string& descendant) const;
+  void printManifest(const std::string& branchOrCommit) const;
+  void printPathFilters() const;
+  // Prints every setting when name is empty
+  void printSetting(const std::string& name) const;
+  void changeSetting(const std::string& name, const std::string& value);
+  void merge(const std::string& branchName);
+  bool hasUnresolvedConflicts() const;
+  void listConflicts() const;
+  // Resolves every conflict when fileName is empty
+  void resolve(const std::string& fileName);
+  bool startWatching();
+  void stopWatching();
 };
 
 #endif
@@ -0,0 +1,16 @@
+#ifndef PARALLELRUNNER
+#define PARALLELRUNNER
+
+#include <cstddef>
+#include <functional>
+
+// Runs some work on each of a number of items, on a thread per core. Items
+// are handed out one at a time, so a few slow ones don't hold up a thread's
+// share of the rest.
+class ParallelRunner {
+ public:
+  static void forEach(size_t numItems,
+		      const std::function<void(size_t)>& work);
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef PATHREGISTRY
+#define PATHREGISTRY
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Owns one copy of every distinct path string handed to it, so that the
+// registries below can refer to paths by pointer without copying them. Each
+// copy counts the references to it, and is freed along with the last, so a
+// long-lived process doesn't hold on to every path it has ever seen.
+class PathPool {
+  std::unordered_map<std::string, size_t> paths;
+ public:
+  const std::string * intern(const std::string& path);
+  // Once for every intern
+  void release(const std::string * path);
+  size_t size() const;
+};
+
+// Set of paths that remembers the order they were inserted in.
+// Lookups, insertions and removals are all O(1); removed paths leave a hole in
+// the ordered storage which is skipped over, and squeezed out once enough of
+// them build up.
+class PathRegistry {
+  struct PathHash {
+    size_t operator()(const std::string * path) const {
+      return std::hash<std::string>()(*path);
+    }
+  };
+
+  struct PathEqual {
+    bool operator()(const std::string * first,
+		    const std::string * second) const {
+      return *first == *second;
+    }
+  };
+
+  PathPool& pool;
+  std::vector<const std::string *> orderedPaths;
+  std::unordered_map<const std::string *, size_t, PathHash, PathEqual>
+    positions;
+
+  void compact();
+
+  // Copies would release the same paths twice
+  PathRegistry(const PathRegistry&);
+  PathRegistry& operator=(const PathRegistry&);
+
+ public:
+  class const_iterator
+    : public std::iterator<std::forward_iterator_tag, const std::string> {
+    std::vector<const std::string *>::const_iterator current;
+    std::vector<const std::string *>::const_iterator end;
+
+    void skipRemoved() {
+      while (current != end && *current == NULL) {
+	++current;
+      }
+    }
+
+   public:
+    const_iterator(std::vector<const std::string *>::const_iterator current,
+		   std::vector<const std::string *>::const_iterator end) :
+      current(current), end(end) {
+      skipRemoved();
+    }
+    const std::string& operator*() const { return **current; }
+    const std::string * operator->() const { return *current; }
+    const_iterator& operator++() {
+      ++current;
+      skipRemoved();
+      return *this;
+    }
+    bool operator==(const const_iterator& other) const {
+      return current == other.current;
+    }
+    bool operator!=(const const_iterator& other) const {
+      return current != other.current;
+    }
+  };
+
+  explicit PathRegistry(PathPool& pool);
+  bool contains(const std::string& path) const;
+  // returns false if the path was already there
+  bool insert(const std::string& path);
+  // returns false if the path wasn't there
+  bool remove(const std::string& path);
+  void clear();
+  size_t size() const;
+  bool empty() const;
+  const_iterator begin() const;
+  const_iterator end() const;
+};
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef RECORDFILE
+#define RECORDFILE
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "WriteJournal.h"
+
+// A file of fixed-size binary records behind a small header, mapped into
+// memory rather than read in, so that opening it costs the same no matter how
+// many records it holds; a record is only paged in when it's looked at.
+//
+// Changes are made to a private copy of the mapping and only reach the file
+// when it's saved: changed records are written back in place, and new ones
+// are appended. Files that have to stay in step with each other are saved
+// together through a WriteJournal.
+template <typename Record>
+class RecordFile {
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+  };
+
+  char magic[8];
+  uint32_t version;
+
+  void * mapping;
+  size_t mappingLength;
+  Record * mappedRecords;
+  size_t numMappedRecords;
+  // Records past the end of the mapping
+  std::vector<Record> appendedRecords;
+  // How many records the file holds, and which of those have been changed
+  size_t numRecordsOnDisk;
+  std::unordered_set<size_t> changedRecords;
+
+  RecordFile(const RecordFile&);
+  RecordFile& operator=(const RecordFile&);
+
+  void unmap() {
+    if (mapping != NULL) {
+      munmap(mapping, mappingLength);
+      mapping = NULL;
+    }
+  }
+
+  static off_t offsetOf(size_t index) {
+    return sizeof(Header) + index * sizeof(Record);
+  }
+
+ public:
+  RecordFile(const char * fileMagic, uint32_t fileVersion) :
+    version(fileVersion), mapping(NULL), mappingLength(0),
+    mappedRecords(NULL), numMappedRecords(0), numRecordsOnDisk(0) {
+    memset(magic, 0, sizeof(magic));
+    memcpy(magic, fileMagic, strnlen(fileMagic, sizeof(magic)));
+  }
+
+  ~RecordFile() {
+    unmap();
+  }
+
+  // returns false if the file is missing or isn't one of ours
+  bool open(const char * fileName) {
+    int fd = ::open(fileName, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      return false;
+    }
+
+    struct stat info;
+    Header header;
+    if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(Header) ||
+	pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+	memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+	header.version != version || header.recordSize != sizeof(Record) ||
+	(info.st_size - sizeof(Header)) % sizeof(Record) != 0) {
+      close(fd);
+      return false;
+    }
+
+    unmap();
+    appendedRecords.clear();
+    changedRecords.clear();
+    numMappedRecords = (info.st_size - sizeof(Header)) / sizeof(Record);
+    numRecordsOnDisk = numMappedRecords;
+
+    if (numMappedRecords != 0) {
+      // Private and writable, so records can be changed in memory without
+      // touching the file until we save
+      mappingLength = info.st_size;
+      mapping = mmap(NULL, mappingLength, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		     fd, 0);
+      if (mapping == MAP_FAILED) {
+	mapping = NULL;
+	close(fd);
+	return false;
+      }
+      mappedRecords = (Record *) ((char *) mapping + sizeof(Header));
+    }
+
+    close(fd);
+    return true;
+  }
+
+  // The writes that would bring the file up to date, for saving it along
+  // with others through a WriteJournal. markSaved once they've been made.
+  void getUnsavedWrites(const char * fileName,
+			std::vector<WriteJournal::Write>& writes) const {
+    if (changedRecords.empty() && numRecordsOnDisk == size() &&
+	numRecordsOnDisk != 0) {
+      return;
+    }
+
+    WriteJournal::Write write;
+    write.fileName = fileName;
+    if (numRecordsOnDisk == 0) {
+      Header header;
+      memcpy(header.magic, magic, sizeof(magic));
+      header.version = version;
+      header.recordSize = sizeof(Record);
+      write.offset = 0;
+      write.data.assign((const char *) &header, sizeof(header));
+      writes.push_back(write);
+    }
+
+    for (size_t index : changedRecords) {
+      write.offset = offsetOf(index);
+      write.data.assign((const char *) &get(index), sizeof(Record));
+      writes.push_back(write);
+    }
+
+    // New records all sit at the end of the appended ones
+    if (numRecordsOnDisk < size()) {
+      const size_t firstNewRecord = numRecordsOnDisk - numMappedRecords;
+      write.offset = offsetOf(numRecordsOnDisk);
+      write.data.assign((const char *) &appendedRecords[firstNewRecord],
+			(appendedRecords.size() - firstNewRecord) *
+			sizeof(Record));
+      writes.push_back(write);
+    }
+  }
+
+  void markSaved() {
+    changedRecords.clear();
+    numRecordsOnDisk = size();
+  }
+
+  // Saves this file on its own
+  bool save(const char * fileName) {
+    std::vector<WriteJournal::Write> writes;
+    getUnsavedWrites(fileName, writes);
+    if (!WriteJournal::write(writes)) {
+      return false;
+    }
+
+    markSaved();
+    return true;
+  }
+
+  bool hasUnsavedChanges() const {
+    return !changedRecords.empty() || numRecordsOnDisk != size();
+  }
+
+  size_t size() const {
+    return numMappedRecords + appendedRecords.size();
+  }
+
+  const Record& get(size_t index) const {
+    if (index < numMappedRecords) {
+      return mappedRecords[index];
+    }
+    return appendedRecords[index - numMappedRecords];
+  }
+
+  void set(size_t index, const Record& record) {
+    if (index < numMappedRecords) {
+      mappedRecords[index] = record;
+    } else {
+      appendedRecords[index - numMappedRecords] = record;
+    }
+
+    if (index < numRecordsOnDisk) {
+      changedRecords.insert(index);
+    }
+  }
+
+  void append(const Record& record) {
+    appendedRecords.push_back(record);
+  }
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef STATCACHE
+#define STATCACHE
+
+#include <string>
+#include <unordered_map>
+
+#include <sys/stat.h>
+
+// Persistent index of what each tracked file looked like (size, mtime, inode)
+// the last time its contents were known to match the last commit, along with
+// a hash of those contents. If a file's stat data still matches its entry, it
+// hasn't changed and doesn't need to be read.
+//
+// A file modified just before we stat'ed it could be modified again within
+// the same timestamp tick without its stat data changing ("racily clean").
+// Entries for such files are recorded with a size of -1, so they never match
+// and get re-hashed the next time they're looked at.
+class StatCache {
+ public:
+  struct Entry {
+    long long size;
+    long long mtimeNs;
+    unsigned long long inode;
+    std::string hash;
+  };
+
+ private:
+  std::unordered_map<std::string, Entry> entries;
+  // Entries for files whose new contents are about to be committed. They only
+  // replace the real entries once the commit has been written out.
+  std::unordered_map<std::string, Entry> stagedEntries;
+  bool dirty;
+
+  static Entry makeEntry(const struct stat& info, const std::string& hash);
+
+ public:
+  StatCache();
+  bool read(const char * fileName);
+  bool write(const char * fileName);
+  bool isDirty() const;
+  const Entry * find(const std::string& path) const;
+  // true if the stat data matches the entry closely enough that the file can
+  // be assumed unchanged without reading it
+  bool isUnchanged(const std::string& path, const struct stat& info) const;
+  void record(const std::string& path, const struct stat& info,
+	      const std::string& hash);
+  void stage(const std::string& path, const struct stat& info,
+	     const std::string& hash);
+  const Entry * findStaged(const std::string& path) const;
+  void applyStaged();
+  void clearStaged();
+  void remove(const std::string& path);
+  static long long getMtimeNs(const struct stat& info);
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef STORELINKER
+#define STORELINKER
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Fills a new repository's store from one that's already on this machine.
+// Nothing in .commits, .manifests or .blame is changed once it's written -
+// new commits go in directories of their own, and whatever is rewritten is
+// replaced by renaming a new file over it - so the two repositories can share
+// those files. Each is hard linked; where that can't be done (eg. across file
+// systems) it's cloned copy-on-write, and failing that copied.
+class StoreLinker {
+ public:
+  struct Stats {
+    size_t directoriesCreated;
+    size_t filesLinked;
+    size_t filesCloned;
+    size_t filesCopied;
+  };
+
+ private:
+  std::atomic<size_t> filesLinked;
+  std::atomic<size_t> filesCloned;
+  std::atomic<size_t> filesCopied;
+  size_t directoriesCreated;
+
+  // Makes the directories under source in destination, and adds the files
+  // under it (relative to source) to files
+  bool collect(const std::string& source, const std::string& destination,
+	       const std::string& relativePath,
+	       std::vector<std::string>& files);
+  bool copyFile(const std::string& source, const std::string& destination,
+		bool& cloned);
+
+ public:
+  StoreLinker();
+  // Links every file under sourceDirectory into destinationDirectory, which
+  // is created, on a thread per core
+  bool linkDirectory(const std::string& sourceDirectory,
+		     const std::string& destinationDirectory);
+  // For files that are changed in place, so can't be shared. Clones them
+  // where the file system can.
+  bool copyFile(const std::string& source, const std::string& destination);
+  Stats getStats() const;
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef THREEWAYMERGE
+#define THREEWAYMERGE
+
+#include <string>
+#include <vector>
+
+#include "FileDiff.h"
+#include "Line.h"
+
+// Merges two versions of a file that both descend from a common base, diff3
+// style: each side is diffed against the base, changes only one side made are
+// taken as they are, and where both sides changed the same lines differently
+// the result holds both versions between conflict markers.
+class ThreeWayMerge {
+  // A run of base lines [baseStart, baseEnd) that one side replaced with
+  // lines. Insertions are hunks with baseStart == baseEnd.
+  struct Hunk {
+    unsigned int baseStart;
+    unsigned int baseEnd;
+    std::vector<std::string> lines;
+  };
+
+  static void getHunks(const FileDiff& diff, std::vector<Hunk>& hunks);
+  static bool overlap(unsigned int firstStart, unsigned int firstEnd,
+		      unsigned int secondStart, unsigned int secondEnd);
+  static void applyHunks(const std::vector<Line>& base, unsigned int start,
+			 unsigned int end, const std::vector<Hunk>& hunks,
+			 size_t firstHunk, size_t lastHunk,
+			 std::vector<std::string>& lines);
+
+ public:
+  // Returns the number of conflicting regions
+  static size_t merge(const std::vector<Line>& base,
+		      const std::vector<Line>& ours,
+		      const std::vector<Line>& theirs,
+		      const std::string& ourLabel,
+		      const std::string& theirLabel,
+		      std::vector<std::string>& merged);
+  // true if the lines contain a conflict marker left by merge
+  static bool hasConflictMarkers(const std::vector<std::string>& lines);
+};
+
+#endif
@@ -1,28 +1,131 @@
 #ifndef TREE
 #define TREE
 
+#include <cstdint>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "CommitHash.h"
-#include "TreeNode.h"
+#include "RecordFile.h"
+#include "WriteJournal.h"
 
+// The history of the project. Every node is either a commit, or the point a
+// new branch was created from (a "branch node", which carries nothing but the
+// name of the new branch).
+//
+// Nodes are identified by their index, in the order they were created, and
+// are kept as fixed-size records in a binary file that is mapped in rather
+// than parsed, so loading the tree doesn't depend on how long the history is;
+// only the nodes a command actually visits are ever read.
 class Tree {
-  TreeNode * root;
-  TreeNode * curNode;
+  struct Node {
+    int32_t parent;
+    int32_t firstChild;
+    int32_t lastChild;
+    int32_t nextSibling;
+    uint32_t branchId;
+    // NO_COMMIT for branch nodes
+    int32_t commit;
+    // The other parent of a merge, NO_NODE for everything else
+    int32_t mergeParent;
+    // One more than the largest generation of the node's parents, so an
+    // ancestor always has a smaller generation than its descendants
+    uint32_t generation;
+  };
 
+  RecordFile<Node> nodes;
+  // Commit ids are handed out sequentially, so they index straight into this
+  RecordFile<int32_t> nodesByCommit;
+  // The node each branch is on, by branch id: the most recently created one
+  // on it, unless the branch has been moved back since
+  RecordFile<int32_t> branchTips;
+
+  // Branch names, by branch id. There are few enough of these that they're
+  // read in whole; the branch list is append-only, so the first
+  // numSavedBranches are already on disk.
+  std::vector<std::string> branchNames;
+  std::unordered_map<std::string, unsigned int> branchIdsByName;
+  size_t numSavedBranches;
+
+  int curNode;
+
+  bool isValidNode(int node) const;
   bool determineCurrentNode(const std::string& branch,
 			    const std::string& commit);
+  unsigned int getBranchId(const std::string& branch);
+  int addNode(unsigned int branchId, int commit, int parent);
+  void getParents(int node, int parents[2]) const;
+  bool readBranchList(const char * fileName);
+  void getBranchListWrites(const char * fileName,
+			   std::vector<WriteJournal::Write>& writes) const;
   
 public:
+  static const int NO_NODE = -1;
+  static const int NO_COMMIT = -1;
+
+  // Where the tree lives on disk
+  struct Files {
+    const char * nodes;
+    const char * commitIndex;
+    const char * branchTips;
+    const char * branchList;
+    // Only there while the others are being saved
+    const char * journal;
+  };
+
   Tree();
   void initialize(const std::string& firstBranch);
+  // The branch mustn't exist yet
   void registerNewBranch(const std::string& newBranch);
-  void addCommit(const CommitHash& commit);
-  void getPrintableTree(std::vector<std::string>& lines) const;
-  bool initializeTree(const std::vector<std::string>& lines,
-		      const std::string& branch, const std::string& commit);
-  ~Tree();
+  // Moves onto the tip of an existing branch
+  bool switchToBranch(const std::string& branch);
+  // Moves the current branch back to a node in its history. A node on some
+  // other branch gets a branch node of the current branch put on top, so
+  // that commits made from there still go on the current branch.
+  void moveCurrentBranch(int node);
+  // mergeParent is the other side's node when the commit is a merge
+  void addCommit(const CommitHash& commit, int mergeParent = NO_NODE);
+  bool hasUnsavedChanges() const;
+  // The files are saved all or nothing, and a save that was cut short is
+  // finished off by the next load
+  bool save(const Files& files);
+  bool load(const Files& files, const std::string& branch,
+	    const std::string& commit);
+  // All return NO_NODE if there is no such commit/branch
+  int findCommit(const std::string& commit) const;
+  int getBranchTip(const std::string& branch) const;
+  const std::vector<std::string>& getBranchNames() const;
+  // Branch names are looked up first, then commit ids
+  int findNode(const std::string& branchOrCommit) const;
+  // The nearest commit at or above the given node, NO_NODE if there isn't one
+  int findNearestCommit(int node) const;
+  // Both walk back from the given nodes in order of decreasing generation,
+  // stopping as soon as the answer is known, so they only visit the nodes
+  // between the ones asked about rather than the whole history.
+  // nodesVisited, if given, is set to how many nodes were looked at.
+  int findMergeBase(int first, int second,
+		    size_t * nodesVisited = NULL) const;
+  bool isAncestor(int ancestor, int node,
+		  size_t * nodesVisited = NULL) const;
+  // The nearest node on the first-parent chains of both given nodes. A
+  // commit's files only depend on its first-parent chain, so only the
+  // commits between the two nodes and this one can account for any
+  // difference between them.
+  int findFirstParentFork(int first, int second) const;
+  // By node, whether it's in the history of a branch tip or of one of the
+  // given nodes
+  std::vector<bool> findReachable(const std::vector<int>& extraNodes) const;
+  size_t getNumNodes() const;
+  int getCurrentNode() const;
+  int getParent(int node) const;
+  int getFirstChild(int node) const;
+  int getNextSibling(int node) const;
+  const std::string& getBranch(int node) const;
+  bool isBranchNode(int node) const;
+  int getCommit(int node) const;
+  int getMergeParent(int node) const;
+  unsigned int getGeneration(int node) const;
 };
 
 #endif
@@ -0,0 +1,36 @@
+#ifndef TREECHECKOUT
+#define TREECHECKOUT
+
+#include <string>
+#include <vector>
+
+#include "CommitContents.h"
+#include "StatCache.h"
+#include "TreeRestore.h"
+
+// Moves the working directory, which must match the contents of one commit,
+// onto those of another. Files whose version is the same in both are never
+// touched, so their stat data stays as it was. The rest are rebuilt and
+// atomically replaced, or removed, by a TreeRestore; a rebuilt file the stat
+// cache shows is already there as it should be is left alone too.
+class TreeCheckout {
+ public:
+  typedef TreeRestore::UpdatedFile UpdatedFile;
+  typedef TreeRestore::Result Result;
+
+ private:
+  const CommitContents& current;
+  const CommitContents& target;
+  const StatCache& statCache;
+
+  void planFiles(std::vector<TreeRestore::File>& files) const;
+
+ public:
+  // Either may have been loaded with only some paths; files missing from
+  // both are left alone
+  TreeCheckout(const CommitContents& current, const CommitContents& target,
+	       const StatCache& statCache);
+  void run(Result& result) const;
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef TREEMERGE
+#define TREEMERGE
+
+#include <string>
+#include <vector>
+
+#include "CommitContents.h"
+
+// Merges the files of another commit ("theirs") into the working directory,
+// which must match the current commit ("ours"), given the contents of both
+// and of their merge base. Which files need work is decided from how each
+// version was built, without reading anything; the files that then need
+// their contents rebuilt or merged are spread over a pool of threads.
+class TreeMerge {
+ public:
+  struct Result {
+    // Files written with their new contents
+    std::vector<std::string> updatedFiles;
+    // Those of the updated files which this side didn't have
+    std::vector<std::string> newFiles;
+    std::vector<std::string> removedFiles;
+    // Files with conflict markers in, or that one side changed and the
+    // other deleted
+    std::vector<std::string> conflictedFiles;
+    // Could not be read or written
+    std::vector<std::string> failedFiles;
+  };
+
+ private:
+  enum Action {
+    // Only they changed the file, or only they have it
+    TAKE_THEIRS,
+    // They deleted it, and we didn't change it
+    REMOVE,
+    // Both changed it
+    MERGE,
+    // We changed it and they deleted it, so it's left as it is
+    KEEP_OURS_CONFLICT,
+    // We deleted it and they changed it, so it comes back
+    TAKE_THEIRS_CONFLICT
+  };
+
+  enum Outcome {
+    DONE,
+    CONFLICTED,
+    FAILED
+  };
+
+  struct Job {
+    std::string path;
+    Action action;
+    bool oursHasFile;
+    Outcome outcome;
+  };
+
+  const CommitContents& base;
+  const CommitContents& ours;
+  const CommitContents& theirs;
+  const std::string ourLabel;
+  const std::string theirLabel;
+
+  void planJobs(std::vector<Job>& jobs) const;
+  void runJob(Job& job) const;
+
+ public:
+  TreeMerge(const CommitContents& base, const CommitContents& ours,
+	    const CommitContents& theirs, const std::string& ourLabel,
+	    const std::string& theirLabel);
+  void run(Result& result) const;
+};
+
+#endif
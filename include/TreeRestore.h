@@ -0,0 +1,76 @@
+#ifndef TREERESTORE
+#define TREERESTORE
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "Line.h"
+#include "StatCache.h"
+
+// Brings files in the working directory to the contents they should have,
+// spread over a pool of threads. Each one is written under a temporary name
+// and renamed into place, so it's never seen half written, and only if what's
+// there differs: a file the stat cache vouches for, or whose contents hash to
+// what's wanted, is left alone.
+class TreeRestore {
+ public:
+  struct File {
+    std::string path;
+    bool remove;
+    // What the contents should hash to, if known up front, which saves
+    // rebuilding the version for files that already have it
+    std::string hash;
+  };
+
+  struct UpdatedFile {
+    std::string path;
+    // What the file looked like once written, for the stat cache
+    struct stat info;
+    std::string hash;
+  };
+
+  struct Result {
+    // Files written with the wanted contents
+    std::vector<UpdatedFile> updatedFiles;
+    // Already had them, though the stat cache didn't know it
+    std::vector<UpdatedFile> verifiedFiles;
+    std::vector<std::string> removedFiles;
+    // Could not be rebuilt, written or removed
+    std::vector<std::string> failedFiles;
+  };
+
+ private:
+  enum Outcome {
+    WRITTEN,
+    VERIFIED,
+    REMOVED,
+    ALREADY_UP_TO_DATE,
+    FAILED
+  };
+
+  struct Job {
+    UpdatedFile file;
+    const File * wanted;
+    Outcome outcome;
+  };
+
+  const std::function<bool(const std::string&, std::vector<Line>&)>
+    readVersion;
+  const StatCache& statCache;
+
+  bool isAlreadyWritten(const std::string& path,
+			const std::string& hash) const;
+  void runJob(Job& job) const;
+
+ public:
+  // readVersion gives the contents a file should have, and is called from
+  // several threads at once
+  TreeRestore(std::function<bool(const std::string&, std::vector<Line>&)>
+	      readVersion, const StatCache& statCache);
+  void run(const std::vector<File>& files, Result& result) const;
+};
+
+#endif
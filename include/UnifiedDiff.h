@@ -0,0 +1,28 @@
+#ifndef UNIFIEDDIFF
+#define UNIFIEDDIFF
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "FileDiff.h"
+#include "Line.h"
+
+// Prints the changes to a file in the unified diff format, with a few lines
+// of unchanged context around each group of changes.
+class UnifiedDiff {
+  static void printHeader(std::ostream& output, const std::string& path,
+			  bool oldExists, bool newExists);
+
+ public:
+  static const size_t CONTEXT_LINES = 3;
+
+  static void print(std::ostream& output, const std::string& path,
+		    const std::vector<Line>& oldFile, const FileDiff& diff);
+  static void printAdded(std::ostream& output, const std::string& path,
+			 const std::vector<Line>& newFile);
+  static void printRemoved(std::ostream& output, const std::string& path,
+			   const std::vector<Line>& oldFile);
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef WRITEJOURNAL
+#define WRITEJOURNAL
+
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+// Makes a set of writes to several files all or nothing, without rewriting
+// the files whole. The writes are recorded in the journal first, then made,
+// then the journal is removed. If that's cut short, replaying the journal
+// (when the files are next opened) makes all of them again; a journal that
+// was itself cut short is thrown away, as none of its writes were made yet.
+//
+// This covers the process stopping part way, not the machine: like the rest
+// of .kil, nothing is synced to disk.
+class WriteJournal {
+ public:
+  struct Write {
+    std::string fileName;
+    off_t offset;
+    std::string data;
+  };
+
+  // Makes the writes as they are, with no journal
+  static bool write(const std::vector<Write>& writes);
+  // returns false if the writes couldn't all be made, in which case the
+  // journal is left for replay to finish them
+  static bool apply(const char * journalFile,
+		    const std::vector<Write>& writes);
+  // Finishes any writes an earlier apply was cut short in. returns false if
+  // there were some that couldn't be made.
+  static bool replay(const char * journalFile);
+};
+
+#endif
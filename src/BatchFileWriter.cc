@@ -0,0 +1,195 @@
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "BatchFileWriter.h"
+#include "FileSystemInterface.h"
+
+using namespace std;
+
+// Keeps us well clear of the default open file limit
+static const size_t MAX_OPEN_DIRECTORIES = 256;
+
+static void splitPath(const string& path, string& directory, string& name) {
+  size_t locationOfSlash = path.rfind('/');
+  if (locationOfSlash == string::npos) {
+    directory = "";
+    name = path;
+  } else {
+    directory = path.substr(0, locationOfSlash);
+    name = path.substr(locationOfSlash + 1);
+  }
+}
+
+BatchFileWriter::BatchFileWriter(const string& rootDirectory) {
+  stats.mkdirCalls = 0;
+  stats.openCalls = 1;
+  stats.writeCalls = 0;
+  stats.filesCopied = 0;
+  stats.filesCloned = 0;
+  stats.filesLinked = 0;
+  stats.directoriesCreated = 0;
+  stats.filesWritten = 0;
+
+  rootFd = open(rootDirectory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+BatchFileWriter::~BatchFileWriter() {
+  closeDirectoryFds();
+  if (rootFd != -1) {
+    close(rootFd);
+  }
+}
+
+bool BatchFileWriter::isOpen() const {
+  return rootFd != -1;
+}
+
+void BatchFileWriter::closeDirectoryFds() {
+  for (const pair<const string, int>& directoryAndFd : directoryFds) {
+    close(directoryAndFd.second);
+  }
+  directoryFds.clear();
+}
+
+int BatchFileWriter::getDirectoryFd(const string& directory) {
+  if (directory.empty()) {
+    return rootFd;
+  }
+
+  unordered_map<string, int>::const_iterator it = directoryFds.find(directory);
+  if (it != directoryFds.end()) {
+    return it->second;
+  }
+
+  string parent;
+  string name;
+  splitPath(directory, parent, name);
+
+  int parentFd = getDirectoryFd(parent);
+  if (parentFd == -1) {
+    return -1;
+  }
+
+  if (createdDirectories.count(directory) == 0) {
+    ++stats.mkdirCalls;
+    if (mkdirat(parentFd, name.c_str(),
+		S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == 0) {
+      ++stats.directoriesCreated;
+    } else if (errno != EEXIST) {
+      return -1;
+    }
+    createdDirectories.insert(directory);
+  }
+
+  ++stats.openCalls;
+  int fd = openat(parentFd, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) {
+    return -1;
+  }
+
+  if (directoryFds.size() >= MAX_OPEN_DIRECTORIES) {
+    // parentFd may be one of these, but we're done with it
+    closeDirectoryFds();
+  }
+  directoryFds[directory] = fd;
+  return fd;
+}
+
+int BatchFileWriter::openFile(const string& path) {
+  string directory;
+  string name;
+  splitPath(path, directory, name);
+
+  int directoryFd = getDirectoryFd(directory);
+  if (directoryFd == -1) {
+    return -1;
+  }
+
+  ++stats.openCalls;
+  return openat(directoryFd, name.c_str(),
+		O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+}
+
+bool BatchFileWriter::writeFile(const string& path, const string& contents) {
+  int fd = openFile(path);
+  if (fd == -1) {
+    return false;
+  }
+
+  size_t written = 0;
+  while (written < contents.length()) {
+    ++stats.writeCalls;
+    ssize_t result = write(fd, contents.data() + written,
+			   contents.length() - written);
+    if (result == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      close(fd);
+      return false;
+    }
+    written += result;
+  }
+
+  close(fd);
+  ++stats.filesWritten;
+  return true;
+}
+
+bool BatchFileWriter::copyFile(const string& sourcePath, const string& path) {
+  ++stats.openCalls;
+  int sourceFd = open(sourcePath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (sourceFd == -1) {
+    return false;
+  }
+
+  int fd = openFile(path);
+  if (fd == -1) {
+    close(sourceFd);
+    return false;
+  }
+
+  bool cloned;
+  bool copied = FileSystemInterface::copyFileContents(sourceFd, fd, cloned);
+  close(sourceFd);
+  close(fd);
+
+  if (!copied) {
+    return false;
+  }
+
+  ++stats.filesCopied;
+  if (cloned) {
+    ++stats.filesCloned;
+  }
+  ++stats.filesWritten;
+  return true;
+}
+
+bool BatchFileWriter::linkFile(const string& sourcePath, const string& path) {
+  string directory;
+  string name;
+  splitPath(path, directory, name);
+
+  int directoryFd = getDirectoryFd(directory);
+  if (directoryFd == -1) {
+    return false;
+  }
+
+  // Eg. across file systems, or on one without hard links
+  if (linkat(AT_FDCWD, sourcePath.c_str(), directoryFd, name.c_str(), 0) !=
+      0) {
+    return copyFile(sourcePath, path);
+  }
+
+  ++stats.filesLinked;
+  ++stats.filesWritten;
+  return true;
+}
+
+const BatchFileWriter::Stats& BatchFileWriter::getStats() const {
+  return stats;
+}
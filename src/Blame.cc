@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <fstream>
+
+#include "Blame.h"
+#include "CommitInfo.h"
+#include "FileSystemInterface.h"
+#include "FileWriter.h"
+#include "HistoryWalk.h"
+
+using namespace std;
+
+namespace {
+  // A stretch of the new version of a file, as a diff made it: either lines
+  // the diff inserted, or lines carried over from the old version
+  struct Piece {
+    unsigned int newStart;
+    unsigned int length;
+    bool inserted;
+    unsigned int oldStart;
+  };
+
+  void addPiece(vector<Piece>& pieces, unsigned int& newPosition,
+		unsigned int length, bool inserted, unsigned int oldStart) {
+    Piece piece;
+    piece.newStart = newPosition;
+    piece.length = length;
+    piece.inserted = inserted;
+    piece.oldStart = oldStart;
+    pieces.push_back(piece);
+    newPosition += length;
+  }
+
+  // Splits the new version of the file into pieces at the diff's hunks. The
+  // diff doesn't say how long the old version was, so the last piece
+  // carries over everything after the last hunk. Returns false if the diff's
+  // elements aren't in order.
+  bool splitAtHunks(const FileDiff& diff, vector<Piece>& pieces) {
+    const vector<DiffElement>& insertions = diff.getInsertions();
+    const vector<DiffElement>& deletions = diff.getDeletions();
+    size_t nextInsertion = 0;
+    size_t nextDeletion = 0;
+    unsigned int oldPosition = 0;
+    unsigned int newPosition = 0;
+
+    while (nextInsertion < insertions.size() ||
+	   nextDeletion < deletions.size()) {
+      // Insertions go before the line they're numbered with, so they come
+      // before a deletion starting on the same line
+      const bool isInsertion = nextDeletion == deletions.size() ||
+	(nextInsertion < insertions.size() &&
+	 insertions[nextInsertion].getBaseStartingLine() <=
+	 deletions[nextDeletion].getBaseStartingLine());
+      const DiffElement& element = isInsertion ?
+	insertions[nextInsertion] : deletions[nextDeletion];
+      const unsigned int base = element.getBaseStartingLine();
+
+      // Insertions may land in the middle of lines that were deleted, but
+      // deletions can't overlap
+      if (!isInsertion && base < oldPosition) {
+	return false;
+      }
+      if (base > oldPosition) {
+	addPiece(pieces, newPosition, base - oldPosition, false, oldPosition);
+	oldPosition = base;
+      }
+
+      if (isInsertion) {
+	addPiece(pieces, newPosition, element.getNumLines(), true, 0);
+	++nextInsertion;
+      } else {
+	oldPosition += element.getNumLines();
+	++nextDeletion;
+      }
+    }
+
+    addPiece(pieces, newPosition, UINT_MAX - newPosition, false, oldPosition);
+    return true;
+  }
+
+  void addRange(vector<Blame::Range>& ranges, unsigned int start,
+		unsigned int length, const string& commit) {
+    Blame::Range range;
+    range.start = start;
+    range.length = length;
+    range.commit = commit;
+    ranges.push_back(range);
+  }
+}
+
+Blame::Blame(const Tree& tree, const string& commitDirectory,
+	     const string& cacheDirectory, const Manifest& manifests,
+	     const ChangedPathFilters& filters) :
+  tree(tree), commitDirectory(commitDirectory),
+  cacheDirectory(cacheDirectory), manifests(manifests), filters(filters) {
+  stats.diffsRead = 0;
+  stats.commitsRead = 0;
+}
+
+void Blame::addInterval(vector<Interval>& intervals, unsigned int start,
+			unsigned int length, unsigned int target) {
+  // Runs of lines that stay together through a diff stay one interval
+  if (!intervals.empty()) {
+    Interval& last = intervals.back();
+    if (last.start + last.length == start &&
+	last.target + last.length == target) {
+      last.length += length;
+      return;
+    }
+  }
+
+  Interval interval;
+  interval.start = start;
+  interval.length = length;
+  interval.target = target;
+  intervals.push_back(interval);
+}
+
+bool Blame::carryThroughDiff(const FileDiff& diff, const string& commit,
+			     vector<Interval>& intervals,
+			     vector<Range>& ranges) {
+  vector<Piece> pieces;
+  if (!splitAtHunks(diff, pieces)) {
+    return false;
+  }
+
+  // Both are in order, and the pieces cover every line, so one pass over
+  // each does
+  vector<Interval> carried;
+  size_t nextPiece = 0;
+  for (const Interval& interval : intervals) {
+    unsigned int position = interval.start;
+    const unsigned int end = interval.start + interval.length;
+    while (position < end) {
+      while (pieces[nextPiece].newStart + pieces[nextPiece].length <=
+	     position) {
+	++nextPiece;
+      }
+      const Piece& piece = pieces[nextPiece];
+      const unsigned int partEnd = min(end, piece.newStart + piece.length);
+      const unsigned int target = interval.target +
+	(position - interval.start);
+
+      if (piece.inserted) {
+	addRange(ranges, target, partEnd - position, commit);
+      } else {
+	addInterval(carried, piece.oldStart + (position - piece.newStart),
+		    partEnd - position, target);
+      }
+      position = partEnd;
+    }
+  }
+
+  intervals.swap(carried);
+  return true;
+}
+
+bool Blame::resolveFromCache(const vector<Range>& cached,
+			     const vector<Interval>& intervals,
+			     vector<Range>& ranges) {
+  size_t nextRange = 0;
+  for (const Interval& interval : intervals) {
+    unsigned int position = interval.start;
+    const unsigned int end = interval.start + interval.length;
+    while (position < end) {
+      while (nextRange < cached.size() &&
+	     cached[nextRange].start + cached[nextRange].length <= position) {
+	++nextRange;
+      }
+      // Lines the cached blame doesn't know of mean it isn't of this version
+      if (nextRange == cached.size() ||
+	  cached[nextRange].start > position) {
+	return false;
+      }
+
+      const Range& range = cached[nextRange];
+      const unsigned int partEnd = min(end, range.start + range.length);
+      addRange(ranges, interval.target + (position - interval.start),
+	       partEnd - position, range.commit);
+      position = partEnd;
+    }
+  }
+
+  return true;
+}
+
+string Blame::getCacheFileName(const string& path,
+			       const string& commit) const {
+  // The suffix keeps a file's entry from clashing with a directory of the
+  // same name at some other commit
+  return FileSystemInterface::appendPath(
+      FileSystemInterface::appendPath(cacheDirectory, commit),
+      path + ".blame");
+}
+
+bool Blame::readCache(const string& path, const string& commit,
+		      unsigned int numLines, vector<Range>& ranges) const {
+  ifstream input(getCacheFileName(path, commit));
+  string line;
+  unsigned int cachedLines;
+  if (!input || !getline(input, line) ||
+      sscanf(line.c_str(), "lines=%u", &cachedLines) != 1 ||
+      (numLines != UINT_MAX && cachedLines != numLines)) {
+    return false;
+  }
+
+  // The ranges have to cover every line, in order
+  ranges.clear();
+  unsigned int covered = 0;
+  Range range;
+  while (input >> range.start >> range.length >> range.commit) {
+    if (range.start != covered || range.length == 0) {
+      return false;
+    }
+    covered += range.length;
+    ranges.push_back(range);
+  }
+
+  return covered == cachedLines;
+}
+
+bool Blame::writeCache(const string& path, const string& commit,
+		       unsigned int numLines,
+		       const vector<Range>& ranges) const {
+  vector<string> lines;
+  lines.push_back("lines=" + to_string(numLines));
+  for (const Range& range : ranges) {
+    lines.push_back(to_string(range.start) + " " + to_string(range.length) +
+		    " " + range.commit);
+  }
+
+  return FileWriter::replaceFile(getCacheFileName(path, commit), lines);
+}
+
+bool Blame::run(const string& path, int node, unsigned int numLines,
+		vector<Range>& ranges) {
+  stats.diffsRead = 0;
+  stats.commitsRead = 0;
+  stats.cachedCommit.clear();
+  ranges.clear();
+
+  vector<Interval> intervals;
+  if (numLines != 0) {
+    addInterval(intervals, 0, numLines, 0);
+  }
+
+  // Only the commits that changed the file come up, newest first; the first
+  // is the one that wrote the version being blamed
+  HistoryWalk walk(tree, commitDirectory, manifests, node, path, &filters);
+  CommitInfo commit;
+  string versionCommit;
+  vector<Range> found;
+  while (!intervals.empty() && walk.next(commit)) {
+    if (versionCommit.empty()) {
+      versionCommit = commit.hash;
+      if (readCache(path, commit.hash, numLines, ranges)) {
+	stats.cachedCommit = commit.hash;
+	stats.commitsRead = walk.getStats().commitsRead;
+	return true;
+      }
+    } else {
+      vector<Range> cached, resolved;
+      if (readCache(path, commit.hash, UINT_MAX, cached) &&
+	  resolveFromCache(cached, intervals, resolved)) {
+	found.insert(found.end(), resolved.begin(), resolved.end());
+	stats.cachedCommit = commit.hash;
+	intervals.clear();
+	break;
+      }
+    }
+
+    if (find(commit.addedFiles.begin(), commit.addedFiles.end(), path) !=
+	commit.addedFiles.end()) {
+      for (const Interval& interval : intervals) {
+	addRange(found, interval.target, interval.length, commit.hash);
+      }
+      intervals.clear();
+      break;
+    }
+
+    // Anything else, like the file having been removed, means the history
+    // doesn't lead back to the file at all
+    FileDiff diff;
+    if (find(commit.modifiedFiles.begin(), commit.modifiedFiles.end(),
+	     path) == commit.modifiedFiles.end() ||
+	!diff.read(FileSystemInterface::appendPath(
+	    FileSystemInterface::appendPath(commitDirectory, commit.hash),
+	    path)) ||
+	!carryThroughDiff(diff, commit.hash, intervals, found)) {
+      return false;
+    }
+    ++stats.diffsRead;
+  }
+  stats.commitsRead = walk.getStats().commitsRead;
+
+  if (walk.failed() || !intervals.empty()) {
+    return false;
+  }
+
+  // Back in order of the lines being blamed, with neighbours from the same
+  // commit run together
+  ranges.clear();
+  sort(found.begin(), found.end(), [](const Range& a, const Range& b) {
+      return a.start < b.start;
+    });
+  unsigned int covered = 0;
+  for (const Range& range : found) {
+    if (range.start != covered) {
+      return false;
+    }
+    covered += range.length;
+
+    if (!ranges.empty() && ranges.back().commit == range.commit) {
+      ranges.back().length += range.length;
+    } else {
+      ranges.push_back(range);
+    }
+  }
+  if (covered != numLines) {
+    return false;
+  }
+
+  if (!versionCommit.empty()) {
+    writeCache(path, versionCommit, numLines, ranges);
+  }
+  return true;
+}
+
+const Blame::Stats& Blame::getStats() const {
+  return stats;
+}
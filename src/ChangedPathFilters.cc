@@ -0,0 +1,150 @@
+#include <cmath>
+#include <unordered_set>
+
+#include "ChangedPathFilters.h"
+#include "FileSystemInterface.h"
+
+using namespace std;
+
+const double ChangedPathFilters::DEFAULT_FALSE_POSITIVE_RATE = 0.01;
+const size_t ChangedPathFilters::MAX_PATHS;
+
+namespace {
+  const unsigned int WORD_BITS = 64;
+  const uint8_t MAX_HASHES = 16;
+
+  // Two independent hashes of the path, from the halves of its 64-bit FNV-1a
+  // hash; the filter's k hashes are combinations of these
+  void hashPath(const string& path, uint32_t& first, uint32_t& second) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (char c : path) {
+      hash ^= (unsigned char) c;
+      hash *= 1099511628211ULL;
+    }
+    first = (uint32_t) hash;
+    // Odd, so that it never cycles through only some of the bits
+    second = (uint32_t) (hash >> 32) | 1;
+  }
+
+  uint64_t bitIndex(uint32_t first, uint32_t second, unsigned int i,
+		    uint64_t numBits) {
+    return ((uint64_t) first + (uint64_t) i * second) % numBits;
+  }
+}
+
+ChangedPathFilters::ChangedPathFilters() :
+  index("KILPFIDX", 1), words("KILPFBIT", 1) {}
+
+bool ChangedPathFilters::load(const Files& files) {
+  const bool haveIndex = FileSystemInterface::fileExists(files.index);
+  const bool haveWords = FileSystemInterface::fileExists(files.words);
+  return (!haveIndex || index.open(files.index)) &&
+    (!haveWords || words.open(files.words));
+}
+
+bool ChangedPathFilters::save(const Files& files) {
+  // The bits go first, so the index never points past the end of them
+  return words.save(files.words) && index.save(files.index);
+}
+
+bool ChangedPathFilters::hasUnsavedChanges() const {
+  return index.hasUnsavedChanges() || words.hasUnsavedChanges();
+}
+
+void ChangedPathFilters::setLocation(int commit, const Location& location) {
+  Location missing = Location();
+  missing.kind = MISSING;
+  while (index.size() <= (size_t) commit) {
+    index.append(missing);
+  }
+  index.set(commit, location);
+}
+
+void ChangedPathFilters::add(int commit, const vector<string>& changedFiles,
+			     double falsePositiveRate) {
+  // Every directory a file is in counts as changed along with it
+  unordered_set<string> paths;
+  for (const string& file : changedFiles) {
+    for (size_t slash = file.find('/'); slash != string::npos;
+	 slash = file.find('/', slash + 1)) {
+      paths.insert(file.substr(0, slash));
+    }
+    paths.insert(file);
+  }
+
+  Location location = Location();
+  location.numPaths = paths.size();
+  if (paths.size() > MAX_PATHS) {
+    location.kind = TOO_LARGE;
+    setLocation(commit, location);
+    return;
+  }
+
+  // The usual optimum: -ln(p) / ln(2)^2 bits and -log2(p) hashes per path
+  const double bitsPerPath = -log(falsePositiveRate) / (M_LN2 * M_LN2);
+  const uint64_t numBits = max<uint64_t>(
+      WORD_BITS, ceil(bitsPerPath * paths.size()));
+  location.kind = FILTER;
+  location.firstWord = words.size();
+  location.numWords = (numBits + WORD_BITS - 1) / WORD_BITS;
+  location.numHashes = max<long>(1, min<long>(MAX_HASHES,
+					      lround(bitsPerPath * M_LN2)));
+
+  vector<uint64_t> bits(location.numWords, 0);
+  const uint64_t filterBits = (uint64_t) location.numWords * WORD_BITS;
+  for (const string& path : paths) {
+    uint32_t first, second;
+    hashPath(path, first, second);
+    for (unsigned int i = 0; i < location.numHashes; ++i) {
+      const uint64_t bit = bitIndex(first, second, i, filterBits);
+      bits[bit / WORD_BITS] |= (uint64_t) 1 << (bit % WORD_BITS);
+    }
+  }
+
+  for (uint64_t word : bits) {
+    words.append(word);
+  }
+  setLocation(commit, location);
+}
+
+ChangedPathFilters::Answer ChangedPathFilters::query(
+    int commit, const string& path) const {
+  if (commit < 0 || (size_t) commit >= index.size()) {
+    return NO_FILTER;
+  }
+
+  const Location& location = index.get(commit);
+  if (location.kind != FILTER || location.numWords == 0 ||
+      location.firstWord + location.numWords > words.size()) {
+    return NO_FILTER;
+  }
+
+  uint32_t first, second;
+  hashPath(path, first, second);
+  const uint64_t filterBits = (uint64_t) location.numWords * WORD_BITS;
+  for (unsigned int i = 0; i < location.numHashes; ++i) {
+    const uint64_t bit = bitIndex(first, second, i, filterBits);
+    if ((words.get(location.firstWord + bit / WORD_BITS) &
+	 ((uint64_t) 1 << (bit % WORD_BITS))) == 0) {
+      return NOT_CHANGED;
+    }
+  }
+
+  return MAYBE_CHANGED;
+}
+
+ChangedPathFilters::Summary ChangedPathFilters::summarize() const {
+  Summary summary = Summary();
+  for (size_t commit = 0; commit < index.size(); ++commit) {
+    const Location& location = index.get(commit);
+    if (location.kind == FILTER) {
+      ++summary.commitsWithFilters;
+      summary.pathsAdded += location.numPaths;
+      summary.bitsUsed += (size_t) location.numWords * WORD_BITS;
+    } else if (location.kind == TOO_LARGE) {
+      ++summary.commitsTooLarge;
+    }
+  }
+
+  return summary;
+}
@@ -0,0 +1,352 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "CommandServer.h"
+#include "FileSystemInterface.h"
+
+using namespace std;
+
+const char * const CommandServer::SOCKET_FILE = ".kil/.socket";
+
+namespace {
+  volatile sig_atomic_t stopRequested = 0;
+
+  void requestStop(int) {
+    stopRequested = 1;
+  }
+
+  // A socket connected to the server, -1 if there isn't one to connect to
+  int connectToServer() {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+      return -1;
+    }
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, CommandServer::SOCKET_FILE,
+	    sizeof(address.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address),
+		sizeof(address)) != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  bool sendAll(int fd, const string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+      // A client that has gone away mustn't take the server with it
+      const ssize_t written = send(fd, data.data() + sent, data.size() - sent,
+				   MSG_NOSIGNAL);
+      if (written == -1 && errno == EINTR) {
+	continue;
+      }
+      if (written <= 0) {
+	return false;
+      }
+      sent += written;
+    }
+    return true;
+  }
+
+  // Reads until the other side shuts down its end
+  bool receiveAll(int fd, string& data) {
+    char buffer[1 << 16];
+    for (;;) {
+      const ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+      if (received == -1 && errno == EINTR) {
+	continue;
+      }
+      if (received < 0) {
+	return false;
+      }
+      if (received == 0) {
+	return true;
+      }
+      data.append(buffer, received);
+    }
+  }
+}
+
+bool CommandServer::FileState::operator!=(const FileState& other) const {
+  return exists != other.exists || inode != other.inode ||
+    size != other.size || modifiedNs != other.modifiedNs;
+}
+
+CommandServer::CommandServer(unsigned int idleSeconds) :
+  idleSeconds(idleSeconds), commandsServed(0), nextConnectionId(0) {
+}
+
+void CommandServer::readState(vector<FileState>& state) const {
+  state.clear();
+  for (const string& file : accumulator->getStateFiles()) {
+    struct stat info;
+    FileState fileState = FileState();
+    fileState.exists = FileSystemInterface::getFileInfo(file.c_str(), info);
+    if (fileState.exists) {
+      // Files replaced by renaming get a new inode, and ones written in place
+      // a new modification time
+      fileState.inode = info.st_ino;
+      fileState.size = info.st_size;
+      fileState.modifiedNs = info.st_mtim.tv_sec * 1000000000LL +
+	info.st_mtim.tv_nsec;
+    }
+    state.push_back(fileState);
+  }
+}
+
+bool CommandServer::runCommand(Interpretor::OutputFormat format,
+			       const string& command, string& output) {
+  lock_guard<mutex> lock(commandMutex);
+  ostringstream printed;
+  streambuf * const terminal = cout.rdbuf(printed.rdbuf());
+
+  vector<FileState> state;
+  readState(state);
+  bool loaded = true;
+  if (state.size() != savedState.size() ||
+      !equal(state.begin(), state.end(), savedState.begin(),
+	     [](const FileState& first, const FileState& second) {
+	       return !(first != second);
+	     })) {
+    accumulator.reset(new OperationAccumulator());
+    loaded = Interpretor(*accumulator, format, true).load() &&
+      accumulator->isInitialized();
+  }
+
+  bool succeeded = false;
+  if (loaded) {
+    // Never interactive: the log mustn't wait on the server's stdin for
+    // the next page, holding up every other client as it does
+    Interpretor interpretor(*accumulator, format, true);
+    succeeded = interpretor.execute(command);
+    succeeded = interpretor.save() && succeeded;
+    readState(savedState);
+  } else {
+    savedState.clear();
+    if (!accumulator->isInitialized()) {
+      cout << "The project has gone!" << endl;
+    }
+  }
+  ++commandsServed;
+
+  cout.rdbuf(terminal);
+  output = printed.str();
+  return succeeded;
+}
+
+void CommandServer::serve(unsigned int id, int fd) {
+  // Everything is read before anything is run, so a client that sends a lot
+  // of commands can't get stuck sending them while the server is stuck
+  // sending it their output
+  string request;
+  if (receiveAll(fd, request)) {
+    istringstream commands(request);
+    string formatName;
+    getline(commands, formatName);
+    const Interpretor::OutputFormat format = formatName == "json" ?
+      Interpretor::JSON_LINES : Interpretor::TEXT;
+
+    bool succeeded = true;
+    bool connected = true;
+    string command;
+    while (connected && Interpretor::readCommand(commands, command)) {
+      string output;
+      if (!runCommand(format, command, output)) {
+	succeeded = false;
+      }
+      connected = sendAll(fd, "o " + to_string(output.size()) + "\n" +
+			  output);
+    }
+    if (connected) {
+      sendAll(fd, succeeded ? "x 0\n" : "x 1\n");
+    }
+  }
+  close(fd);
+
+  lock_guard<mutex> lock(connectionsMutex);
+  finishedConnections.push_back(id);
+  lastActive = Clock::now();
+}
+
+void CommandServer::joinFinishedConnections() {
+  vector<thread> finished;
+  {
+    lock_guard<mutex> lock(connectionsMutex);
+    for (unsigned int id : finishedConnections) {
+      finished.push_back(move(connections[id]));
+      connections.erase(id);
+    }
+    finishedConnections.clear();
+  }
+  for (thread& connection : finished) {
+    connection.join();
+  }
+}
+
+bool CommandServer::run() {
+  accumulator.reset(new OperationAccumulator());
+  if (!accumulator->initialize()) {
+    return false;
+  }
+  if (!accumulator->isInitialized()) {
+    cout << "No KIL project here to serve!" << endl;
+    return false;
+  }
+
+  int connected = connectToServer();
+  if (connected != -1) {
+    close(connected);
+    cout << "A server is already running for this project!" << endl;
+    return false;
+  }
+  // Left behind by one that didn't stop cleanly
+  unlink(SOCKET_FILE);
+
+  const int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, SOCKET_FILE, sizeof(address.sun_path) - 1);
+  if (listenFd == -1 ||
+      ::bind(listenFd, reinterpret_cast<sockaddr *>(&address),
+	     sizeof(address)) != 0 ||
+      listen(listenFd, SOMAXCONN) != 0) {
+    cout << "Could not listen on " << SOCKET_FILE << ": " << strerror(errno) <<
+      "!" << endl;
+    if (listenFd != -1) {
+      close(listenFd);
+    }
+    return false;
+  }
+  readState(savedState);
+
+  // The signals are only let through while waiting for connections, so
+  // they're never taken by a thread serving one, and stopping is always
+  // noticed straight away
+  sigset_t stopSignals;
+  sigset_t waitingMask;
+  sigemptyset(&stopSignals);
+  sigaddset(&stopSignals, SIGINT);
+  sigaddset(&stopSignals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stopSignals, &waitingMask);
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = requestStop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  cout << "Serving on " << SOCKET_FILE << " until " << idleSeconds <<
+    " seconds go by without a client." << endl;
+  lastActive = Clock::now();
+  while (!stopRequested) {
+    joinFinishedConnections();
+
+    double idleMs;
+    {
+      lock_guard<mutex> lock(connectionsMutex);
+      idleMs = connections.empty() ?
+	chrono::duration<double, milli>(Clock::now() - lastActive).count() :
+	0;
+    }
+    const double waitMs = 1000.0 * idleSeconds - idleMs;
+    if (waitMs <= 0) {
+      break;
+    }
+
+    pollfd listening = { listenFd, POLLIN, 0 };
+    const timespec timeout = {
+      static_cast<time_t>(waitMs / 1000),
+      static_cast<long>(static_cast<long long>(waitMs) % 1000 * 1000000)
+    };
+    if (ppoll(&listening, 1, &timeout, &waitingMask) <= 0) {
+      continue;
+    }
+
+    const int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd == -1) {
+      continue;
+    }
+    lock_guard<mutex> lock(connectionsMutex);
+    const unsigned int id = nextConnectionId++;
+    connections[id] = thread(&CommandServer::serve, this, id, fd);
+  }
+
+  // New clients run their commands themselves from here on, while the ones
+  // already connected are finished off
+  close(listenFd);
+  unlink(SOCKET_FILE);
+  for (;;) {
+    joinFinishedConnections();
+    lock_guard<mutex> lock(connectionsMutex);
+    if (connections.empty()) {
+      break;
+    }
+    this_thread::sleep_for(chrono::milliseconds(10));
+  }
+  pthread_sigmask(SIG_SETMASK, &waitingMask, NULL);
+
+  cout << (stopRequested ? "Stopped" : "Stopped after " +
+	   to_string(idleSeconds) + " seconds without a client") <<
+    ", having served " << commandsServed << " commands." << endl;
+  return true;
+}
+
+int CommandServer::openConnection() {
+  return connectToServer();
+}
+
+bool CommandServer::forward(int fd, const string& commands,
+			    Interpretor::OutputFormat format) {
+  bool succeeded = false;
+  // If this fails, so does reading the reply
+  sendAll(fd, string(format == Interpretor::JSON_LINES ? "json\n" : "text\n") +
+	  commands);
+  shutdown(fd, SHUT_WR);
+
+  // "o <length>\n<output>" for each command, then "x <exit status>\n"
+  string reply;
+  char buffer[1 << 16];
+  for (;;) {
+    const size_t lineEnd = reply.find('\n');
+    if (lineEnd != string::npos && reply.compare(0, 2, "x ") == 0) {
+      succeeded = reply.compare(0, lineEnd, "x 0") == 0;
+      break;
+    }
+    if (lineEnd != string::npos && reply.compare(0, 2, "o ") == 0) {
+      const size_t length = strtoull(reply.c_str() + 2, NULL, 10);
+      if (reply.size() - lineEnd - 1 >= length) {
+	cout << reply.substr(lineEnd + 1, length) << flush;
+	reply.erase(0, lineEnd + 1 + length);
+	continue;
+      }
+    }
+
+    const ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+    if (received == -1 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      cerr << "Lost the connection to the server!" << endl;
+      break;
+    }
+    reply.append(buffer, received);
+  }
+  close(fd);
+  return succeeded;
+}
@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <unordered_set>
+
+#include "CommitContents.h"
+#include "CommitHash.h"
+#include "CommitInfo.h"
+#include "DiffApplier.h"
+#include "FileParser.h"
+#include "FileSystemInterface.h"
+#include "FileWriter.h"
+
+using namespace std;
+
+// Not numbers, so they can't clash with a commit's directory
+static const char * FULL_COPY_DIRECTORY = ".snapshots";
+static const char * NEWER_VERSION_DIRECTORY = ".newer";
+
+bool CommitContents::FileVersion::operator==(const FileVersion& other) const {
+  return addedIn == other.addedIn && modifiedIn == other.modifiedIn;
+}
+
+bool CommitContents::FileVersion::operator!=(const FileVersion& other) const {
+  return !(*this == other);
+}
+
+CommitContents::CommitContents(const string& commitDirectory) :
+  commitDirectory(commitDirectory) {}
+
+bool CommitContents::load(const string& commit,
+			  const unordered_set<string> * paths) {
+  files.clear();
+
+  // Walking back from the newest commit, the first mention of a file decides
+  // whether it's there at all; until we reach the commit that added it, each
+  // commit that modified it adds another diff to apply
+  unordered_set<string> removedFiles;
+  string hash = commit;
+
+  while (hash != "ROOT" && hash != CommitHash::getNullHash()) {
+    CommitInfo info;
+    if (!info.read(CommitInfo::getFileName(commitDirectory, hash))) {
+      return false;
+    }
+
+    for (const string& path : info.modifiedFiles) {
+      if (paths != NULL && paths->count(path) == 0) {
+	continue;
+      }
+      if (removedFiles.count(path) == 0) {
+	FileVersion& version = files[path];
+	if (version.addedIn.empty()) {
+	  version.modifiedIn.push_back(hash);
+	}
+      }
+    }
+
+    for (const string& path : info.addedFiles) {
+      if (paths != NULL && paths->count(path) == 0) {
+	continue;
+      }
+      if (removedFiles.count(path) == 0) {
+	FileVersion& version = files[path];
+	if (version.addedIn.empty()) {
+	  version.addedIn = hash;
+	}
+      }
+    }
+
+    for (const string& path : info.removedFiles) {
+      if (paths != NULL && paths->count(path) == 0) {
+	continue;
+      }
+      if (files.count(path) == 0) {
+	removedFiles.insert(path);
+      }
+    }
+
+    hash = info.parent;
+  }
+
+  for (unordered_map<string, FileVersion>::iterator it = files.begin();
+       it != files.end(); ++it) {
+    // Modified without ever having been added
+    if (it->second.addedIn.empty()) {
+      return false;
+    }
+    reverse(it->second.modifiedIn.begin(), it->second.modifiedIn.end());
+  }
+
+  return true;
+}
+
+const CommitContents::FileVersion * CommitContents::find(
+    const string& path) const {
+  unordered_map<string, FileVersion>::const_iterator it = files.find(path);
+  return it == files.end() ? NULL : &it->second;
+}
+
+const unordered_map<string, CommitContents::FileVersion>&
+CommitContents::getFiles() const {
+  return files;
+}
+
+bool CommitContents::readFile(const string& path, vector<Line>& lines) const {
+  const FileVersion * version = find(path);
+  return version != NULL &&
+    readVersion(commitDirectory, path, *version, version->modifiedIn.size(),
+		lines);
+}
+
+bool CommitContents::readVersion(const string& commitDirectory,
+				 const string& path,
+				 const FileVersion& version, size_t numDiffs,
+				 vector<Line>& lines) {
+  size_t start = numDiffs;
+  while (true) {
+    const string& commit = start == 0 ? version.addedIn :
+      version.modifiedIn[start - 1];
+    if ((start == 0 && readSnapshot(commitDirectory, path, commit, lines)) ||
+	readFullCopy(commitDirectory, path, commit, lines) ||
+	readFromNewer(commitDirectory, path, commit, lines)) {
+      break;
+    }
+    if (start == 0) {
+      return false;
+    }
+    --start;
+  }
+
+  for (size_t i = start; i < numDiffs; ++i) {
+    if (!applyDiff(commitDirectory, path, version.modifiedIn[i], lines)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+string CommitContents::getFullCopyDirectory(const string& commitDirectory,
+					    const string& commit) {
+  return FileSystemInterface::appendPath(
+      FileSystemInterface::appendPath(commitDirectory, FULL_COPY_DIRECTORY),
+      commit);
+}
+
+string CommitContents::getNewerVersionFileName(const string& commitDirectory,
+					       const string& path,
+					       const string& commit) {
+  return FileSystemInterface::appendPath(
+      FileSystemInterface::appendPath(
+	  FileSystemInterface::appendPath(commitDirectory,
+					  NEWER_VERSION_DIRECTORY), commit),
+      path);
+}
+
+bool CommitContents::readFullCopy(const string& commitDirectory,
+				  const string& path, const string& commit,
+				  vector<Line>& lines) {
+  const string fullCopy = FileSystemInterface::appendPath(
+      getFullCopyDirectory(commitDirectory, commit), path);
+  if (!FileSystemInterface::fileExists(fullCopy.c_str())) {
+    return false;
+  }
+
+  lines.clear();
+  FileParser::readFile(fullCopy.c_str(), lines);
+  return true;
+}
+
+bool CommitContents::readFromNewer(const string& commitDirectory,
+				   const string& path, const string& commit,
+				   vector<Line>& lines) {
+  vector<string> newerCommits;
+  string current = commit;
+  while (true) {
+    ifstream input(getNewerVersionFileName(commitDirectory, path, current));
+    string newer;
+    // Commits are numbered in the order they're made, which also rules out
+    // going round in circles
+    if (!(input >> newer) || atoi(newer.c_str()) <= atoi(current.c_str())) {
+      return false;
+    }
+
+    newerCommits.push_back(newer);
+    if (readFullCopy(commitDirectory, path, newer, lines)) {
+      break;
+    }
+    current = newer;
+  }
+
+  for (vector<string>::reverse_iterator it = newerCommits.rbegin();
+       it != newerCommits.rend(); ++it) {
+    if (!unapplyDiff(commitDirectory, path, *it, lines)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool CommitContents::readSnapshot(const string& commitDirectory,
+				  const string& path, const string& commit,
+				  vector<Line>& lines) {
+  const string snapshot = FileSystemInterface::appendPath(
+      FileSystemInterface::appendPath(commitDirectory, commit), path);
+  if (!FileSystemInterface::fileExists(snapshot.c_str())) {
+    return false;
+  }
+
+  lines.clear();
+  FileParser::readFile(snapshot.c_str(), lines);
+  return true;
+}
+
+bool CommitContents::applyDiff(const string& commitDirectory,
+			       const string& path, const string& commit,
+			       vector<Line>& lines, bool keepLineNumbers) {
+  FileDiff diff;
+  vector<Line> newLines;
+  if (!diff.read(FileSystemInterface::appendPath(
+	  FileSystemInterface::appendPath(commitDirectory, commit), path)) ||
+      !DiffApplier::applyDiff(lines, diff, newLines, keepLineNumbers)) {
+    return false;
+  }
+
+  lines.swap(newLines);
+  return true;
+}
+
+bool CommitContents::unapplyDiff(const string& commitDirectory,
+				 const string& path, const string& commit,
+				 vector<Line>& lines) {
+  FileDiff diff;
+  vector<Line> oldLines;
+  if (!diff.read(FileSystemInterface::appendPath(
+	  FileSystemInterface::appendPath(commitDirectory, commit), path)) ||
+      !DiffApplier::unapplyDiff(lines, diff, oldLines)) {
+    return false;
+  }
+
+  lines.swap(oldLines);
+  return true;
+}
+
+bool CommitContents::replaceFullCopy(const string& commitDirectory,
+				     const string& path, const string& commit,
+				     bool addedFile, const string& newerCommit) {
+  vector<string> copies;
+  copies.push_back(FileSystemInterface::appendPath(
+      getFullCopyDirectory(commitDirectory, commit), path));
+  if (addedFile) {
+    copies.push_back(FileSystemInterface::appendPath(
+	FileSystemInterface::appendPath(commitDirectory, commit), path));
+  }
+
+  vector<string> existingCopies;
+  for (const string& copy : copies) {
+    if (FileSystemInterface::fileExists(copy.c_str())) {
+      existingCopies.push_back(copy);
+    }
+  }
+  if (existingCopies.empty() ||
+      !FileWriter::replaceFile(
+	  getNewerVersionFileName(commitDirectory, path, commit),
+	  vector<string>(1, newerCommit))) {
+    return false;
+  }
+
+  for (const string& copy : existingCopies) {
+    remove(copy.c_str());
+    FileSystemInterface::removeEmptyDirectories(copy);
+  }
+  return true;
+}
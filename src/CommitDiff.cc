@@ -0,0 +1,321 @@
+#include <algorithm>
+
+#include "CommitDiff.h"
+#include "CommitHash.h"
+#include "CommitInfo.h"
+#include "DiffApplier.h"
+#include "DiffBuilder.h"
+#include "SubsequenceAnalyzer.h"
+#include "UnifiedDiff.h"
+
+using namespace std;
+
+CommitDiff::CommitDiff(const string& commitDirectory,
+		       const Manifest& manifests) :
+  commitDirectory(commitDirectory), manifests(manifests) {
+  stats.filesComposed = 0;
+  stats.filesDiffedWhole = 0;
+  stats.commitsRead = 0;
+}
+
+const CommitDiff::CommitFiles * CommitDiff::readCommit(const string& commit) {
+  unordered_map<string, CommitFiles>::const_iterator it =
+    commits.find(commit);
+  if (it != commits.end()) {
+    return &it->second;
+  }
+
+  CommitInfo info;
+  if (!info.read(CommitInfo::getFileName(commitDirectory, commit))) {
+    return NULL;
+  }
+  ++stats.commitsRead;
+
+  CommitFiles& files = commits[commit];
+  files.parent = info.parent;
+  files.manifest = info.manifest;
+  files.addedFiles.insert(info.addedFiles.begin(), info.addedFiles.end());
+  return &files;
+}
+
+bool CommitDiff::findVersion(const string& commit, const string& path,
+			     CommitContents::FileVersion& version,
+			     bool& exists) {
+  exists = false;
+  if (commit == CommitHash::getNullHash()) {
+    return true;
+  }
+
+  const CommitFiles * files = readCommit(commit);
+  Manifest::Entry entry;
+  if (files == NULL || files->manifest.empty()) {
+    return false;
+  }
+  if (!manifests.findFile(files->manifest, path, entry)) {
+    return true;
+  }
+
+  // Follow the file back through the commits that wrote it, to the one that
+  // added it
+  version.addedIn.clear();
+  version.modifiedIn.clear();
+  while (true) {
+    const string source = entry.commit;
+    files = readCommit(source);
+    if (files == NULL) {
+      return false;
+    }
+    if (files->addedFiles.count(path) != 0) {
+      version.addedIn = source;
+      break;
+    }
+    version.modifiedIn.push_back(source);
+
+    // The diff was made against the file as of the first parent
+    files = readCommit(files->parent);
+    if (files == NULL || files->manifest.empty() ||
+	!manifests.findFile(files->manifest, path, entry)) {
+      return false;
+    }
+  }
+
+  reverse(version.modifiedIn.begin(), version.modifiedIn.end());
+  exists = true;
+  return true;
+}
+
+bool CommitDiff::findVersionsFromHistory(
+    const string& first, const string& second,
+    vector<FileVersions *>& files) const {
+  // Commits from before manifests were can only be read by walking the
+  // whole of their history
+  unordered_set<string> paths;
+  for (const FileVersions * file : files) {
+    paths.insert(file->path);
+  }
+
+  CommitContents firstContents(commitDirectory);
+  CommitContents secondContents(commitDirectory);
+  if (!firstContents.load(first, &paths) ||
+      !secondContents.load(second, &paths)) {
+    return false;
+  }
+
+  for (FileVersions * file : files) {
+    const CommitContents::FileVersion * firstVersion =
+      firstContents.find(file->path);
+    const CommitContents::FileVersion * secondVersion =
+      secondContents.find(file->path);
+    file->inFirst = firstVersion != NULL;
+    file->inSecond = secondVersion != NULL;
+    if (file->inFirst) {
+      file->first = *firstVersion;
+    }
+    if (file->inSecond) {
+      file->second = *secondVersion;
+    }
+  }
+
+  return true;
+}
+
+bool CommitDiff::readVersion(const string& path,
+			     const CommitContents::FileVersion& version,
+			     vector<Line>& lines) const {
+  return CommitContents::readVersion(commitDirectory, path, version,
+				     version.modifiedIn.size(), lines);
+}
+
+// Registers the changes between two stretches of lines with nothing in
+// common at either end, given where they start in the old file
+static void addChanges(const vector<Line>& oldLines, size_t oldStart,
+		       size_t oldEnd, const vector<Line>& newLines,
+		       size_t newStart, size_t newEnd, DiffBuilder& builder) {
+  if (oldStart != oldEnd && newStart != newEnd) {
+    // Both versions changed what was here, and may still share some of it
+    vector<Line> oldGap;
+    vector<Line> newGap;
+    for (size_t i = oldStart; i < oldEnd; ++i) {
+      oldGap.push_back(Line(i - oldStart, oldLines[i].getString()));
+    }
+    for (size_t i = newStart; i < newEnd; ++i) {
+      newGap.push_back(Line(i - newStart, newLines[i].getString()));
+    }
+
+    const FileDiff gapDiff = SubsequenceAnalyzer::calculateDiff(oldGap,
+								newGap);
+    for (const DiffElement& deletion : gapDiff.getDeletions()) {
+      for (size_t i = 0; i < deletion.getNumLines(); ++i) {
+	builder.registerDeletedLine(
+	    oldStart + deletion.getBaseStartingLine() + i,
+	    deletion.getLines()[i]);
+      }
+    }
+    for (const DiffElement& insertion : gapDiff.getInsertions()) {
+      for (const string& line : insertion.getLines()) {
+	builder.registerInsertedLine(
+	    oldStart + insertion.getBaseStartingLine(), line);
+      }
+    }
+    return;
+  }
+
+  for (size_t i = oldStart; i < oldEnd; ++i) {
+    builder.registerDeletedLine(i, oldLines[i].getString());
+  }
+  for (size_t i = newStart; i < newEnd; ++i) {
+    builder.registerInsertedLine(oldStart, newLines[i].getString());
+  }
+}
+
+bool CommitDiff::compose(const FileVersions& file, vector<Line>& firstLines,
+			 FileDiff& diff) const {
+  const vector<string>& firstDiffs = file.first.modifiedIn;
+  const vector<string>& secondDiffs = file.second.modifiedIn;
+  size_t numShared = 0;
+  while (numShared < firstDiffs.size() && numShared < secondDiffs.size() &&
+	 firstDiffs[numShared] == secondDiffs[numShared]) {
+    ++numShared;
+  }
+
+  // Number the lines of the last version both were built on, so that each
+  // line of either version says which of its lines it is, if any
+  vector<Line> common;
+  if (!CommitContents::readVersion(commitDirectory, file.path, file.first,
+				   numShared, common)) {
+    return false;
+  }
+  for (size_t i = 0; i < common.size(); ++i) {
+    common[i].setLineNumber(i);
+  }
+
+  firstLines = common;
+  vector<Line> secondLines;
+  secondLines.swap(common);
+  for (size_t i = numShared; i < firstDiffs.size(); ++i) {
+    if (!CommitContents::applyDiff(commitDirectory, file.path, firstDiffs[i],
+				   firstLines, true)) {
+      return false;
+    }
+  }
+  for (size_t i = numShared; i < secondDiffs.size(); ++i) {
+    if (!CommitContents::applyDiff(commitDirectory, file.path, secondDiffs[i],
+				   secondLines, true)) {
+      return false;
+    }
+  }
+
+  // Lines both kept appear in the same order in each, and everything
+  // between two of them has changed on one side or the other
+  DiffBuilder builder;
+  size_t i = 0;
+  size_t j = 0;
+  size_t gapStart = 0;
+  size_t newGapStart = 0;
+  while (true) {
+    while (i < firstLines.size() && j < secondLines.size()) {
+      const unsigned int first = firstLines[i].getNumber();
+      const unsigned int second = secondLines[j].getNumber();
+      if (first == second && first != DiffApplier::INSERTED_LINE) {
+	break;
+      }
+      if (first == DiffApplier::INSERTED_LINE ||
+	  (second != DiffApplier::INSERTED_LINE && first < second)) {
+	++i;
+      } else {
+	++j;
+      }
+    }
+    if (i == firstLines.size() || j == secondLines.size()) {
+      i = firstLines.size();
+      j = secondLines.size();
+    }
+
+    addChanges(firstLines, gapStart, i, secondLines, newGapStart, j,
+	       builder);
+    if (i == firstLines.size()) {
+      break;
+    }
+
+    gapStart = ++i;
+    newGapStart = ++j;
+  }
+
+  diff = builder.build();
+  return true;
+}
+
+bool CommitDiff::printFile(const FileVersions& file, ostream& output) {
+  vector<Line> firstLines;
+  if (!file.inSecond) {
+    if (!readVersion(file.path, file.first, firstLines)) {
+      return false;
+    }
+    UnifiedDiff::printRemoved(output, file.path, firstLines);
+    return true;
+  }
+
+  vector<Line> secondLines;
+  if (!file.inFirst) {
+    if (!readVersion(file.path, file.second, secondLines)) {
+      return false;
+    }
+    UnifiedDiff::printAdded(output, file.path, secondLines);
+    return true;
+  }
+
+  if (file.first == file.second) {
+    return true;
+  }
+
+  FileDiff diff;
+  if (file.first.addedIn == file.second.addedIn) {
+    if (!compose(file, firstLines, diff)) {
+      return false;
+    }
+    ++stats.filesComposed;
+  } else {
+    if (!readVersion(file.path, file.first, firstLines) ||
+	!readVersion(file.path, file.second, secondLines)) {
+      return false;
+    }
+    diff = SubsequenceAnalyzer::calculateDiff(firstLines, secondLines);
+    ++stats.filesDiffedWhole;
+  }
+
+  UnifiedDiff::print(output, file.path, firstLines, diff);
+  return true;
+}
+
+bool CommitDiff::print(const string& first, const string& second,
+		       const vector<string>& files, ostream& output) {
+  // Working out every file's versions first only takes the list of commits
+  // each was built from, and shows whether the history has to be walked
+  vector<FileVersions> versions(files.size());
+  vector<FileVersions *> notInManifests;
+  for (size_t i = 0; i < files.size(); ++i) {
+    FileVersions& file = versions[i];
+    file.path = files[i];
+    if (!findVersion(first, file.path, file.first, file.inFirst) ||
+	!findVersion(second, file.path, file.second, file.inSecond)) {
+      notInManifests.push_back(&file);
+    }
+  }
+
+  if (!notInManifests.empty() &&
+      !findVersionsFromHistory(first, second, notInManifests)) {
+    return false;
+  }
+
+  for (const FileVersions& file : versions) {
+    if ((file.inFirst || file.inSecond) && !printFile(file, output)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+const CommitDiff::Stats& CommitDiff::getStats() const {
+  return stats;
+}
@@ -0,0 +1,95 @@
+#include <cstdio>
+#include <fstream>
+
+#include "CommitInfo.h"
+#include "FileSystemInterface.h"
+
+using namespace std;
+
+string CommitInfo::getFileName(const string& commitDirectory,
+			       const string& hash) {
+  return FileSystemInterface::appendPath(
+      FileSystemInterface::appendPath(commitDirectory, hash), hash + ".txt");
+}
+
+static bool readValue(istream& input, const string& key, string& value) {
+  string line;
+  if (!getline(input, line) || line.compare(0, key.size(), key) != 0) {
+    return false;
+  }
+
+  value = line.substr(key.size());
+  return true;
+}
+
+static bool readList(istream& input, const string& heading,
+		     vector<string>& entries) {
+  string line;
+  size_t numEntries;
+  if (!getline(input, line) || line.compare(0, heading.size(), heading) != 0 ||
+      sscanf(line.c_str() + heading.size(), " [%zu]", &numEntries) != 1) {
+    return false;
+  }
+
+  // The count isn't trusted to size anything, so a corrupt one runs out of
+  // lines rather than memory
+  entries.clear();
+  for (size_t i = 0; i < numEntries; ++i) {
+    if (!getline(input, line)) {
+      return false;
+    }
+    entries.push_back(line);
+  }
+
+  return true;
+}
+
+bool CommitInfo::read(const string& fileName) {
+  ifstream input(fileName);
+  string childList;
+
+  if (!readValue(input, "commitHash=", hash) ||
+      !readValue(input, "commitMessage=", message) ||
+      !readValue(input, "branch=", branch) ||
+      !readValue(input, "parentCommit=", parent) ||
+      !readValue(input, "childCommits=[", childList) ||
+      !readList(input, "addedFiles", addedFiles) ||
+      !readList(input, "removedFiles", removedFiles) ||
+      !readList(input, "diffs", modifiedFiles)) {
+    return false;
+  }
+
+  // The message is quoted, and the child list ends with its closing bracket
+  if (message.size() < 2 || message[0] != '"' ||
+      message[message.size() - 1] != '"' || childList.empty() ||
+      childList[childList.size() - 1] != ']') {
+    return false;
+  }
+  message = message.substr(1, message.size() - 2);
+  childList.erase(childList.size() - 1);
+
+  children.clear();
+  size_t start = 0;
+  while (start < childList.size()) {
+    size_t end = childList.find(',', start);
+    if (end == string::npos) {
+      end = childList.size();
+    }
+    children.push_back(childList.substr(start, end - start));
+    start = end + 1;
+  }
+
+  // Optional fields follow
+  mergeParent.clear();
+  manifest.clear();
+  string line;
+  while (getline(input, line)) {
+    if (line.compare(0, 12, "mergeParent=") == 0) {
+      mergeParent = line.substr(12);
+    } else if (line.compare(0, 9, "manifest=") == 0) {
+      manifest = line.substr(9);
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,330 @@
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+#include "CommitPipeline.h"
+#include "ContentHash.h"
+#include "FileParser.h"
+#include "FileSystemInterface.h"
+#include "SubsequenceAnalyzer.h"
+
+using namespace std;
+
+namespace {
+  typedef chrono::steady_clock Clock;
+
+  double millisecondsBetween(const Clock::time_point& start,
+			     const Clock::time_point& end) {
+    return chrono::duration<double, milli>(end - start).count();
+  }
+}
+
+CommitPipeline::CommitPipeline(
+    const StatCache& statCache,
+    function<bool(const string&, string&)> readCommittedHash,
+    function<bool(const string&, vector<Line>&)> readPreviousVersion,
+    size_t queueDepth) :
+  statCache(statCache), readCommittedHash(readCommittedHash),
+  readPreviousVersion(readPreviousVersion),
+  queueDepth(queueDepth), readQueue(queueDepth), diffQueue(queueDepth),
+  encodeQueue(queueDepth), results(NULL) {
+  stats.queueDepth = queueDepth;
+
+  const char * stageNames[] = { "reader", "differ", "encoder", "writer" };
+  for (const char * name : stageNames) {
+    StageStats stage;
+    stage.name = name;
+    stage.itemsProcessed = 0;
+    stage.busyMs = 0;
+    stage.waitingForInputMs = 0;
+    stage.waitingForOutputMs = 0;
+    stats.stages.push_back(stage);
+  }
+}
+
+void CommitPipeline::readItem(Item& item) const {
+  if (!FileSystemInterface::getFileInfo(item.path.c_str(), item.info)) {
+    item.outcome = REMOVED;
+    return;
+  }
+
+  if (item.isAddedFile) {
+    // Snapshotted as is by the writer
+    item.outcome = ADDED;
+    return;
+  }
+
+  if (statCache.isUnchanged(item.path, item.info)) {
+    item.outcome = UNCHANGED;
+    return;
+  }
+
+  FileParser::readFile(item.path.c_str(), item.newFile);
+  item.hash = ContentHash::ofLines(item.newFile);
+
+  // Only the stat data changed (eg. the file was touched), or the index
+  // doesn't know the file but it matches the last commit all the same
+  const StatCache::Entry * entry = statCache.find(item.path);
+  string committedHash;
+  if (entry != NULL ? entry->hash == item.hash :
+      readCommittedHash(item.path, committedHash) &&
+      committedHash == item.hash) {
+    item.outcome = CONTENTS_UNCHANGED;
+    item.newFile.clear();
+    return;
+  }
+
+  if (!readPreviousVersion(item.path, item.previousFile)) {
+    item.outcome = NO_PREVIOUS_VERSION;
+    item.newFile.clear();
+    return;
+  }
+  item.outcome = MODIFIED;
+}
+
+void CommitPipeline::runReader(const vector<string>& addedFiles,
+			       const vector<string>& trackedFiles) {
+  StageStats& stage = stats.stages[0];
+
+  vector<pair<const string *, bool> > paths;
+  for (const string& path : addedFiles) {
+    paths.push_back(make_pair(&path, true));
+  }
+  for (const string& path : trackedFiles) {
+    paths.push_back(make_pair(&path, false));
+  }
+
+  for (const pair<const string *, bool>& pathInfo : paths) {
+    Clock::time_point start = Clock::now();
+
+    unique_ptr<Item> item(new Item());
+    item->path = *pathInfo.first;
+    item->isAddedFile = pathInfo.second;
+    readItem(*item);
+    ++stage.itemsProcessed;
+
+    Clock::time_point processed = Clock::now();
+    readQueue.push(move(item));
+    Clock::time_point pushed = Clock::now();
+
+    stage.busyMs += millisecondsBetween(start, processed);
+    stage.waitingForOutputMs += millisecondsBetween(processed, pushed);
+  }
+
+  readQueue.close();
+}
+
+void CommitPipeline::runDiffer() {
+  StageStats& stage = stats.stages[1];
+
+  while (true) {
+    Clock::time_point start = Clock::now();
+    unique_ptr<Item> item;
+    if (!readQueue.pop(item)) {
+      stage.waitingForInputMs += millisecondsBetween(start, Clock::now());
+      break;
+    }
+    Clock::time_point popped = Clock::now();
+
+    if (item->outcome == MODIFIED) {
+      item->diff.reset(new FileDiff(
+	  SubsequenceAnalyzer::calculateDiff(item->previousFile,
+					     item->newFile)));
+      if (item->diff->isEmptyDiff()) {
+	item->outcome = CONTENTS_UNCHANGED;
+	item->diff.reset();
+      }
+      item->previousFile.clear();
+      if (!getFullCopyDirectory) {
+	item->newFile.clear();
+      }
+    }
+    ++stage.itemsProcessed;
+
+    Clock::time_point processed = Clock::now();
+    diffQueue.push(move(item));
+    Clock::time_point pushed = Clock::now();
+
+    stage.waitingForInputMs += millisecondsBetween(start, popped);
+    stage.busyMs += millisecondsBetween(popped, processed);
+    stage.waitingForOutputMs += millisecondsBetween(processed, pushed);
+  }
+
+  diffQueue.close();
+}
+
+void CommitPipeline::runEncoder() {
+  StageStats& stage = stats.stages[2];
+
+  while (true) {
+    Clock::time_point start = Clock::now();
+    unique_ptr<Item> item;
+    if (!diffQueue.pop(item)) {
+      stage.waitingForInputMs += millisecondsBetween(start, Clock::now());
+      break;
+    }
+    Clock::time_point popped = Clock::now();
+
+    if (item->outcome == MODIFIED && getCommitDirectory) {
+      ostringstream encoded;
+      item->diff->print(encoded);
+      item->encodedDiff = encoded.str();
+    }
+    if (item->outcome == MODIFIED && getFullCopyDirectory) {
+      // The lines that were diffed, so the copy and the diff agree
+      for (const Line& line : item->newFile) {
+	item->encodedFullCopy += line.getString();
+	item->encodedFullCopy += '\n';
+      }
+    }
+    item->newFile.clear();
+    ++stage.itemsProcessed;
+
+    Clock::time_point processed = Clock::now();
+    encodeQueue.push(move(item));
+    Clock::time_point pushed = Clock::now();
+
+    stage.waitingForInputMs += millisecondsBetween(start, popped);
+    stage.busyMs += millisecondsBetween(popped, processed);
+    stage.waitingForOutputMs += millisecondsBetween(processed, pushed);
+  }
+
+  encodeQueue.close();
+}
+
+BatchFileWriter * CommitPipeline::getWriter() {
+  if (!writer) {
+    commitDirectory = getCommitDirectory();
+    writer.reset(new BatchFileWriter(commitDirectory));
+  }
+
+  return writer.get();
+}
+
+BatchFileWriter * CommitPipeline::getFullCopyWriter() {
+  if (!fullCopyWriter) {
+    fullCopyWriter.reset(new BatchFileWriter(getFullCopyDirectory()));
+  }
+
+  return fullCopyWriter.get();
+}
+
+void CommitPipeline::writeItem(Item& item) {
+  if (!getCommitDirectory) {
+    return;
+  }
+
+  if (item.outcome == MODIFIED) {
+    if (!getWriter()->writeFile(item.path, item.encodedDiff)) {
+      item.outcome = FAILED;
+      return;
+    }
+    item.encodedDiff.clear();
+    if (getFullCopyDirectory) {
+      if (!getFullCopyWriter()->writeFile(item.path, item.encodedFullCopy)) {
+	item.outcome = FAILED;
+	return;
+      }
+      item.encodedFullCopy.clear();
+    }
+  } else if (item.outcome == ADDED) {
+    if (!getWriter()->copyFile(item.path, item.path)) {
+      item.outcome = FAILED;
+      return;
+    }
+    // The snapshot is already a full copy, so it only needs another name
+    if (getFullCopyDirectory &&
+	!getFullCopyWriter()->linkFile(
+	    FileSystemInterface::appendPath(commitDirectory, item.path),
+	    item.path)) {
+      item.outcome = FAILED;
+      return;
+    }
+
+    // Hash what actually went into the snapshot, rather than the file, which
+    // may have changed since
+    if (!ContentHash::ofFile(
+	    FileSystemInterface::appendPath(commitDirectory,
+					    item.path).c_str(), item.hash)) {
+      item.hash = "";
+    }
+  }
+}
+
+void CommitPipeline::runWriter() {
+  StageStats& stage = stats.stages[3];
+
+  while (true) {
+    Clock::time_point start = Clock::now();
+    unique_ptr<Item> item;
+    if (!encodeQueue.pop(item)) {
+      stage.waitingForInputMs += millisecondsBetween(start, Clock::now());
+      break;
+    }
+    Clock::time_point popped = Clock::now();
+
+    writeItem(*item);
+    ++stage.itemsProcessed;
+
+    Result result;
+    result.path = item->path;
+    result.outcome = item->outcome;
+    result.info = item->info;
+    result.hash = item->hash;
+    result.diff = item->diff;
+    results->push_back(result);
+
+    Clock::time_point processed = Clock::now();
+    stage.waitingForInputMs += millisecondsBetween(start, popped);
+    stage.busyMs += millisecondsBetween(popped, processed);
+  }
+}
+
+void CommitPipeline::run(const vector<string>& addedFiles,
+			 const vector<string>& trackedFiles,
+			 function<string()> getCommitDirectory,
+			 function<string()> getFullCopyDirectory,
+			 vector<Result>& results) {
+  this->getCommitDirectory = getCommitDirectory;
+  this->getFullCopyDirectory = getCommitDirectory ? getFullCopyDirectory :
+    function<string()>();
+  this->results = &results;
+
+  thread reader(&CommitPipeline::runReader, this, cref(addedFiles),
+		cref(trackedFiles));
+  thread differ(&CommitPipeline::runDiffer, this);
+  thread encoder(&CommitPipeline::runEncoder, this);
+  runWriter();
+
+  reader.join();
+  differ.join();
+  encoder.join();
+
+  stats.queueHighWaterMarks.push_back(readQueue.getHighWaterMark());
+  stats.queueHighWaterMarks.push_back(diffQueue.getHighWaterMark());
+  stats.queueHighWaterMarks.push_back(encodeQueue.getHighWaterMark());
+}
+
+const CommitPipeline::Stats& CommitPipeline::getStats() const {
+  return stats;
+}
+
+bool CommitPipeline::getWriteStats(BatchFileWriter::Stats& writeStats) const {
+  if (!writer) {
+    return false;
+  }
+
+  writeStats = writer->getStats();
+  if (fullCopyWriter) {
+    const BatchFileWriter::Stats& fullCopyStats = fullCopyWriter->getStats();
+    writeStats.mkdirCalls += fullCopyStats.mkdirCalls;
+    writeStats.openCalls += fullCopyStats.openCalls;
+    writeStats.writeCalls += fullCopyStats.writeCalls;
+    writeStats.filesCopied += fullCopyStats.filesCopied;
+    writeStats.filesCloned += fullCopyStats.filesCloned;
+    writeStats.filesLinked += fullCopyStats.filesLinked;
+    writeStats.directoriesCreated += fullCopyStats.directoriesCreated;
+    writeStats.filesWritten += fullCopyStats.filesWritten;
+  }
+  return true;
+}
@@ -0,0 +1,55 @@
+#include <fstream>
+#include <vector>
+
+#include "Config.h"
+#include "FileWriter.h"
+
+using namespace std;
+
+Config::Config() : dirty(false) {}
+
+bool Config::read(const char * fileName) {
+  ifstream input(fileName);
+  if (!input) {
+    return true;
+  }
+
+  string line;
+  while (getline(input, line)) {
+    const size_t equals = line.find('=');
+    if (equals == string::npos || equals == 0) {
+      return false;
+    }
+    values[line.substr(0, equals)] = line.substr(equals + 1);
+  }
+
+  return true;
+}
+
+bool Config::save(const char * fileName) {
+  vector<string> lines;
+  for (const auto& value : values) {
+    lines.push_back(value.first + "=" + value.second);
+  }
+
+  if (!FileWriter::replaceFile(fileName, lines)) {
+    return false;
+  }
+
+  dirty = false;
+  return true;
+}
+
+bool Config::hasUnsavedChanges() const {
+  return dirty;
+}
+
+string Config::get(const string& name, const string& defaultValue) const {
+  map<string, string>::const_iterator it = values.find(name);
+  return it == values.end() ? defaultValue : it->second;
+}
+
+void Config::set(const string& name, const string& value) {
+  values[name] = value;
+  dirty = true;
+}
@@ -0,0 +1,77 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+
+#include "ContentHash.h"
+
+using namespace std;
+
+static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+static void hashBytes(uint64_t& hash, const char * bytes, size_t length) {
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= (unsigned char) bytes[i];
+    hash *= FNV_PRIME;
+  }
+}
+
+static string toHex(uint64_t hash) {
+  char buffer[17];
+  snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long) hash);
+  return buffer;
+}
+
+string ContentHash::ofLines(const vector<Line>& lines) {
+  uint64_t hash = FNV_OFFSET_BASIS;
+  for (const Line& line : lines) {
+    const string text = line.getString();
+    hashBytes(hash, text.data(), text.length());
+    hashBytes(hash, "\n", 1);
+  }
+
+  return toHex(hash);
+}
+
+string ContentHash::ofLines(const vector<string>& lines) {
+  uint64_t hash = FNV_OFFSET_BASIS;
+  for (const string& line : lines) {
+    hashBytes(hash, line.data(), line.length());
+    hashBytes(hash, "\n", 1);
+  }
+
+  return toHex(hash);
+}
+
+bool ContentHash::ofFile(const char * fileName, string& hash) {
+  int fd = open(fileName, O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+
+  uint64_t value = FNV_OFFSET_BASIS;
+  char buffer[1 << 16];
+  char lastByte = '\n';
+  ssize_t bytesRead;
+
+  while ((bytesRead = read(fd, buffer, sizeof(buffer))) > 0) {
+    hashBytes(value, buffer, bytesRead);
+    lastByte = buffer[bytesRead - 1];
+  }
+
+  close(fd);
+
+  if (bytesRead == -1) {
+    return false;
+  }
+
+  // Treat an unterminated last line the same as a terminated one
+  if (lastByte != '\n') {
+    hashBytes(value, "\n", 1);
+  }
+
+  hash = toHex(value);
+  return true;
+}
@@ -2,100 +2,124 @@
 
 using namespace std;
 
-static void reindex(vector<Line>& file) {
-  unsigned int curElem = 0;
-
-  for (vector<Line>::iterator it = file.begin(); it != file.end(); ++it) {
-    it->setLineNumber(curElem);
-    ++curElem;
-  }
-}
-
-void DiffApplier::applyDiff(const vector<Line>& originalFile,
-			    const FileDiff& diff, vector<Line>& newFile) {
-  /*************** copy everything from originalFile to newFile ***************/
-  for (vector<Line>::const_iterator it = originalFile.begin();
-       it != originalFile.end(); ++it) {
-    newFile.push_back(*it);
-  }
-  
-  /****************** delete everything with the given index ******************/
+bool DiffApplier::applyDiff(const vector<Line>& originalFile,
+			    const FileDiff& diff, vector<Line>& newFile,
+			    bool keepLineNumbers) {
+  // Deletions and insertions are both in order of the line they apply to, so
+  // the new file can be built in a single pass over the original. Insertions
+  // go before the line they're numbered with; those numbered with the length
+  // of the file go at the end.
   const vector<DiffElement>& deletions = diff.getDeletions();
+  const vector<DiffElement>& insertions = diff.getInsertions();
+  size_t nextDeletion = 0;
+  size_t nextInsertion = 0;
 
-  for (vector<DiffElement>::const_reverse_iterator rit = deletions.rbegin();
-       rit != deletions.rend(); ++rit) {
-    // for each element, remove from original file at the index specified
-    int idx = rit->getBaseStartingLine();
-    int numLines = rit->getNumLines();
+  for (size_t lineNumber = 0; lineNumber <= originalFile.size();
+       ++lineNumber) {
+    while (nextInsertion < insertions.size() &&
+	   insertions[nextInsertion].getBaseStartingLine() == lineNumber) {
+      for (const string& line : insertions[nextInsertion].getLines()) {
+	newFile.push_back(Line(keepLineNumbers ? INSERTED_LINE :
+			       newFile.size(), line));
+      }
+      ++nextInsertion;
+    }
+
+    if (lineNumber == originalFile.size()) {
+      break;
+    }
 
-    for (int i = 0; i < numLines; ++i) {
-      newFile.erase(newFile.begin() + idx);
+    if (nextDeletion < deletions.size() &&
+	deletions[nextDeletion].getBaseStartingLine() <= lineNumber) {
+      const DiffElement& deletion = deletions[nextDeletion];
+      if (lineNumber + 1 ==
+	  deletion.getBaseStartingLine() + deletion.getNumLines()) {
+	++nextDeletion;
+      }
+      continue;
     }
+
+    newFile.push_back(Line(keepLineNumbers ?
+			   originalFile[lineNumber].getNumber() :
+			   newFile.size(),
+			   originalFile[lineNumber].getString()));
   }
 
-  // At this point newFile contains the longest common subsequence!
+  // Anything left over refers to lines the original file doesn't have
+  return nextDeletion == deletions.size() &&
+    nextInsertion == insertions.size();
+}
 
-  /** Figure out the indices in the newFile vector we need to insert the new **/
-  /** lines at                                                               **/
-  vector<int> indicesToInsertAt;
+bool DiffApplier::unapplyDiff(const vector<Line>& newFile,
+			      const FileDiff& diff, vector<Line>& originalFile) {
+  // Walks the original file's line numbers as applyDiff does, skipping over
+  // what was inserted before each line and putting back what was deleted
+  const vector<DiffElement>& deletions = diff.getDeletions();
   const vector<DiffElement>& insertions = diff.getInsertions();
-  int currentIndex = 0;
-  
-  for (vector<DiffElement>::const_iterator it = insertions.begin();
-       it != insertions.end(); ++it) {
-    while (newFile[currentIndex].getNumber() < it->getBaseStartingLine()) {
-      ++currentIndex;
-    }
+  size_t nextDeletion = 0;
+  size_t nextInsertion = 0;
+  size_t newLine = 0;
 
-    indicesToInsertAt.push_back(currentIndex );
-    ++currentIndex;
-  }
-  
-  int originalSize = originalFile.size();
+  while (true) {
+    const size_t lineNumber = originalFile.size();
+    while (nextInsertion < insertions.size() &&
+	   insertions[nextInsertion].getBaseStartingLine() == lineNumber) {
+      newLine += insertions[nextInsertion].getNumLines();
+      ++nextInsertion;
+    }
+    if (newLine > newFile.size()) {
+      return false;
+    }
 
-  vector<DiffElement>::const_reverse_iterator rit = insertions.rbegin();
-  
-  for (vector<int>::reverse_iterator it = indicesToInsertAt.rbegin();
-       it != indicesToInsertAt.rend(); ++it) {
-    DiffElement currDiffElement = *rit;
-    const vector<string>& newLines = currDiffElement.getLines();
-    
-    if (*it >= originalSize) {
-      // push backs
-      for (vector<string>::const_iterator lineIt = newLines.begin();
-	   lineIt != newLines.end(); ++lineIt) {
-	newFile.push_back(Line(0, *lineIt));
+    if (nextDeletion < deletions.size() &&
+	deletions[nextDeletion].getBaseStartingLine() <= lineNumber) {
+      const DiffElement& deletion = deletions[nextDeletion];
+      const size_t offset = lineNumber - deletion.getBaseStartingLine();
+      if (offset >= deletion.getLines().size()) {
+	return false;
       }
-    } else {
-      for (vector<string>::const_reverse_iterator lineIt = newLines.rbegin();
-	   lineIt != newLines.rend(); ++lineIt) {
-	newFile.insert(newFile.begin() + *it, Line(0, *lineIt));
+      originalFile.push_back(Line(lineNumber, deletion.getLines()[offset]));
+      if (offset + 1 == deletion.getNumLines()) {
+	++nextDeletion;
       }
+      continue;
     }
 
-    ++rit;
-  } // end for loop
+    if (newLine == newFile.size()) {
+      break;
+    }
+    originalFile.push_back(Line(lineNumber, newFile[newLine].getString()));
+    ++newLine;
+  }
+
+  return nextDeletion == deletions.size() &&
+    nextInsertion == insertions.size();
 }
 
-void DiffApplier::applyManyDiffs(std::vector<Line>& baseFile,
+bool DiffApplier::applyManyDiffs(std::vector<Line>& baseFile,
 				 const FileDiff& diff1, const FileDiff& diff2) {
   vector<Line> newFile;
-  DiffApplier::applyDiff(baseFile, diff1, newFile);
-  reindex(newFile);
-  baseFile = newFile;
+  if (!DiffApplier::applyDiff(baseFile, diff1, newFile)) {
+    return false;
+  }
+  baseFile.swap(newFile);
   newFile.clear();
-  DiffApplier::applyDiff(baseFile, diff2, newFile);
-  baseFile = newFile;
+  if (!DiffApplier::applyDiff(baseFile, diff2, newFile)) {
+    return false;
+  }
+  baseFile.swap(newFile);
+  return true;
 }
 
-void DiffApplier::applyManyDiffs(std::vector<Line>& baseFile,
+bool DiffApplier::applyManyDiffs(std::vector<Line>& baseFile,
 				 std::queue<FileDiff>& diffsToApply) {
   while (!diffsToApply.empty()) {
     vector<Line> newFile;
-    FileDiff d = diffsToApply.front();
+    if (!DiffApplier::applyDiff(baseFile, diffsToApply.front(), newFile)) {
+      return false;
+    }
     diffsToApply.pop();
-    DiffApplier::applyDiff(baseFile, d, newFile);
-    reindex(newFile);
-    baseFile = newFile;
+    baseFile.swap(newFile);
   }
+  return true;
 }
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <cstdio>
 
 #include "DiffElement.h"
 
@@ -15,8 +16,16 @@ DiffElement::DiffElement(const ElementType type,
   }
 }
 
+DiffElement::DiffElement(const ElementType type,
+			 const unsigned int baseStartingLine,
+			 const vector<string>& lines) :
+  type(type), lines(lines), baseStartingLine(baseStartingLine) {}
+
+// The starting line is followed by the number of lines, so that lines which
+// happen to look like numbers can't be mistaken for the start of the next
+// element
 void DiffElement::print(ostream& os) const {
-  os << baseStartingLine << "\n";
+  os << baseStartingLine << " " << lines.size() << "\n";
   for (const string& line : lines) {
     os << line << "\n";
   }
@@ -24,6 +33,31 @@ void DiffElement::print(ostream& os) const {
   os << flush;
 }
 
+bool DiffElement::read(istream& is, const ElementType type,
+		       vector<DiffElement>& elements) {
+  string header;
+  unsigned int baseStartingLine;
+  size_t numLines;
+  if (!getline(is, header) ||
+      sscanf(header.c_str(), "%u %zu", &baseStartingLine, &numLines) != 2 ||
+      numLines == 0) {
+    return false;
+  }
+
+  // Read a line at a time rather than trusting the count to size anything
+  vector<string> lines;
+  string line;
+  for (size_t i = 0; i < numLines; ++i) {
+    if (!getline(is, line)) {
+      return false;
+    }
+    lines.push_back(line);
+  }
+
+  elements.push_back(DiffElement(type, baseStartingLine, lines));
+  return true;
+}
+
 unsigned int DiffElement::getNumLines() const {
   return lines.size();
 }
@@ -1,16 +1,23 @@
+#include <cstdio>
 #include <fstream>
 
 #include "FileDiff.h"
 
 using namespace std;
 
+FileDiff::FileDiff() {}
+
 FileDiff::FileDiff(const vector<DiffElement> insertions, const vector<DiffElement> deletions) :
   insertions(insertions), deletions(deletions) {}
 
 void FileDiff::print(const string& path) const {
   ofstream os;
   os.open(path);
-  
+  print(os);
+  os.close();
+}
+
+void FileDiff::print(ostream& os) const {
   os << "insertions [" << insertions.size() << "]" << "\n";
   for (const DiffElement& insertion : insertions) {
     insertion.print(os);
@@ -24,7 +31,38 @@ void FileDiff::print(const string& path) const {
   }
 
   os << flush;
-  os.close();
+}
+
+bool FileDiff::read(const string& path) {
+  ifstream is(path);
+  return is && read(is);
+}
+
+static bool readElements(istream& is, const char * heading,
+			 const ElementType type,
+			 vector<DiffElement>& elements) {
+  string line;
+  size_t numElements;
+  if (!getline(is, line) ||
+      sscanf(line.c_str(), heading, &numElements) != 1) {
+    return false;
+  }
+
+  elements.clear();
+  for (size_t i = 0; i < numElements; ++i) {
+    // Each element is followed by a blank line
+    if (!DiffElement::read(is, type, elements) || !getline(is, line) ||
+	!line.empty()) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool FileDiff::read(istream& is) {
+  return readElements(is, "insertions [%zu]", INSERTION, insertions) &&
+    readElements(is, "deletions [%zu]", DELETION, deletions);
 }
 
 const std::vector<DiffElement>& FileDiff::getDeletions() const {
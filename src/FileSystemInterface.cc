@@ -1,6 +1,13 @@
+#include <cerrno>
 #include <iostream>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "FileSystemInterface.h"
 
@@ -12,6 +19,11 @@ bool FileSystemInterface::fileExists(const char * fileName) {
   return (stat(fileName, &info) == 0);
 }
 
+bool FileSystemInterface::getFileInfo(const char * fileName,
+				      struct stat& info) {
+  return (stat(fileName, &info) == 0);
+}
+
 const int FileSystemInterface::createDirectory(const char * dirName) {
   if (fileExists(dirName)) {
     return 0;
@@ -54,3 +66,175 @@ void FileSystemInterface::createDirectories(
     createDirectory(completePath.c_str());
   }
 }
+
+void FileSystemInterface::removeEmptyDirectories(const string& fileName) {
+  vector<string> directories;
+  parseDirectoryStructure(fileName, directories);
+  for (vector<string>::reverse_iterator it = directories.rbegin();
+       it != directories.rend(); ++it) {
+    if (rmdir(it->c_str()) != 0) {
+      break;
+    }
+  }
+}
+
+// Each entry's name, and whether it's a directory
+static bool readEntries(const string& directory,
+			vector<pair<string, bool> >& entries) {
+  DIR * handle = opendir(directory.c_str());
+  if (handle == NULL) {
+    return false;
+  }
+
+  struct dirent * entry;
+  while ((entry = readdir(handle)) != NULL) {
+    const string name = entry->d_name;
+    if (name == "." || name == "..") {
+      continue;
+    }
+
+    bool isDirectory = entry->d_type == DT_DIR;
+    if (entry->d_type == DT_UNKNOWN) {
+      // Not every file system fills the type in
+      struct stat info;
+      isDirectory = lstat(FileSystemInterface::appendPath(directory,
+							  name).c_str(),
+			  &info) == 0 && S_ISDIR(info.st_mode);
+    }
+    entries.push_back(make_pair(name, isDirectory));
+  }
+  closedir(handle);
+  return true;
+}
+
+bool FileSystemInterface::listDirectory(const string& directory,
+					vector<string>& names) {
+  vector<pair<string, bool> > entries;
+  if (!readEntries(directory, entries)) {
+    return false;
+  }
+
+  for (const pair<string, bool>& entry : entries) {
+    names.push_back(entry.first);
+  }
+  return true;
+}
+
+static bool addFilesUnder(const string& directory, const string& prefix,
+			  vector<string>& files) {
+  vector<pair<string, bool> > entries;
+  if (!readEntries(FileSystemInterface::appendPath(directory, prefix),
+		   entries)) {
+    return false;
+  }
+
+  for (const pair<string, bool>& entry : entries) {
+    const string path = FileSystemInterface::appendPath(prefix, entry.first);
+    if (!entry.second) {
+      files.push_back(path);
+    } else if (!addFilesUnder(directory, path, files)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool FileSystemInterface::listFilesUnder(const string& directory,
+					 vector<string>& files) {
+  return addFilesUnder(directory, "", files);
+}
+
+bool FileSystemInterface::removeDirectory(const string& directory) {
+  vector<pair<string, bool> > entries;
+  if (!readEntries(directory, entries)) {
+    return false;
+  }
+
+  for (const pair<string, bool>& entry : entries) {
+    const string path = appendPath(directory, entry.first);
+    if (entry.second ? !removeDirectory(path) : unlink(path.c_str()) != 0) {
+      return false;
+    }
+  }
+  return rmdir(directory.c_str()) == 0;
+}
+
+static bool copyWithReadAndWrite(int sourceFd, int destinationFd) {
+  char buffer[1 << 16];
+
+  while (true) {
+    ssize_t bytesRead = read(sourceFd, buffer, sizeof(buffer));
+    if (bytesRead == 0) {
+      return true;
+    }
+    if (bytesRead == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      return false;
+    }
+
+    ssize_t written = 0;
+    while (written < bytesRead) {
+      ssize_t result = write(destinationFd, buffer + written,
+			     bytesRead - written);
+      if (result == -1) {
+	if (errno == EINTR) {
+	  continue;
+	}
+	return false;
+      }
+      written += result;
+    }
+  }
+}
+
+bool FileSystemInterface::copyFileContents(int sourceFd, int destinationFd,
+					   bool& cloned) {
+  cloned = false;
+
+#ifdef FICLONE
+  if (ioctl(destinationFd, FICLONE, sourceFd) == 0) {
+    cloned = true;
+    return true;
+  }
+#endif
+
+  struct stat info;
+  if (fstat(sourceFd, &info) != 0) {
+    return false;
+  }
+
+  // Try copy_file_range first, then sendfile, and only then copy through a
+  // buffer ourselves. Anything already copied stays copied when falling back,
+  // since all of these advance the file offsets.
+  bool useCopyFileRange = true;
+  while (true) {
+    ssize_t copied;
+    if (useCopyFileRange) {
+      copied = copy_file_range(sourceFd, NULL, destinationFd, NULL,
+			       1 << 30, 0);
+    } else {
+      copied = sendfile(destinationFd, sourceFd, NULL, 1 << 30);
+    }
+
+    if (copied == 0) {
+      return true;
+    }
+
+    if (copied == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      if (useCopyFileRange && (errno == EXDEV || errno == ENOSYS ||
+			       errno == EINVAL || errno == EOPNOTSUPP)) {
+	useCopyFileRange = false;
+	continue;
+      }
+      if (errno == EINVAL || errno == ENOSYS) {
+	return copyWithReadAndWrite(sourceFd, destinationFd);
+      }
+      return false;
+    }
+  }
+}
@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <cerrno>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "FileWatcher.h"
+
+using namespace std;
+
+static const uint32_t WATCH_MASK = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+  IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |
+  IN_MOVE_SELF;
+
+static string getParentDirectory(const string& path) {
+  size_t locationOfSlash = path.rfind('/');
+  if (locationOfSlash == string::npos) {
+    return ".";
+  }
+
+  return path.substr(0, locationOfSlash);
+}
+
+FileWatcher::FileWatcher() : inotifyFd(-1), needsFullRescan(true) {}
+
+FileWatcher::~FileWatcher() {
+  stop();
+}
+
+bool FileWatcher::start() {
+  if (inotifyFd != -1) {
+    return true;
+  }
+
+  inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotifyFd == -1) {
+    return false;
+  }
+
+  // We don't know what happened before we started watching
+  needsFullRescan = true;
+  return true;
+}
+
+void FileWatcher::stop() {
+  if (inotifyFd == -1) {
+    return;
+  }
+
+  close(inotifyFd);
+  inotifyFd = -1;
+  directoriesByWatch.clear();
+  watchedDirectories.clear();
+  changedPaths.clear();
+  needsFullRescan = true;
+}
+
+bool FileWatcher::isRunning() const {
+  return inotifyFd != -1;
+}
+
+void FileWatcher::watchDirectory(const string& directory) {
+  if (watchedDirectories.count(directory) != 0) {
+    return;
+  }
+
+  int watch = inotify_add_watch(inotifyFd, directory.c_str(), WATCH_MASK);
+  if (watch == -1) {
+    // Paths in here will be reported as changed until we manage to watch it
+    return;
+  }
+
+  directoriesByWatch[watch] = directory;
+  watchedDirectories.insert(directory);
+}
+
+void FileWatcher::watchPath(const string& path) {
+  if (inotifyFd == -1) {
+    return;
+  }
+
+  // Every directory on the way, as a directory being renamed or removed is
+  // only heard about by the one it's in. Once one is watched, so are the
+  // ones above it.
+  string directory = getParentDirectory(path);
+  while (watchedDirectories.count(directory) == 0) {
+    watchDirectory(directory);
+    if (directory == ".") {
+      break;
+    }
+    directory = getParentDirectory(directory);
+  }
+}
+
+bool FileWatcher::isWatched(const string& path) const {
+  string directory = path;
+  do {
+    directory = getParentDirectory(directory);
+    if (watchedDirectories.count(directory) == 0) {
+      return false;
+    }
+  } while (directory != ".");
+  return true;
+}
+
+void FileWatcher::forgetDirectory(const string& directory) {
+  const string prefix = directory + "/";
+  for (unordered_map<int, string>::iterator it = directoriesByWatch.begin();
+       it != directoriesByWatch.end();) {
+    if (it->second == directory || it->second.compare(0, prefix.size(),
+						      prefix) == 0) {
+      inotify_rm_watch(inotifyFd, it->first);
+      watchedDirectories.erase(it->second);
+      it = directoriesByWatch.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void FileWatcher::processEvents() {
+  // Large enough for plenty of events at once, and aligned as inotify_event
+  // requires
+  char buffer[64 * 1024]
+    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+  while (true) {
+    ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+    if (length <= 0) {
+      // EAGAIN means we've drained the queue
+      if (length == -1 && errno == EINTR) {
+	continue;
+      }
+      return;
+    }
+
+    for (char * cursor = buffer; cursor < buffer + length;
+	 cursor += sizeof(struct inotify_event) +
+	   ((struct inotify_event *) cursor)->len) {
+      const struct inotify_event * event = (struct inotify_event *) cursor;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+	needsFullRescan = true;
+	continue;
+      }
+
+      unordered_map<int, string>::iterator directory =
+	directoriesByWatch.find(event->wd);
+      if (directory == directoriesByWatch.end()) {
+	continue;
+      }
+
+      if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+	// The directory itself is gone, so we can no longer hear about what
+	// happens to the files that were in it
+	watchedDirectories.erase(directory->second);
+	if (!(event->mask & IN_IGNORED)) {
+	  inotify_rm_watch(inotifyFd, event->wd);
+	}
+	directoriesByWatch.erase(directory);
+	needsFullRescan = true;
+	continue;
+      }
+
+      if (event->len == 0) {
+	continue;
+      }
+
+      const string name = event->name;
+      const string path = directory->second == "." ? name :
+	directory->second + "/" + name;
+      if ((event->mask & IN_ISDIR) &&
+	  (event->mask & (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))) {
+	// Watches follow directories wherever they're moved to, so those
+	// under this name now watch the wrong place, or nothing at all
+	forgetDirectory(path);
+	needsFullRescan = true;
+	continue;
+      }
+      changedPaths.insert(path);
+    }
+  }
+}
+
+bool FileWatcher::getChangedPaths(vector<string>& paths) {
+  if (inotifyFd == -1) {
+    return false;
+  }
+
+  processEvents();
+
+  if (needsFullRescan) {
+    return false;
+  }
+
+  paths.insert(paths.end(), changedPaths.begin(), changedPaths.end());
+  sort(paths.begin(), paths.end());
+  return true;
+}
+
+void FileWatcher::markClean(const string& path) {
+  // Nothing to keep track of for when not watching
+  if (inotifyFd == -1) {
+    return;
+  }
+
+  // A path in a directory we couldn't watch has to keep being looked at
+  if (isWatched(path)) {
+    changedPaths.erase(path);
+  } else {
+    changedPaths.insert(path);
+  }
+}
+
+void FileWatcher::markChanged(const string& path) {
+  if (inotifyFd == -1) {
+    return;
+  }
+
+  changedPaths.insert(path);
+}
+
+void FileWatcher::finishFullRescan() {
+  needsFullRescan = false;
+}
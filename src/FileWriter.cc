@@ -1,5 +1,9 @@
+#include <cstdio>
 #include <fstream>
 
+#include <sys/stat.h>
+
+#include "FileSystemInterface.h"
 #include "FileWriter.h"
 
 using namespace std;
@@ -9,8 +13,39 @@ void FileWriter::writeFile(const char * fileName, const vector<string>& lines) {
   file.open(fileName);
 
   for (const string& line : lines) {
-    file << line << endl;
+    file << line << "\n";
   }
 
   file.close();
 }
+
+bool FileWriter::replaceFile(const string& fileName,
+			     const vector<string>& lines) {
+  vector<string> directories;
+  FileSystemInterface::parseDirectoryStructure(fileName, directories);
+  FileSystemInterface::createDirectories("", directories);
+
+  const string temporaryFileName = fileName + ".kiltmp";
+  ofstream file(temporaryFileName.c_str());
+  for (const string& line : lines) {
+    file << line << "\n";
+  }
+  file.close();
+
+  // The copy takes the place of the file, so it keeps its permissions (eg. a
+  // script stays executable). History doesn't record them, so a new file
+  // gets the default ones.
+  struct stat info;
+  if (file && FileSystemInterface::getFileInfo(fileName.c_str(), info) &&
+      chmod(temporaryFileName.c_str(), info.st_mode & 07777) != 0) {
+    remove(temporaryFileName.c_str());
+    return false;
+  }
+
+  if (!file || rename(temporaryFileName.c_str(), fileName.c_str()) != 0) {
+    remove(temporaryFileName.c_str());
+    return false;
+  }
+
+  return true;
+}
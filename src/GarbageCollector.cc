@@ -0,0 +1,484 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+
+#include "CommitContents.h"
+#include "FileParser.h"
+#include "FileSystemInterface.h"
+#include "FileWriter.h"
+#include "GarbageCollector.h"
+#include "Manifest.h"
+#include "ParallelRunner.h"
+
+using namespace std;
+
+namespace {
+  // A file of a commit, eg. one of its full copies
+  struct CommitFile {
+    string commit;
+    string path;
+    // The commit with the next version, for full copies being replaced
+    string newerCommit;
+  };
+
+  bool isCommitHash(const string& name) {
+    return !name.empty() &&
+      name.find_first_not_of("0123456789") == string::npos;
+  }
+
+  // Everywhere a commit keeps things, with its own directory last. Given an
+  // empty hash, the directories that hold them for every commit.
+  vector<string> getCommitDirectories(const string& commitDirectory,
+				      const string& blameDirectory,
+				      const string& commit) {
+    vector<string> directories;
+    directories.push_back(
+	FileSystemInterface::appendPath(blameDirectory, commit));
+    directories.push_back(
+	CommitContents::getNewerVersionFileName(commitDirectory, "", commit));
+    directories.push_back(
+	CommitContents::getFullCopyDirectory(commitDirectory, commit));
+    directories.push_back(
+	FileSystemInterface::appendPath(commitDirectory, commit));
+    return directories;
+  }
+}
+
+GarbageCollector::GarbageCollector(const Tree& tree,
+				   const string& commitDirectory,
+				   const string& objectDirectory,
+				   const string& blameDirectory) :
+  tree(tree), commitDirectory(commitDirectory),
+  objectDirectory(objectDirectory), blameDirectory(blameDirectory),
+  budgetMs(0) {
+  stats = Stats();
+}
+
+bool GarbageCollector::outOfTime() const {
+  return budgetMs != 0 &&
+    chrono::duration<double, milli>(Clock::now() - start).count() >= budgetMs;
+}
+
+bool GarbageCollector::markCommits(const vector<string>& keep,
+				   vector<string>& tips) {
+  vector<int> nodes;
+  for (const string& branch : tree.getBranchNames()) {
+    const int tip = tree.getBranchTip(branch);
+    if (tip != Tree::NO_NODE) {
+      nodes.push_back(tip);
+    }
+  }
+  vector<int> extraNodes;
+  for (const string& commit : keep) {
+    const int node = tree.findCommit(commit);
+    if (node == Tree::NO_NODE) {
+      return false;
+    }
+    nodes.push_back(node);
+    extraNodes.push_back(node);
+  }
+
+  // Where each branch's latest versions are
+  for (int node : nodes) {
+    const int commitNode = tree.findNearestCommit(node);
+    const string commit = commitNode == Tree::NO_NODE ? "" :
+      to_string(tree.getCommit(commitNode));
+    if (!commit.empty() && find(tips.begin(), tips.end(), commit) ==
+	tips.end()) {
+      tips.push_back(commit);
+    }
+  }
+
+  // Nodes are only records in the tree, so walking them is cheap; it's
+  // reading the commits they lead to that's worth sharing out
+  const vector<bool> reachableNodes = tree.findReachable(extraNodes);
+  vector<string> commits;
+  for (size_t node = 0; node < reachableNodes.size(); ++node) {
+    if (reachableNodes[node] && !tree.isBranchNode(node)) {
+      commits.push_back(to_string(tree.getCommit(node)));
+    }
+  }
+
+  vector<CommitInfo> infos(commits.size());
+  atomic<bool> failed(false);
+  ParallelRunner::forEach(commits.size(), [&](size_t i) {
+      if (!infos[i].read(CommitInfo::getFileName(commitDirectory,
+						  commits[i]))) {
+	failed = true;
+      }
+    });
+  if (failed) {
+    return false;
+  }
+
+  for (size_t i = 0; i < commits.size(); ++i) {
+    reachable[commits[i]] = move(infos[i]);
+  }
+  return true;
+}
+
+bool GarbageCollector::markObjects() {
+  vector<const string *> roots;
+  for (const auto& commit : reachable) {
+    if (!commit.second.manifest.empty()) {
+      roots.push_back(&commit.second.manifest);
+    }
+  }
+
+  // Commits share most of their directories with their parents', so each
+  // one is only gone into by whichever thread gets to it first
+  mutex objectsMutex;
+  atomic<bool> failed(false);
+  ParallelRunner::forEach(roots.size(), [&](size_t i) {
+      // A manifest keeps what it reads, so they can't be shared between
+      // threads
+      Manifest manifest(objectDirectory);
+      if (!manifest.walkDirectories(*roots[i], [&](const string& hash) {
+	    lock_guard<mutex> lock(objectsMutex);
+	    return objects.insert(hash).second;
+	  })) {
+	failed = true;
+      }
+    });
+  return !failed;
+}
+
+void GarbageCollector::findUnreachableCommits(
+    vector<string>& unreachable) const {
+  vector<string> names;
+  for (const string& directory :
+	 getCommitDirectories(commitDirectory, blameDirectory, "")) {
+    FileSystemInterface::listDirectory(directory, names);
+  }
+
+  for (const string& name : names) {
+    if (isCommitHash(name) && reachable.count(name) == 0) {
+      unreachable.push_back(name);
+    }
+  }
+  sort(unreachable.begin(), unreachable.end(),
+       [](const string& first, const string& second) {
+	 return atoi(first.c_str()) < atoi(second.c_str());
+       });
+  unreachable.erase(unique(unreachable.begin(), unreachable.end()),
+		    unreachable.end());
+}
+
+bool GarbageCollector::rebuildVersions() {
+  // Kept versions whose notes lead to commits that are going
+  vector<CommitFile> notes;
+  vector<string> names;
+  FileSystemInterface::listDirectory(
+      CommitContents::getNewerVersionFileName(commitDirectory, "", ""), names);
+  for (const string& name : names) {
+    vector<string> paths;
+    if (reachable.count(name) == 0 ||
+	!FileSystemInterface::listFilesUnder(
+	    CommitContents::getNewerVersionFileName(commitDirectory, "", name),
+	    paths)) {
+      continue;
+    }
+
+    for (const string& path : paths) {
+      ifstream input(CommitContents::getNewerVersionFileName(commitDirectory,
+							     path, name));
+      string newer;
+      if (input >> newer && reachable.count(newer) == 0) {
+	CommitFile note;
+	note.commit = name;
+	note.path = path;
+	notes.push_back(note);
+      }
+    }
+  }
+
+  atomic<size_t> rebuilt(0);
+  atomic<size_t> unreadable(0);
+  atomic<bool> incomplete(false);
+  ParallelRunner::forEach(notes.size(), [&](size_t i) {
+      if (outOfTime()) {
+	incomplete = true;
+	return;
+      }
+
+      const CommitFile& note = notes[i];
+      vector<Line> lines;
+      if (!CommitContents::readFromNewer(commitDirectory, note.path,
+					 note.commit, lines)) {
+	++unreadable;
+	incomplete = true;
+	return;
+      }
+
+      vector<string> contents;
+      for (const Line& line : lines) {
+	contents.push_back(line.getString());
+      }
+      if (!FileWriter::replaceFile(
+	      FileSystemInterface::appendPath(
+		  CommitContents::getFullCopyDirectory(commitDirectory,
+						       note.commit),
+		  note.path), contents)) {
+	incomplete = true;
+	return;
+      }
+
+      const string noteFileName = CommitContents::getNewerVersionFileName(
+	  commitDirectory, note.path, note.commit);
+      remove(noteFileName.c_str());
+      FileSystemInterface::removeEmptyDirectories(noteFileName);
+      ++rebuilt;
+    });
+
+  stats.versionsRebuilt = rebuilt;
+  stats.versionsUnreadable = unreadable;
+  return !incomplete;
+}
+
+bool GarbageCollector::removeChildren(
+    const string& parent, const unordered_set<string>& children) const {
+  const size_t CHILD_COMMIT_LINE = 4;
+  const string prefix = "childCommits=[";
+
+  const string path = CommitInfo::getFileName(commitDirectory, parent);
+  vector<string> lines;
+  FileParser::readFile(path.c_str(), lines);
+  if (lines.size() <= CHILD_COMMIT_LINE ||
+      lines[CHILD_COMMIT_LINE].compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+
+  const CommitInfo& info = reachable.at(parent);
+  string listOfChildren;
+  for (const string& child : info.children) {
+    if (children.count(child) == 0) {
+      listOfChildren += (listOfChildren.empty() ? "" : ",") + child;
+    }
+  }
+  lines[CHILD_COMMIT_LINE] = prefix + listOfChildren + "]";
+
+  // Replaced rather than rewritten, as a clone may share the file
+  return FileWriter::replaceFile(path, lines);
+}
+
+bool GarbageCollector::removeCommits(const vector<string>& unreachable) {
+  // Their parents stop naming them as children first
+  vector<CommitInfo> infos(unreachable.size());
+  ParallelRunner::forEach(unreachable.size(), [&](size_t i) {
+      infos[i].read(CommitInfo::getFileName(commitDirectory, unreachable[i]));
+    });
+  map<string, unordered_set<string> > childrenByParent;
+  for (size_t i = 0; i < unreachable.size(); ++i) {
+    const string parents[] = { infos[i].parent, infos[i].mergeParent };
+    for (const string& parent : parents) {
+      if (reachable.count(parent) != 0) {
+	childrenByParent[parent].insert(unreachable[i]);
+      }
+    }
+  }
+  for (const auto& parent : childrenByParent) {
+    removeChildren(parent.first, parent.second);
+  }
+
+  atomic<size_t> removed(0);
+  atomic<bool> incomplete(false);
+  ParallelRunner::forEach(unreachable.size(), [&](size_t i) {
+      if (outOfTime()) {
+	incomplete = true;
+	return;
+      }
+
+      for (const string& directory :
+	     getCommitDirectories(commitDirectory, blameDirectory,
+				  unreachable[i])) {
+	if (FileSystemInterface::fileExists(directory.c_str()) &&
+	    !FileSystemInterface::removeDirectory(directory)) {
+	  incomplete = true;
+	  return;
+	}
+      }
+      ++removed;
+    });
+
+  stats.commitsRemoved = removed;
+  return !incomplete;
+}
+
+bool GarbageCollector::removeObjects() {
+  vector<string> names;
+  FileSystemInterface::listDirectory(objectDirectory, names);
+  vector<string> unreferenced;
+  for (const string& name : names) {
+    if (objects.count(name) == 0) {
+      unreferenced.push_back(name);
+    }
+  }
+
+  atomic<size_t> removed(0);
+  atomic<bool> incomplete(false);
+  ParallelRunner::forEach(unreferenced.size(), [&](size_t i) {
+      if (outOfTime()) {
+	incomplete = true;
+	return;
+      }
+
+      if (remove(FileSystemInterface::appendPath(objectDirectory,
+						 unreferenced[i]).c_str())
+	  == 0) {
+	++removed;
+      }
+    });
+
+  stats.objectsRemoved = removed;
+  return !incomplete;
+}
+
+bool GarbageCollector::replaceFullCopies(const vector<string>& tips) {
+  // Only reverse-delta storage makes full copies
+  vector<string> names;
+  if (!FileSystemInterface::listDirectory(
+	  CommitContents::getFullCopyDirectory(commitDirectory, ""), names)) {
+    return true;
+  }
+
+  // Branches whose manifests we can't see might be on any version
+  vector<string> tipRoots;
+  for (const string& tip : tips) {
+    const string& root = reachable.at(tip).manifest;
+    if (root.empty()) {
+      return true;
+    }
+    tipRoots.push_back(root);
+  }
+
+  // The full copies of kept versions that aren't any branch's latest, by
+  // path
+  Manifest manifest(objectDirectory);
+  unordered_map<string, unordered_set<string> > replaceable;
+  for (const string& name : names) {
+    vector<string> paths;
+    if (reachable.count(name) == 0 ||
+	!FileSystemInterface::listFilesUnder(
+	    CommitContents::getFullCopyDirectory(commitDirectory, name),
+	    paths)) {
+      continue;
+    }
+
+    for (const string& path : paths) {
+      bool latest = false;
+      for (const string& root : tipRoots) {
+	Manifest::Entry entry;
+	if (manifest.findFile(root, path, entry) && entry.commit == name) {
+	  latest = true;
+	  break;
+	}
+      }
+      if (!latest) {
+	replaceable[path].insert(name);
+      }
+    }
+  }
+
+  // The next version of each is made by a kept commit whose parent has it
+  map<pair<string, string>, string> newerCommits;
+  for (const auto& commit : reachable) {
+    const CommitInfo& info = commit.second;
+    unordered_map<string, CommitInfo>::const_iterator parent =
+      reachable.find(info.parent);
+    if (parent == reachable.end() || parent->second.manifest.empty()) {
+      continue;
+    }
+
+    for (const string& path : info.modifiedFiles) {
+      unordered_map<string, unordered_set<string> >::const_iterator it =
+	replaceable.find(path);
+      Manifest::Entry entry;
+      if (it != replaceable.end() &&
+	  manifest.findFile(parent->second.manifest, path, entry) &&
+	  it->second.count(entry.commit) != 0) {
+	newerCommits.insert(make_pair(make_pair(entry.commit, path),
+				      commit.first));
+      }
+    }
+  }
+
+  vector<CommitFile> copies;
+  for (const auto& copy : newerCommits) {
+    CommitFile file;
+    file.commit = copy.first.first;
+    file.path = copy.first.second;
+    file.newerCommit = copy.second;
+    copies.push_back(file);
+  }
+
+  atomic<size_t> replaced(0);
+  atomic<bool> incomplete(false);
+  ParallelRunner::forEach(copies.size(), [&](size_t i) {
+      if (outOfTime()) {
+	incomplete = true;
+	return;
+      }
+
+      // The newer version has to be there to go back from, whole or as a
+      // note of its own (which always goes down before its copy goes)
+      const CommitFile& copy = copies[i];
+      if (!FileSystemInterface::fileExists(
+	      FileSystemInterface::appendPath(
+		  CommitContents::getFullCopyDirectory(commitDirectory,
+						       copy.newerCommit),
+		  copy.path).c_str()) &&
+	  !FileSystemInterface::fileExists(
+	      CommitContents::getNewerVersionFileName(
+		  commitDirectory, copy.path, copy.newerCommit).c_str())) {
+	return;
+      }
+
+      const vector<string>& addedFiles = reachable.at(copy.commit).addedFiles;
+      if (CommitContents::replaceFullCopy(
+	      commitDirectory, copy.path, copy.commit,
+	      find(addedFiles.begin(), addedFiles.end(), copy.path) !=
+	      addedFiles.end(), copy.newerCommit)) {
+	++replaced;
+      }
+    });
+
+  stats.fullCopiesReplaced = replaced;
+  return !incomplete;
+}
+
+bool GarbageCollector::run(const vector<string>& keep,
+			   unsigned int budgetMs) {
+  start = Clock::now();
+  this->budgetMs = budgetMs;
+  stats = Stats();
+  reachable.clear();
+  objects.clear();
+
+  // Nothing goes unless everything that's kept could be read
+  vector<string> tips;
+  if (!markCommits(keep, tips) || !markObjects()) {
+    return false;
+  }
+  stats.reachableCommits = reachable.size();
+  stats.markMs = chrono::duration<double, milli>(Clock::now() - start).count();
+
+  vector<string> unreachable;
+  findUnreachableCommits(unreachable);
+  stats.unreachableCommits = unreachable.size();
+
+  // Each step waits for the one before to be done, as kept versions have to
+  // be readable without the commits that are going before those go
+  stats.finished = rebuildVersions() && removeCommits(unreachable) &&
+    removeObjects() && replaceFullCopies(tips);
+  stats.totalMs =
+    chrono::duration<double, milli>(Clock::now() - start).count();
+  return true;
+}
+
+const GarbageCollector::Stats& GarbageCollector::getStats() const {
+  return stats;
+}
@@ -0,0 +1,88 @@
+#include "HistoryWalk.h"
+
+using namespace std;
+
+HistoryWalk::HistoryWalk(const Tree& tree, const string& commitDirectory,
+			 const Manifest& manifests, int start,
+			 const string& path, const ChangedPathFilters * filters) :
+  tree(tree), commitDirectory(commitDirectory), manifests(manifests),
+  filters(filters), path(path), node(start), readFailed(false) {
+  stats.commitsRead = 0;
+  stats.commitsSkipped = 0;
+  stats.falsePositives = 0;
+}
+
+static bool isAtOrUnder(const string& file, const string& path) {
+  return file.compare(0, path.size(), path) == 0 &&
+    (file.size() == path.size() || file[path.size()] == '/');
+}
+
+bool HistoryWalk::touchesPath(const CommitInfo& info) const {
+  const vector<string> * lists[] = {
+    &info.addedFiles, &info.removedFiles, &info.modifiedFiles
+  };
+  for (const vector<string> * files : lists) {
+    for (const string& file : *files) {
+      if (isAtOrUnder(file, path)) {
+	return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+bool HistoryWalk::next(CommitInfo& commit) {
+  while (true) {
+    node = tree.findNearestCommit(node);
+    if (node == Tree::NO_NODE) {
+      return false;
+    }
+
+    const int commitId = tree.getCommit(node);
+    const ChangedPathFilters::Answer answer =
+      path.empty() || filters == NULL ? ChangedPathFilters::NO_FILTER :
+      filters->query(commitId, path);
+    if (answer == ChangedPathFilters::NOT_CHANGED) {
+      ++stats.commitsSkipped;
+      node = tree.getParent(node);
+      continue;
+    }
+
+    if (!commit.read(CommitInfo::getFileName(commitDirectory,
+					     to_string(commitId)))) {
+      readFailed = true;
+      node = Tree::NO_NODE;
+      return false;
+    }
+    ++stats.commitsRead;
+    node = tree.getParent(node);
+
+    if (path.empty() || touchesPath(commit)) {
+      return true;
+    }
+    if (answer == ChangedPathFilters::MAYBE_CHANGED) {
+      ++stats.falsePositives;
+    }
+
+    // Nothing since the commit that wrote the file has touched it. Merges
+    // are recorded against their first parent, so that commit is always
+    // further down the same chain.
+    Manifest::Entry entry;
+    if (!commit.manifest.empty() &&
+	manifests.findFile(commit.manifest, path, entry)) {
+      const int source = tree.findCommit(entry.commit);
+      if (source != Tree::NO_NODE) {
+	node = source;
+      }
+    }
+  }
+}
+
+bool HistoryWalk::failed() const {
+  return readFailed;
+}
+
+const HistoryWalk::Stats& HistoryWalk::getStats() const {
+  return stats;
+}
@@ -0,0 +1,510 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <thread>
+#include <unordered_set>
+
+#include "CommitContents.h"
+#include "ContentHash.h"
+#include "FileSystemInterface.h"
+#include "IntegrityCheck.h"
+#include "ParallelRunner.h"
+
+using namespace std;
+
+static const unsigned int REPORT_INTERVAL_MS = 100;
+
+static bool byCommitNumber(const string& first, const string& second) {
+  return atoi(first.c_str()) < atoi(second.c_str());
+}
+
+IntegrityCheck::IntegrityCheck(const Tree& tree,
+			       const string& commitDirectory,
+			       const string& objectDirectory,
+			       const ChangedPathFilters& filters) :
+  tree(tree), commitDirectory(commitDirectory),
+  objectDirectory(objectDirectory), filters(filters) {
+  stats = Stats();
+}
+
+void IntegrityCheck::addProblem(const string& problem) {
+  lock_guard<mutex> lock(problemsMutex);
+  problems.push_back(problem);
+}
+
+void IntegrityCheck::runStep(const string& name, size_t numItems,
+			     const ProgressReporter& report,
+			     const function<void(size_t)>& work) {
+  Progress progress;
+  progress.step = name;
+  progress.done = 0;
+  progress.total = numItems;
+  atomic<size_t> done(0);
+
+  // Reported from a thread of its own, so there's news however long any one
+  // item takes
+  mutex reportMutex;
+  condition_variable stepFinished;
+  bool finished = false;
+  thread reporter([&]() {
+      unique_lock<mutex> lock(reportMutex);
+      while (!stepFinished.wait_for(
+		 lock, chrono::milliseconds(REPORT_INTERVAL_MS),
+		 [&finished]() { return finished; })) {
+	progress.done = done;
+	report(progress, false);
+      }
+    });
+
+  ParallelRunner::forEach(numItems, [&](size_t i) {
+      work(i);
+      ++done;
+    });
+
+  {
+    lock_guard<mutex> lock(reportMutex);
+    finished = true;
+  }
+  stepFinished.notify_one();
+  reporter.join();
+
+  progress.done = done;
+  report(progress, true);
+}
+
+void IntegrityCheck::checkCommit(Commit& commit) {
+  const string prefix = "commit " + commit.hash + ": ";
+  if (!commit.info.read(CommitInfo::getFileName(commitDirectory,
+						commit.hash))) {
+    addProblem(prefix + "its info is missing or unreadable");
+    return;
+  }
+  commit.readable = true;
+  const CommitInfo& info = commit.info;
+
+  if (info.hash != commit.hash) {
+    addProblem(prefix + "its info names it " + info.hash);
+  }
+
+  const int parentNode = tree.findNearestCommit(tree.getParent(commit.node));
+  const string parent = parentNode == Tree::NO_NODE ? "ROOT" :
+    to_string(tree.getCommit(parentNode));
+  if (info.parent != parent) {
+    addProblem(prefix + "its info gives its parent as " + info.parent +
+	       ", but the commit tree has " + parent);
+  }
+
+  const int mergeParentNode = tree.getMergeParent(commit.node);
+  const string mergeParent = mergeParentNode == Tree::NO_NODE ? "" :
+    to_string(tree.getCommit(tree.findNearestCommit(mergeParentNode)));
+  if (info.mergeParent != mergeParent) {
+    addProblem(prefix + "its info gives its merge parent as \"" +
+	       info.mergeParent + "\", but the commit tree has \"" +
+	       mergeParent + "\"");
+  }
+
+  if (info.branch != tree.getBranch(commit.node)) {
+    addProblem(prefix + "its info puts it on branch " + info.branch +
+	       ", but the commit tree has " + tree.getBranch(commit.node));
+  }
+}
+
+void IntegrityCheck::checkChildren() {
+  for (const Commit& commit : commits) {
+    if (!commit.readable) {
+      continue;
+    }
+    const string prefix = "commit " + commit.hash + ": ";
+
+    for (const string& child : commit.info.children) {
+      unordered_map<string, size_t>::const_iterator it =
+	commitsByHash.find(child);
+      if (it == commitsByHash.end()) {
+	// Not in any branch's history, but it has to be in the tree still
+	// (gc takes it off the list when it removes it)
+	const int node = tree.findCommit(child);
+	const int parentNode = node == Tree::NO_NODE ? Tree::NO_NODE :
+	  tree.findNearestCommit(tree.getParent(node));
+	const int mergeParentNode = node == Tree::NO_NODE ? Tree::NO_NODE :
+	  tree.findNearestCommit(tree.getMergeParent(node));
+	if (node == Tree::NO_NODE ||
+	    ((parentNode == Tree::NO_NODE ||
+	      to_string(tree.getCommit(parentNode)) != commit.hash) &&
+	     (mergeParentNode == Tree::NO_NODE ||
+	      to_string(tree.getCommit(mergeParentNode)) != commit.hash))) {
+	  addProblem(prefix + "it lists " + child +
+		     " as a child, which the commit tree doesn't have");
+	}
+	continue;
+      }
+
+      const Commit& childCommit = commits[it->second];
+      if (childCommit.readable && childCommit.info.parent != commit.hash &&
+	  childCommit.info.mergeParent != commit.hash) {
+	addProblem(prefix + "it lists " + child + " as a child, which " +
+		   "doesn't have it as a parent");
+      }
+    }
+
+    const string parents[] = { commit.info.parent, commit.info.mergeParent };
+    for (const string& parent : parents) {
+      unordered_map<string, size_t>::const_iterator it =
+	commitsByHash.find(parent);
+      if (it == commitsByHash.end() || !commits[it->second].readable) {
+	continue;
+      }
+      const vector<string>& children = commits[it->second].info.children;
+      if (find(children.begin(), children.end(), commit.hash) ==
+	  children.end()) {
+	addProblem("commit " + parent + ": it doesn't list its child " +
+		   commit.hash);
+      }
+    }
+  }
+}
+
+void IntegrityCheck::checkDirectories(const ProgressReporter& report) {
+  vector<const Commit *> roots;
+  for (const Commit& commit : commits) {
+    if (commit.readable && !commit.info.manifest.empty()) {
+      roots.push_back(&commit);
+    }
+  }
+
+  // Commits share most of their directories with their parents', so each
+  // one is only checked by whichever thread gets to it first
+  mutex checkedMutex;
+  unordered_set<string> checked;
+  atomic<size_t> directoriesChecked(0);
+  runStep("manifest directories", roots.size(), report, [&](size_t i) {
+      Manifest manifest(objectDirectory);
+      vector<string> toCheck(1, roots[i]->info.manifest);
+      while (!toCheck.empty()) {
+	const string hash = toCheck.back();
+	toCheck.pop_back();
+	{
+	  lock_guard<mutex> lock(checkedMutex);
+	  if (!checked.insert(hash).second) {
+	    continue;
+	  }
+	}
+
+	string problem;
+	if (!manifest.checkDirectory(hash, toCheck, problem)) {
+	  addProblem("manifest directory " + hash + " (of commit " +
+		     roots[i]->hash + "): it " + problem);
+	}
+	++directoriesChecked;
+      }
+    });
+  stats.directoriesChecked = directoriesChecked;
+}
+
+void IntegrityCheck::checkChanges(const Commit& commit) {
+  if (!commit.readable || commit.info.manifest.empty()) {
+    return;
+  }
+  const string prefix = "commit " + commit.hash + ": ";
+  const CommitInfo& info = commit.info;
+  const string& root = info.manifest;
+  Manifest manifest(objectDirectory);
+
+  unordered_set<string> changedFiles;
+  const vector<string> * writtenLists[] = {
+    &info.addedFiles, &info.modifiedFiles
+  };
+  for (const vector<string> * files : writtenLists) {
+    for (const string& path : *files) {
+      changedFiles.insert(path);
+      Manifest::Entry entry;
+      if (!manifest.findFile(root, path, entry)) {
+	addProblem(prefix + "its manifest doesn't have " + path +
+		   ", which it changed");
+      } else if (entry.commit != commit.hash) {
+	addProblem(prefix + "its manifest has " + path + " as changed in " +
+		   entry.commit + " instead");
+      }
+    }
+  }
+  for (const string& path : info.removedFiles) {
+    changedFiles.insert(path);
+    Manifest::Entry entry;
+    if (manifest.findFile(root, path, entry)) {
+      addProblem(prefix + "its manifest still has " + path +
+		 ", which it removed");
+    }
+  }
+
+  // Everything else has to be as its parent had it
+  string parentRoot;
+  if (commit.parent != NO_PARENT) {
+    const Commit& parent = commits[commit.parent];
+    if (!parent.readable || parent.info.manifest.empty()) {
+      return;
+    }
+    parentRoot = parent.info.manifest;
+  }
+  vector<Manifest::Change> changes;
+  if (!manifest.compare(parentRoot, root, changes)) {
+    addProblem(prefix + "its manifest can't be compared with its parent's");
+  }
+  for (const Manifest::Change& change : changes) {
+    if (changedFiles.count(change.path) == 0) {
+      addProblem(prefix + "its manifest changes " + change.path +
+		 ", which it doesn't say it changed");
+    }
+  }
+
+  const int commitNumber = atoi(commit.hash.c_str());
+  for (const string& path : changedFiles) {
+    if (filters.query(commitNumber, path) ==
+	ChangedPathFilters::NOT_CHANGED) {
+      addProblem(prefix + "its changed path filter doesn't have " + path);
+    }
+  }
+}
+
+string IntegrityCheck::findPreviousVersion(const Commit& commit,
+					   const string& path,
+					   const Manifest& manifest) const {
+  if (commit.parent == NO_PARENT) {
+    return "";
+  }
+
+  const Commit& parent = commits[commit.parent];
+  if (parent.readable && !parent.info.manifest.empty()) {
+    Manifest::Entry entry;
+    return manifest.findFile(parent.info.manifest, path, entry) ?
+      entry.commit : "";
+  }
+
+  // Made before there were manifests, so back along the first parents to the
+  // last commit that did something to the file
+  for (int node = parent.node; node != Tree::NO_NODE;
+       node = tree.findNearestCommit(tree.getParent(node))) {
+    unordered_map<string, size_t>::const_iterator it =
+      commitsByHash.find(to_string(tree.getCommit(node)));
+    if (it == commitsByHash.end() || !commits[it->second].readable) {
+      return "";
+    }
+
+    const CommitInfo& info = commits[it->second].info;
+    if (find(info.addedFiles.begin(), info.addedFiles.end(), path) !=
+	info.addedFiles.end() ||
+	find(info.modifiedFiles.begin(), info.modifiedFiles.end(), path) !=
+	info.modifiedFiles.end()) {
+      return info.hash;
+    }
+    if (find(info.removedFiles.begin(), info.removedFiles.end(), path) !=
+	info.removedFiles.end()) {
+      return "";
+    }
+  }
+  return "";
+}
+
+void IntegrityCheck::checkVersions(const string& path,
+				   const vector<Version>& versions) {
+  Manifest manifest(objectDirectory);
+  // Each version's lines and hash, by the commit that wrote it. Versions come
+  // in the order they were made, so the one a version was changed from has
+  // always been rebuilt already.
+  unordered_map<string, vector<Line> > contents;
+  unordered_map<string, string> hashes;
+  unordered_map<string, string> changedFrom;
+  size_t versionsChecked = 0;
+
+  for (const Version& version : versions) {
+    const Commit& commit = commits[commitsByHash.at(version.commit)];
+    const string prefix = "commit " + commit.hash + ": ";
+    vector<Line> lines;
+
+    if (version.added) {
+      CommitContents::FileVersion fileVersion;
+      fileVersion.addedIn = version.commit;
+      if (!CommitContents::readVersion(commitDirectory, path, fileVersion, 0,
+				       lines)) {
+	addProblem(prefix + "the version of " + path +
+		   " it added can't be read");
+	continue;
+      }
+    } else {
+      const string older = findPreviousVersion(commit, path, manifest);
+      if (older.empty()) {
+	addProblem(prefix + "it changes " + path +
+		   ", which its parent doesn't have");
+	continue;
+      }
+      // Otherwise what's wrong with the older version has been reported
+      unordered_map<string, vector<Line> >::const_iterator it =
+	contents.find(older);
+      if (it == contents.end()) {
+	continue;
+      }
+
+      lines = it->second;
+      if (!CommitContents::applyDiff(commitDirectory, path, version.commit,
+				     lines)) {
+	addProblem(prefix + "its diff of " + path + " can't be applied");
+	continue;
+      }
+      changedFrom[version.commit] = older;
+    }
+    ++versionsChecked;
+
+    const string hash = ContentHash::ofLines(lines);
+    Manifest::Entry entry;
+    if (!commit.info.manifest.empty() &&
+	manifest.findFile(commit.info.manifest, path, entry) &&
+	entry.hash != hash) {
+      // The versions built from this one would all be reported too
+      addProblem(prefix + "its version of " + path +
+		 " doesn't match the hash its manifest gives");
+      continue;
+    }
+
+    vector<Line> fullCopy;
+    if (CommitContents::readFullCopy(commitDirectory, path, version.commit,
+				     fullCopy) &&
+	ContentHash::ofLines(fullCopy) != hash) {
+      addProblem(prefix + "its full copy of " + path +
+		 " doesn't match its version");
+    }
+
+    hashes[version.commit] = hash;
+    contents[version.commit].swap(lines);
+  }
+
+  // A note is checked by taking the newer version back, which normally is
+  // the one that was changed from this version
+  for (const Version& version : versions) {
+    ifstream input(CommitContents::getNewerVersionFileName(
+	commitDirectory, path, version.commit));
+    string newer;
+    if (!(input >> newer) || hashes.count(version.commit) == 0) {
+      continue;
+    }
+    const string prefix = "commit " + version.commit + ": ";
+
+    vector<Line> lines;
+    unordered_map<string, string>::const_iterator it = changedFrom.find(newer);
+    if (it != changedFrom.end() && it->second == version.commit) {
+      lines = contents[newer];
+      if (!CommitContents::unapplyDiff(commitDirectory, path, newer, lines)) {
+	addProblem(prefix + "its version of " + path + " can't be got back " +
+		   "from " + newer + "'s");
+	continue;
+      }
+    } else if (!CommitContents::readFromNewer(commitDirectory, path,
+					      version.commit, lines)) {
+      addProblem(prefix + "its version of " + path + " can't be got back " +
+		 "from the newer ones it's stored against");
+      continue;
+    }
+
+    if (ContentHash::ofLines(lines) != hashes[version.commit]) {
+      addProblem(prefix + "taking " + path + " back from " + newer +
+		 " doesn't give its version");
+    }
+  }
+
+  lock_guard<mutex> lock(problemsMutex);
+  stats.versionsChecked += versionsChecked;
+}
+
+void IntegrityCheck::countUnreachableCommits() {
+  vector<string> names;
+  FileSystemInterface::listDirectory(commitDirectory, names);
+  for (const string& name : names) {
+    if (!name.empty() &&
+	name.find_first_not_of("0123456789") == string::npos &&
+	commitsByHash.count(name) == 0) {
+      ++stats.unreachableCommits;
+    }
+  }
+}
+
+void IntegrityCheck::run(const ProgressReporter& report) {
+  typedef chrono::steady_clock Clock;
+  const Clock::time_point start = Clock::now();
+  stats = Stats();
+  problems.clear();
+  commits.clear();
+  commitsByHash.clear();
+
+  const vector<bool> reachable = tree.findReachable(vector<int>());
+  for (size_t node = 0; node < reachable.size(); ++node) {
+    if (reachable[node] && !tree.isBranchNode(node)) {
+      Commit commit;
+      commit.node = node;
+      commit.hash = to_string(tree.getCommit(node));
+      commit.readable = false;
+      commit.parent = NO_PARENT;
+      commitsByHash[commit.hash] = commits.size();
+      commits.push_back(commit);
+    }
+  }
+
+  // Commits are checked against their parents as the commit tree has them,
+  // so an info file giving the wrong one is only reported once
+  for (Commit& commit : commits) {
+    const int parentNode =
+      tree.findNearestCommit(tree.getParent(commit.node));
+    commit.parent = parentNode == Tree::NO_NODE ? NO_PARENT :
+      commitsByHash.at(to_string(tree.getCommit(parentNode)));
+  }
+
+  runStep("commits", commits.size(), report, [this](size_t i) {
+      checkCommit(commits[i]);
+    });
+  stats.commitsChecked = commits.size();
+  checkChildren();
+  countUnreachableCommits();
+
+  checkDirectories(report);
+  runStep("manifests", commits.size(), report, [this](size_t i) {
+      checkChanges(commits[i]);
+    });
+
+  // Every version each file has been through, oldest first
+  map<string, vector<Version> > versionsByPath;
+  for (const Commit& commit : commits) {
+    if (!commit.readable) {
+      continue;
+    }
+    for (const string& path : commit.info.addedFiles) {
+      Version version = { commit.hash, true };
+      versionsByPath[path].push_back(version);
+    }
+    for (const string& path : commit.info.modifiedFiles) {
+      Version version = { commit.hash, false };
+      versionsByPath[path].push_back(version);
+    }
+  }
+  vector<pair<const string *, vector<Version> *> > paths;
+  for (auto& path : versionsByPath) {
+    sort(path.second.begin(), path.second.end(),
+	 [](const Version& first, const Version& second) {
+	   return byCommitNumber(first.commit, second.commit);
+	 });
+    paths.push_back(make_pair(&path.first, &path.second));
+  }
+  runStep("file versions", paths.size(), report, [&](size_t i) {
+      checkVersions(*paths[i].first, *paths[i].second);
+    });
+
+  sort(problems.begin(), problems.end());
+  stats.totalMs = chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+const vector<string>& IntegrityCheck::getProblems() const {
+  return problems;
+}
+
+const IntegrityCheck::Stats& IntegrityCheck::getStats() const {
+  return stats;
+}
@@ -1,4 +1,8 @@
+#include <cstdlib>
 #include <iostream>
+#include <sstream>
+
+#include <unistd.h>
 
 #include "FileSystemInterface.h"
 #include "Interpretor.h"
@@ -8,8 +12,9 @@ using namespace std;
 // TODO:
 // Up and down arrows to cycle through commands
 
-Interpretor::Interpretor(OperationAccumulator& accumulator) :
-  accumulator(accumulator) {
+Interpretor::Interpretor(OperationAccumulator& accumulator,
+			 OutputFormat format, bool batch) :
+  accumulator(accumulator), format(format), failed(false), inBatch(batch) {
   errorMessages[NOT_ENOUGH_ARGS] = "Not enough arguments! Please try again.";
   errorMessages[TOO_MANY_ARGS] = "Too many arguments! Please try again.";
   errorMessages[FILE_NOT_FOUND] = "Specified file not found!";
@@ -23,22 +28,112 @@ Interpretor::Interpretor(OperationAccumulator& accumulator) :
     "Please provide a valid commit message.";
   errorMessages[NOTHING_TO_COMMIT] = "No changes staged for commit!";
   errorMessages[UNRECOGNIZED_OPTION] = "Unrecognized option! Please try again.";
+  errorMessages[UNRESOLVED_CONFLICTS] =
+    "Please resolve all merge conflicts before committing!";
 }
 
+// How many commits log shows at a time when someone is there to read them
+static const size_t LOG_PAGE_SIZE = 10;
+
 static bool reachedTerminatingCommand(const string& command) {
   return command == "q" || command == "quit";
 }
 
+static void appendJsonString(string& json, const string& value) {
+  static const char HEX_DIGITS[] = "0123456789abcdef";
+  json += '"';
+  for (const char c : value) {
+    switch (c) {
+    case '"':
+      json += "\\\"";
+      break;
+    case '\\':
+      json += "\\\\";
+      break;
+    case '\n':
+      json += "\\n";
+      break;
+    case '\r':
+      json += "\\r";
+      break;
+    case '\t':
+      json += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+	json += "\\u00";
+	json += HEX_DIGITS[c >> 4];
+	json += HEX_DIGITS[c & 0xf];
+      } else {
+	json += c;
+      }
+    }
+  }
+  json += '"';
+}
+
+ostream& Interpretor::failure() const {
+  failed = true;
+  return cout;
+}
+
+bool Interpretor::record(const string& command,
+			 const function<void()>& operation) const {
+  failed = false;
+  accumulator.takeFailure();
+  if (format == TEXT) {
+    operation();
+    return !accumulator.takeFailure() && !failed;
+  }
+
+  ostringstream output;
+  streambuf * const terminal = cout.rdbuf(output.rdbuf());
+  operation();
+  cout.rdbuf(terminal);
+  const bool succeeded = !accumulator.takeFailure() && !failed;
+
+  // Loading and saving only get a record when they have something to say
+  const string text = output.str();
+  if (command.empty() && text.empty()) {
+    return succeeded;
+  }
+
+  // {"command": ..., "ok": ..., "branch": ..., "output": [<lines>]}
+  string json = "{\"command\":";
+  if (command.empty()) {
+    json += "null";
+  } else {
+    appendJsonString(json, command);
+  }
+  json += succeeded ? ",\"ok\":true" : ",\"ok\":false";
+  if (accumulator.isInitialized()) {
+    json += ",\"branch\":";
+    appendJsonString(json, accumulator.getCurBranchName());
+  }
+  json += ",\"output\":[";
+  istringstream lines(text);
+  string line;
+  for (bool first = true; getline(lines, line); first = false) {
+    if (!first) {
+      json += ',';
+    }
+    appendJsonString(json, line);
+  }
+  json += "]}";
+  cout << json << endl;
+  return succeeded;
+}
+
 bool Interpretor::parseOneArgument(istringstream& input, string& arg) const {
   if (!(input >> arg)) {
-    cout << errorMessages.at(NOT_ENOUGH_ARGS) << endl;
+    failure() << errorMessages.at(NOT_ENOUGH_ARGS) << endl;
     return false;
   }
 
   string extraArg;
 
   if (input >> extraArg) {
-    cout << errorMessages.at(TOO_MANY_ARGS) << endl;
+    failure() << errorMessages.at(TOO_MANY_ARGS) << endl;
     return false;
   }
 
@@ -60,14 +155,14 @@ void Interpretor::parseAdd(istringstream& input) const {
       cout << "File " << fileArg << " was already tracked." << endl;
     }
   } else {
-    cout << errorMessages.at(FILE_NOT_FOUND) << endl;
+    failure() << errorMessages.at(FILE_NOT_FOUND) << endl;
   }
 }
 
 bool Interpretor::parseWithOrWithoutFlag(
     istringstream& input, const string& targetFlag, string& nextToken, bool& flag) const {
   if (!(input >> nextToken)) {
-    cout << errorMessages.at(NOT_ENOUGH_ARGS) << endl;
+    failure() << errorMessages.at(NOT_ENOUGH_ARGS) << endl;
     return false;
   }
 
@@ -76,13 +171,13 @@ bool Interpretor::parseWithOrWithoutFlag(
   if (nextToken == targetFlag) {
     flag = true;
     if (!(input >> nextToken)) {
-      cout << errorMessages.at(NOT_ENOUGH_ARGS) << endl;
+      failure() << errorMessages.at(NOT_ENOUGH_ARGS) << endl;
       return false;
     }
   }
 
   if (nextToken.at(0) == '-') {
-    cout << errorMessages.at(UNRECOGNIZED_OPTION) << endl;
+    failure() << errorMessages.at(UNRECOGNIZED_OPTION) << endl;
     return false;
   }
 
@@ -99,7 +194,7 @@ void Interpretor::parseCommit(string command, istringstream& input) const {
   
   // ensure that the following tokens are a part of the commit message
   if (nextToken.at(0) != '"') {
-    cout << errorMessages.at(INVALID_COMMIT_MESSAGE) << endl;
+    failure() << errorMessages.at(INVALID_COMMIT_MESSAGE) << endl;
     return;
   }
 
@@ -111,35 +206,40 @@ void Interpretor::parseCommit(string command, istringstream& input) const {
   
   if (once) {
     if (nextToken.at(nextToken.length() - 1) != '"') {
-      cout << errorMessages.at(INVALID_COMMIT_MESSAGE) << endl;
+      failure() << errorMessages.at(INVALID_COMMIT_MESSAGE) << endl;
       return;
     }
   } else {
     if (nextToken.length() == 1) {
-      cout << errorMessages.at(INVALID_COMMIT_MESSAGE) << endl;
+      failure() << errorMessages.at(INVALID_COMMIT_MESSAGE) << endl;
       return;
     }
 
     if (nextToken.at(nextToken.length() - 1) != '"') {
-      cout << errorMessages.at(INVALID_COMMIT_MESSAGE) << endl;
+      failure() << errorMessages.at(INVALID_COMMIT_MESSAGE) << endl;
       return;
     }
   }
 
+  if (accumulator.hasUnresolvedConflicts()) {
+    failure() << errorMessages.at(UNRESOLVED_CONFLICTS) << endl;
+    return;
+  }
+
   // Now we know we have a valid commit message, we just need to parse it
   command = command.substr(command.find("\"") + 1);
   command = command.substr(0, command.find("\""));
 
   bool changesToCommit = accumulator.commit(command, addFlag);
   if (!changesToCommit) {
-    cout << errorMessages.at(NOTHING_TO_COMMIT) << endl;
+    failure() << errorMessages.at(NOTHING_TO_COMMIT) << endl;
   }
 }
 
 void Interpretor::parseStatus(istringstream& input) const {
   string nextToken;
   if (input >> nextToken) {
-    cout << errorMessages.at(TOO_MANY_ARGS) << endl;
+    failure() << errorMessages.at(TOO_MANY_ARGS) << endl;
   }
 
   accumulator.getStatus();
@@ -157,6 +257,297 @@ void Interpretor::parseCheckout(istringstream& input) const {
   }
 }
 
+void Interpretor::parseWatch(istringstream& input) const {
+  string option;
+  if (!parseOneArgument(input, option)) {
+    return;
+  }
+
+  if (option == "on") {
+    if (accumulator.startWatching()) {
+      cout << "Watching tracked files for changes." << endl;
+    } else {
+      failure() << "Could not start watching for changes!" << endl;
+    }
+  } else if (option == "off") {
+    accumulator.stopWatching();
+    cout << "No longer watching for changes." << endl;
+  } else {
+    failure() << errorMessages.at(UNRECOGNIZED_OPTION) << endl;
+  }
+}
+
+void Interpretor::parseStats(istringstream& input) const {
+  string nextToken;
+  if (input >> nextToken) {
+    failure() << errorMessages.at(TOO_MANY_ARGS) << endl;
+    return;
+  }
+
+  accumulator.printStats();
+}
+
+void Interpretor::parseMerge(istringstream& input) const {
+  string branchName;
+  if (!parseOneArgument(input, branchName)) {
+    return;
+  }
+
+  accumulator.merge(branchName);
+}
+
+void Interpretor::parseConflicts(istringstream& input) const {
+  string nextToken;
+  if (input >> nextToken) {
+    failure() << errorMessages.at(TOO_MANY_ARGS) << endl;
+    return;
+  }
+
+  accumulator.listConflicts();
+}
+
+void Interpretor::parseResolve(istringstream& input) const {
+  string fileName;
+  string extraArg;
+  input >> fileName;
+  if (input >> extraArg) {
+    failure() << errorMessages.at(TOO_MANY_ARGS) << endl;
+    return;
+  }
+
+  accumulator.resolve(fileName);
+}
+
+void Interpretor::parseDiff(istringstream& input) const {
+  string first, second;
+  if (!(input >> first)) {
+    accumulator.printDiff();
+    return;
+  }
+
+  if (!(input >> second)) {
+    failure() << errorMessages.at(NOT_ENOUGH_ARGS) << endl;
+    return;
+  }
+
+  string extraArg;
+  if (input >> extraArg) {
+    failure() << errorMessages.at(TOO_MANY_ARGS) << endl;
+    return;
+  }
+
+  accumulator.printDiff(first, second);
+}
+
+void Interpretor::parseLog(istringstream& input) const {
+  size_t maxCommits = 0;
+  string path, nextToken;
+  bool haveToken = static_cast<bool>(input >> nextToken);
+  if (haveToken && nextToken == "-n") {
+    string count;
+    if (!(input >> count)) {
+      failure() << errorMessages.at(NOT_ENOUGH_ARGS) << endl;
+      return;
+    }
+
+    char * end;
+    const long value = strtol(count.c_str(), &end, 10);
+    if (*end != '\0' || value <= 0) {
+      failure() << "Please give a positive number of commits to show." << endl;
+      return;
+    }
+    maxCommits = value;
+    haveToken = static_cast<bool>(input >> nextToken);
+  }
+
+  if (haveToken) {
+    if (nextToken[0] == '-') {
+      failure() << errorMessages.at(UNRECOGNIZED_OPTION) << endl;
+      return;
+    }
+    path = nextToken;
+    while (path.size() > 1 && path[path.size() - 1] == '/') {
+      path.erase(path.size() - 1);
+    }
+
+    string extraArg;
+    if (input >> extraArg) {
+      failure() << errorMessages.at(TOO_MANY_ARGS) << endl;
+      return;
+    }
+  }
+
+  // Only stop between pages when both the commands and the output are on a
+  // terminal, and the output is for reading; anything else (including a
+  // batch, whose next command would be taken for the answer) gets the whole
+  // log in one go
+  const bool interactive = format == TEXT && !inBatch &&
+    isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+  accumulator.printLog(maxCommits, path, interactive ? LOG_PAGE_SIZE : 0,
+		       []() {
+			 cout << "-- more (Enter to continue, q to stop) --" <<
+			   flush;
+			 string answer;
+			 return getline(cin, answer) && answer != "q";
+		       });
+}
+
+void Interpretor::parseBlame(istringstream& input) const {
+  string fileName;
+  if (!parseOneArgument(input, fileName)) {
+    return;
+  }
+
+  accumulator.blame(fileName);
+}
+
+void Interpretor::parseUndo(istringstream& input) const {
+  string fileName;
+  if (!parseOneArgument(input, fileName)) {
+    return;
+  }
+
+  // A file that really is named ALL can be given as ./ALL
+  if (fileName == "ALL") {
+    fileName = "";
+  } else if (fileName.compare(0, 2, "./") == 0) {
+    fileName = fileName.substr(2);
+  }
+
+  accumulator.undo(fileName);
+}
+
+void Interpretor::parseReset(istringstream& input) const {
+  string nextToken;
+  if (!(input >> nextToken)) {
+    failure() << errorMessages.at(NOT_ENOUGH_ARGS) << endl;
+    return;
+  }
+
+  bool hard = false;
+  if (nextToken == "-s" || nextToken == "-h") {
+    hard = nextToken == "-h";
+    if (!(input >> nextToken)) {
+      failure() << errorMessages.at(NOT_ENOUGH_ARGS) << endl;
+      return;
+    }
+  }
+  if (nextToken.at(0) == '-') {
+    failure() << errorMessages.at(UNRECOGNIZED_OPTION) << endl;
+    return;
+  }
+
+  string extraArg;
+  if (input >> extraArg) {
+    failure() << errorMessages.at(TOO_MANY_ARGS) << endl;
+    return;
+  }
+
+  accumulator.reset(nextToken, hard);
+}
+
+void Interpretor::parseGc(istringstream& input) const {
+  unsigned int budgetMs = 0;
+  string budget;
+  if (input >> budget) {
+    char * end;
+    const long value = strtol(budget.c_str(), &end, 10);
+    if (*end != '\0' || value <= 0) {
+      failure() << "Please give a positive number of milliseconds to spend." <<
+	endl;
+      return;
+    }
+    budgetMs = value;
+
+    string extraArg;
+    if (input >> extraArg) {
+      failure() << errorMessages.at(TOO_MANY_ARGS) << endl;
+      return;
+    }
+  }
+
+  accumulator.collectGarbage(budgetMs);
+}
+
+void Interpretor::parseFsck(istringstream& input) const {
+  string nextToken;
+  if (input >> nextToken) {
+    failure() << errorMessages.at(TOO_MANY_ARGS) << endl;
+    return;
+  }
+
+  accumulator.checkIntegrity(format == TEXT && !inBatch);
+}
+
+void Interpretor::parseConfig(istringstream& input) const {
+  string name, value;
+  if (!(input >> name)) {
+    accumulator.printSetting("");
+    return;
+  }
+
+  if (!(input >> value)) {
+    accumulator.printSetting(name);
+    return;
+  }
+
+  string extraArg;
+  if (input >> extraArg) {
+    failure() << errorMessages.at(TOO_MANY_ARGS) << endl;
+    return;
+  }
+
+  accumulator.changeSetting(name, value);
+}
+
+// Queries about the history, for checking on the internals
+void Interpretor::parseDebug(istringstream& input) const {
+  string query, first, second;
+  if (input >> query && query == "path-filters") {
+    string extraArg;
+    if (input >> extraArg) {
+      failure() << errorMessages.at(TOO_MANY_ARGS) << endl;
+      return;
+    }
+    accumulator.printPathFilters();
+    return;
+  }
+
+  if (!(input >> first)) {
+    failure() << errorMessages.at(NOT_ENOUGH_ARGS) << endl;
+    return;
+  }
+
+  if (query == "manifest") {
+    string extraArg;
+    if (input >> extraArg) {
+      failure() << errorMessages.at(TOO_MANY_ARGS) << endl;
+      return;
+    }
+    accumulator.printManifest(first);
+    return;
+  }
+
+  if (!(input >> second)) {
+    failure() << errorMessages.at(NOT_ENOUGH_ARGS) << endl;
+    return;
+  }
+
+  string extraArg;
+  if (input >> extraArg) {
+    failure() << errorMessages.at(TOO_MANY_ARGS) << endl;
+    return;
+  }
+
+  if (query == "merge-base") {
+    accumulator.printMergeBase(first, second);
+  } else if (query == "is-ancestor") {
+    accumulator.printIsAncestor(first, second);
+  } else {
+    failure() << errorMessages.at(UNRECOGNIZED_OPTION) << endl;
+  }
+}
+
 void Interpretor::parseCommand(const string& command) const {
   istringstream input(command);
   string firstToken = "";
@@ -164,8 +555,8 @@ void Interpretor::parseCommand(const string& command) const {
   input >> firstToken;
 
   if (firstToken != "") {
-    if (firstToken == "init") {
-      cout << errorMessages.at(PROJECT_ALREADY_INITIALIZED) << endl;
+    if (firstToken == "init" || firstToken == "clone") {
+      failure() << errorMessages.at(PROJECT_ALREADY_INITIALIZED) << endl;
     } else if (firstToken == "add") {
       parseAdd(input);
     } else if (firstToken == "commit") {
@@ -174,8 +565,36 @@ void Interpretor::parseCommand(const string& command) const {
       parseStatus(input);
     } else if (firstToken == "checkout") {
       parseCheckout(input);
+    } else if (firstToken == "watch") {
+      parseWatch(input);
+    } else if (firstToken == "stats") {
+      parseStats(input);
+    } else if (firstToken == "merge") {
+      parseMerge(input);
+    } else if (firstToken == "conflicts") {
+      parseConflicts(input);
+    } else if (firstToken == "resolve") {
+      parseResolve(input);
+    } else if (firstToken == "debug") {
+      parseDebug(input);
+    } else if (firstToken == "diff") {
+      parseDiff(input);
+    } else if (firstToken == "log") {
+      parseLog(input);
+    } else if (firstToken == "config") {
+      parseConfig(input);
+    } else if (firstToken == "blame") {
+      parseBlame(input);
+    } else if (firstToken == "undo") {
+      parseUndo(input);
+    } else if (firstToken == "reset") {
+      parseReset(input);
+    } else if (firstToken == "gc") {
+      parseGc(input);
+    } else if (firstToken == "fsck") {
+      parseFsck(input);
     } else {
-      cout << errorMessages.at(UNRECOGNIZED_COMMAND) << endl;
+      failure() << errorMessages.at(UNRECOGNIZED_COMMAND) << endl;
     }
   }
 }
@@ -192,6 +611,16 @@ bool Interpretor::parseInit(istringstream& input) const {
   return true;
 }
 
+bool Interpretor::parseClone(istringstream& input) const {
+  string sourcePath;
+
+  if (!parseOneArgument(input, sourcePath)) {
+    return false;
+  }
+
+  return accumulator.cloneProject(sourcePath);
+}
+
 static bool isValidOperation(const string& command) {
   if (command == "init") {
     return true;
@@ -213,18 +642,65 @@ bool Interpretor::parseFirstCommand(const string& command) const {
   string firstToken;
   input >> firstToken;
     
+  if (firstToken == "clone") {
+    return parseClone(input);
+  }
+
   if (firstToken != "init") {
     if (!isValidOperation(firstToken)) {
-      cout << errorMessages.at(UNRECOGNIZED_COMMAND) << endl;
+      failure() << errorMessages.at(UNRECOGNIZED_COMMAND) << endl;
       return false;
     }
-    cout << errorMessages.at(PROJECT_UNINITIALIZED) << endl;
+    failure() << errorMessages.at(PROJECT_UNINITIALIZED) << endl;
     return false;
   }
 
   return parseInit(input);
 }
 
+bool Interpretor::load() const {
+  return record("", [this]() { accumulator.initialize(); });
+}
+
+bool Interpretor::save() const {
+  return record("", [this]() { accumulator.saveState(); });
+}
+
+bool Interpretor::execute(const string& command) const {
+  return record(command, [this, &command]() {
+      if (accumulator.isInitialized()) {
+	parseCommand(command);
+      } else if (!parseFirstCommand(command)) {
+	failed = true;
+      }
+    });
+}
+
+bool Interpretor::readCommand(istream& commands, string& command) {
+  while (getline(commands, command) && !reachedTerminatingCommand(command)) {
+    // Blank lines and comments, so batch files can be laid out
+    const size_t start = command.find_first_not_of(" \t");
+    if (start != string::npos && command[start] != '#') {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Interpretor::executeBatch(istream& commands) const {
+  const bool wasInBatch = inBatch;
+  inBatch = true;
+  bool succeeded = true;
+  string command;
+  while (readCommand(commands, command)) {
+    if (!execute(command)) {
+      succeeded = false;
+    }
+  }
+  inBatch = wasInBatch;
+  return succeeded;
+}
+
 void Interpretor::interpret() const {
   string command;
 
@@ -0,0 +1,396 @@
+#include <fstream>
+
+#include "ContentHash.h"
+#include "FileSystemInterface.h"
+#include "FileWriter.h"
+#include "Manifest.h"
+
+using namespace std;
+
+Manifest::Manifest(const string& objectDirectory) :
+  objectDirectory(objectDirectory) {}
+
+const string& Manifest::getObjectDirectory() const {
+  return objectDirectory;
+}
+
+// Each entry is a line of "d <hash> <name>" or "f <hash> <commit> <name>", in
+// name order
+static bool parseEntry(const string& line, string& name,
+		       Manifest::Entry& entry) {
+  if (line.size() < 4 || (line[0] != 'f' && line[0] != 'd') ||
+      line[1] != ' ') {
+    return false;
+  }
+
+  entry.isDirectory = line[0] == 'd';
+  size_t nameStart = line.find(' ', 2);
+  if (nameStart == string::npos) {
+    return false;
+  }
+  entry.hash = line.substr(2, nameStart - 2);
+
+  entry.commit.clear();
+  if (!entry.isDirectory) {
+    const size_t commitStart = nameStart + 1;
+    nameStart = line.find(' ', commitStart);
+    if (nameStart == string::npos) {
+      return false;
+    }
+    entry.commit = line.substr(commitStart, nameStart - commitStart);
+  }
+
+  if (entry.hash.empty() || nameStart + 1 >= line.size()) {
+    return false;
+  }
+  name = line.substr(nameStart + 1);
+  return true;
+}
+
+bool Manifest::readDirectory(const string& hash,
+			     const Directory *& directory) const {
+  static const Directory EMPTY_DIRECTORY;
+  if (hash.empty()) {
+    directory = &EMPTY_DIRECTORY;
+    return true;
+  }
+
+  unordered_map<string, Directory>::const_iterator it =
+    directories.find(hash);
+  if (it != directories.end()) {
+    directory = &it->second;
+    return true;
+  }
+
+  ifstream input(FileSystemInterface::appendPath(objectDirectory, hash));
+  if (!input) {
+    return false;
+  }
+
+  Directory entries;
+  string line;
+  while (getline(input, line)) {
+    string name;
+    Entry entry;
+    if (!parseEntry(line, name, entry)) {
+      return false;
+    }
+    entries[name] = entry;
+  }
+
+  directory = &(directories[hash] = entries);
+  return true;
+}
+
+bool Manifest::writeDirectory(const Directory& directory, string& hash) {
+  vector<string> lines;
+  for (const auto& entry : directory) {
+    if (entry.second.isDirectory) {
+      lines.push_back("d " + entry.second.hash + " " + entry.first);
+    } else {
+      lines.push_back("f " + entry.second.hash + " " + entry.second.commit +
+		      " " + entry.first);
+    }
+  }
+
+  hash = ContentHash::ofLines(lines);
+  if (directories.count(hash) != 0) {
+    return true;
+  }
+
+  // Already on disk if an earlier commit shares the directory
+  const string fileName = FileSystemInterface::appendPath(objectDirectory,
+							  hash);
+  if (!FileSystemInterface::fileExists(fileName.c_str()) &&
+      !FileWriter::replaceFile(fileName, lines)) {
+    return false;
+  }
+
+  directories[hash] = directory;
+  return true;
+}
+
+bool Manifest::updateDirectory(const string& hash, const FileEntries& files,
+			       bool isRoot, string& newHash) {
+  const Directory * existing;
+  if (!readDirectory(hash, existing)) {
+    return false;
+  }
+  Directory directory = *existing;
+
+  // Files are in path order, so everything under a subdirectory is together
+  size_t i = 0;
+  while (i < files.size()) {
+    const string& path = files[i].first;
+    const size_t slash = path.find('/');
+    if (slash == string::npos) {
+      if (files[i].second.hash.empty()) {
+	directory.erase(path);
+      } else {
+	directory[path] = files[i].second;
+      }
+      ++i;
+      continue;
+    }
+
+    const string name = path.substr(0, slash);
+    FileEntries subdirectoryFiles;
+    for (; i < files.size() &&
+	   files[i].first.compare(0, slash + 1, path, 0, slash + 1) == 0;
+	 ++i) {
+      subdirectoryFiles.push_back(make_pair(files[i].first.substr(slash + 1),
+					    files[i].second));
+    }
+
+    // A file that has become a directory is replaced outright
+    Directory::const_iterator it = directory.find(name);
+    const string subdirectoryHash =
+      it != directory.end() && it->second.isDirectory ? it->second.hash : "";
+    string newSubdirectoryHash;
+    if (!updateDirectory(subdirectoryHash, subdirectoryFiles, false,
+			 newSubdirectoryHash)) {
+      return false;
+    }
+
+    if (newSubdirectoryHash.empty()) {
+      directory.erase(name);
+    } else {
+      Entry& entry = directory[name];
+      entry.isDirectory = true;
+      entry.hash = newSubdirectoryHash;
+      entry.commit.clear();
+    }
+  }
+
+  // Directories left empty disappear, other than the root
+  if (directory.empty() && !isRoot) {
+    newHash = "";
+    return true;
+  }
+
+  return writeDirectory(directory, newHash);
+}
+
+bool Manifest::update(const string& root, const map<string, Entry>& files,
+		      string& newRoot) {
+  FileEntries fileEntries(files.begin(), files.end());
+  return updateDirectory(root, fileEntries, true, newRoot);
+}
+
+bool Manifest::findFile(const string& root, const string& path,
+			Entry& entry) const {
+  const Directory * directory;
+  if (!readDirectory(root, directory)) {
+    return false;
+  }
+
+  size_t start = 0;
+  while (true) {
+    const size_t slash = path.find('/', start);
+    Directory::const_iterator it = directory->find(
+	path.substr(start, slash == string::npos ? string::npos :
+		    slash - start));
+    if (it == directory->end() ||
+	it->second.isDirectory != (slash != string::npos)) {
+      return false;
+    }
+
+    if (slash == string::npos) {
+      entry = it->second;
+      return true;
+    }
+
+    if (!readDirectory(it->second.hash, directory)) {
+      return false;
+    }
+    start = slash + 1;
+  }
+}
+
+bool Manifest::listFiles(const string& hash, const string& prefix,
+			 ChangeType type, vector<Change>& changes) const {
+  const Directory * directory;
+  if (!readDirectory(hash, directory)) {
+    return false;
+  }
+
+  for (const auto& entry : *directory) {
+    const string path = prefix + entry.first;
+    if (entry.second.isDirectory) {
+      if (!listFiles(entry.second.hash, path + "/", type, changes)) {
+	return false;
+      }
+    } else {
+      Change change;
+      change.path = path;
+      change.type = type;
+      changes.push_back(change);
+    }
+  }
+
+  return true;
+}
+
+bool Manifest::compareDirectories(const string& first, const string& second,
+				  const string& prefix,
+				  vector<Change>& changes) const {
+  if (first == second) {
+    return true;
+  }
+
+  const Directory * firstDirectory;
+  const Directory * secondDirectory;
+  if (!readDirectory(first, firstDirectory) ||
+      !readDirectory(second, secondDirectory)) {
+    return false;
+  }
+
+  const Directory& firstEntries = *firstDirectory;
+  const Directory& secondEntries = *secondDirectory;
+  const Entry NO_ENTRY = { false, "", "" };
+
+  Directory::const_iterator firstIt = firstEntries.begin();
+  Directory::const_iterator secondIt = secondEntries.begin();
+  while (firstIt != firstEntries.end() || secondIt != secondEntries.end()) {
+    const bool inFirst = firstIt != firstEntries.end() &&
+      (secondIt == secondEntries.end() || firstIt->first <= secondIt->first);
+    const bool inSecond = secondIt != secondEntries.end() &&
+      (firstIt == firstEntries.end() || secondIt->first <= firstIt->first);
+    const string path = prefix + (inFirst ? firstIt : secondIt)->first;
+    const Entry& firstEntry = inFirst ? firstIt->second : NO_ENTRY;
+    const Entry& secondEntry = inSecond ? secondIt->second : NO_ENTRY;
+
+    if (inFirst && inSecond &&
+	firstEntry.isDirectory == secondEntry.isDirectory) {
+      if (firstEntry.isDirectory) {
+	if (!compareDirectories(firstEntry.hash, secondEntry.hash,
+				path + "/", changes)) {
+	  return false;
+	}
+      } else if (firstEntry.hash != secondEntry.hash) {
+	Change change;
+	change.path = path;
+	change.type = MODIFIED;
+	changes.push_back(change);
+      }
+    } else {
+      // Added, removed, or a file replaced by a directory or vice versa
+      if (inFirst) {
+	if (firstEntry.isDirectory) {
+	  if (!listFiles(firstEntry.hash, path + "/", REMOVED, changes)) {
+	    return false;
+	  }
+	} else {
+	  Change change;
+	  change.path = path;
+	  change.type = REMOVED;
+	  changes.push_back(change);
+	}
+      }
+      if (inSecond) {
+	if (secondEntry.isDirectory) {
+	  if (!listFiles(secondEntry.hash, path + "/", ADDED, changes)) {
+	    return false;
+	  }
+	} else {
+	  Change change;
+	  change.path = path;
+	  change.type = ADDED;
+	  changes.push_back(change);
+	}
+      }
+    }
+
+    if (inFirst) {
+      ++firstIt;
+    }
+    if (inSecond) {
+      ++secondIt;
+    }
+  }
+
+  return true;
+}
+
+bool Manifest::compare(const string& first, const string& second,
+		       vector<Change>& changes) const {
+  return compareDirectories(first, second, "", changes);
+}
+
+void Manifest::clearCache() {
+  directories.clear();
+}
+
+bool Manifest::walkDirectories(
+    const string& root, const function<bool(const string&)>& visit) const {
+  if (root.empty() || !visit(root)) {
+    return true;
+  }
+
+  // Only the subdirectories are wanted, so the files' lines are passed over
+  // rather than parsed
+  ifstream input(FileSystemInterface::appendPath(objectDirectory, root));
+  if (!input) {
+    return false;
+  }
+
+  vector<string> subdirectories;
+  string line;
+  while (getline(input, line)) {
+    if (line.compare(0, 2, "d ") != 0) {
+      continue;
+    }
+    const size_t hashEnd = line.find(' ', 2);
+    if (hashEnd == string::npos) {
+      return false;
+    }
+    subdirectories.push_back(line.substr(2, hashEnd - 2));
+  }
+
+  for (const string& subdirectory : subdirectories) {
+    if (!walkDirectories(subdirectory, visit)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Manifest::checkDirectory(const string& hash,
+			      vector<string>& subdirectories,
+			      string& problem) const {
+  ifstream input(FileSystemInterface::appendPath(objectDirectory, hash));
+  if (!input) {
+    problem = "is missing";
+    return false;
+  }
+
+  vector<string> lines;
+  string line;
+  while (getline(input, line)) {
+    lines.push_back(line);
+  }
+  if (ContentHash::ofLines(lines) != hash) {
+    problem = "doesn't match its hash";
+    return false;
+  }
+
+  string lastName;
+  for (const string& entryLine : lines) {
+    string name;
+    Entry entry;
+    if (!parseEntry(entryLine, name, entry)) {
+      problem = "has a malformed entry: " + entryLine;
+      return false;
+    }
+    if (!lastName.empty() && name <= lastName) {
+      problem = "isn't in name order at " + name;
+      return false;
+    }
+    lastName = name;
+
+    if (entry.isDirectory) {
+      subdirectories.push_back(entry.hash);
+    }
+  }
+  return true;
+}
@@ -1,24 +1,60 @@
 #include <assert.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <mutex>
 #include <sstream>
+#include <unordered_map>
 
-#include "DiffInterface.h"
+#include <unistd.h>
+
+#include "Blame.h"
+#include "CommitDiff.h"
+#include "CommitInfo.h"
+#include "ContentHash.h"
 #include "FileParser.h"
 #include "FileSystemInterface.h"
 #include "FileWriter.h"
+#include "GarbageCollector.h"
+#include "HistoryWalk.h"
+#include "IntegrityCheck.h"
+#include "Manifest.h"
 #include "OperationAccumulator.h"
+#include "StoreLinker.h"
+#include "ThreeWayMerge.h"
+#include "TreeCheckout.h"
+#include "TreeMerge.h"
+#include "UnifiedDiff.h"
 
 using namespace std;
 
 OperationAccumulator::OperationAccumulator() :
-  projectInit(false), initialCommitPerformed(false), curCommit(NULL) {
+  projectInit(false), initialCommitPerformed(false), curCommit(NULL),
+  trackedFiles(pathPool), addedFiles(pathPool), manifests(".kil/.manifests"),
+  basicInfoDirty(false), trackedFilesDirty(false), addedFilesDirty(false),
+  mergeStateDirty(false),
+  haveCommitStats(false), lastPipelineWasCommit(false),
+  havePipelineStats(false), haveWalkStats(false), haveBlameStats(false),
+  failed(false) {
   fileNames[FileName::ADDED_FILES] = ".kil/.addedFiles.txt";
   fileNames[FileName::BASIC_INFO] = ".kil/.basicInfo.txt";
+  fileNames[FileName::BLAME_DIR] = ".kil/.blame";
   fileNames[FileName::BRANCH_LIST] = ".kil/.branches.txt";
+  fileNames[FileName::BRANCH_TIPS] = ".kil/.branchTips";
   fileNames[FileName::COMMIT_DIR] = ".kil/.commits";
+  fileNames[FileName::COMMIT_INDEX] = ".kil/.commitIndex";
+  fileNames[FileName::CONFIG_FILE] = ".kil/.config.txt";
+  fileNames[FileName::INDEX_FILE] = ".kil/.index.txt";
   fileNames[FileName::MAIN_DIR] = ".kil";
+  fileNames[FileName::MERGE_FILE] = ".kil/.merge.txt";
+  fileNames[FileName::OLD_TREE_FILE] = ".kil/.tree.txt";
+  fileNames[FileName::PATH_FILTER_INDEX] = ".kil/.pathFilterIndex";
+  fileNames[FileName::PATH_FILTERS] = ".kil/.pathFilters";
   fileNames[FileName::TRACKED_FILES] = ".kil/.trackedFiles.txt";
-  fileNames[FileName::TREE_FILE] = ".kil/.tree.txt";
+  fileNames[FileName::TREE_FILE] = ".kil/.tree";
+  fileNames[FileName::TREE_JOURNAL] = ".kil/.tree.journal";
 }
 
 OperationAccumulator::~OperationAccumulator() {
@@ -31,41 +67,145 @@ void OperationAccumulator::initializeProject(const std::string& fileName) {
   
   curBranch = "Master";
   tree.initialize(curBranch);
-  branches.insert("Master");
+
+  basicInfoDirty = true;
+  trackedFilesDirty = true;
+  addedFilesDirty = true;
 }
 
-bool OperationAccumulator::alreadyTracked(const string& fileName) const {
-  for (string file : trackedFiles) {
-    if (fileName == file) {
-      return true;
+bool OperationAccumulator::cloneProject(const string& sourcePath) {
+  typedef chrono::steady_clock Clock;
+  const Clock::time_point start = Clock::now();
+
+  if (!FileSystemInterface::fileExists(FileSystemInterface::appendPath(
+	  sourcePath, fileNames.at(FileName::BASIC_INFO)).c_str())) {
+    failure() << "No repository found at " << sourcePath << "!" << endl;
+    return false;
+  }
+
+  if (FileSystemInterface::createDirectory(fileNames.at(FileName::MAIN_DIR))
+      != 0) {
+    failure() << "Could not initialize project!" << endl;
+    return false;
+  }
+
+  // The store is never changed in place, so it's shared. Missing directories
+  // just haven't been needed yet.
+  StoreLinker linker;
+  const string sharedDirectories[] = {
+    fileNames.at(FileName::COMMIT_DIR), manifests.getObjectDirectory(),
+    fileNames.at(FileName::BLAME_DIR)
+  };
+  for (const string& directory : sharedDirectories) {
+    const string source = FileSystemInterface::appendPath(sourcePath,
+							  directory);
+    if (FileSystemInterface::fileExists(source.c_str()) &&
+	!linker.linkDirectory(source, directory)) {
+      failure() << "Error! Could not link " << source << "!" << endl;
+      return false;
+    }
+  }
+
+  // The rest of the state is rewritten where it is, so each gets its own
+  // copy. The added files, the index and any merge in progress belong to the
+  // source's working directory, and the tracked files are whatever gets
+  // checked out. A tree journal means a save was cut short, which loading
+  // the copy finishes.
+  const FileName copiedFiles[] = {
+    FileName::BASIC_INFO, FileName::BRANCH_LIST, FileName::BRANCH_TIPS,
+    FileName::COMMIT_INDEX, FileName::CONFIG_FILE, FileName::PATH_FILTER_INDEX,
+    FileName::PATH_FILTERS, FileName::TREE_FILE, FileName::TREE_JOURNAL
+  };
+  for (FileName file : copiedFiles) {
+    const string source = FileSystemInterface::appendPath(sourcePath,
+							  fileNames.at(file));
+    if (FileSystemInterface::fileExists(source.c_str()) &&
+	!linker.copyFile(source, fileNames.at(file))) {
+      failure() << "Error! Could not copy " << source << "!" << endl;
+      return false;
     }
   }
+  outputTrackedFiles();
+  outputAddedFiles();
+
+  if (!initialize()) {
+    return false;
+  }
+
+  // Check out the current commit
+  size_t numFiles = 0;
+  if (hasCurrentCommit()) {
+    const string commit = curCommit->toString();
+    unordered_set<string> paths;
+    string root;
+    vector<Manifest::Change> changes;
+    if (getManifest(commit, root) && manifests.compare("", root, changes)) {
+      for (const Manifest::Change& change : changes) {
+	paths.insert(change.path);
+      }
+    } else {
+      const CommitContents * contents = getCurrentContents();
+      if (contents == NULL) {
+	failure() << "Error! Could not read the history of the project!" << endl;
+	return true;
+      }
+      for (const auto& file : contents->getFiles()) {
+	paths.insert(file.first);
+      }
+    }
 
-  for (string file : addedFiles) {
-    if (fileName == file) {
+    TreeRestore::Result result;
+    if (!restoreFiles(commit, paths, result)) {
+      failure() << "Error! Could not read the history of the project!" << endl;
       return true;
     }
+    // Any that couldn't be written show up as changed
+    for (const string& path : paths) {
+      if (trackedFiles.insert(path)) {
+	trackedFilesDirty = true;
+      }
+    }
+    recordRestoredFiles(result);
+    numFiles = result.updatedFiles.size() + result.verifiedFiles.size();
   }
 
-  return false;
+  const StoreLinker::Stats stats = linker.getStats();
+  cout << "Cloned project " << projectName << " from " << sourcePath <<
+    " in " << chrono::duration<double, milli>(Clock::now() - start).count() <<
+    "ms (" << stats.filesLinked << " files hard linked, " <<
+    stats.filesCopied << " copied, of which reflinked: " <<
+    stats.filesCloned << "); " << numFiles << " files checked out." << endl;
+  return true;
+}
+
+bool OperationAccumulator::isTrackedFile(const string& fileName) const {
+  return trackedFiles.contains(fileName);
+}
+
+bool OperationAccumulator::alreadyTracked(const string& fileName) const {
+  return trackedFiles.contains(fileName) || addedFiles.contains(fileName);
 }
 
 bool OperationAccumulator::addFile(const string& fileName) {  
   // Do we already have this file
   if (!alreadyTracked(fileName)) {
-    addedFiles.push_back(fileName);
+    addedFiles.insert(fileName);
+    addedFilesDirty = true;
+    watcher.watchPath(fileName);
     return true;
   }
 
   return false;
 }
 
+template <typename Lines>
 static void outputVectorInfoToFile(const char * fileName,
-				   const vector<string>& lines) {
+				   const Lines& lines,
+				   const bool append = false) {
   ofstream outputStream;
-  outputStream.open(fileName, fstream::out);
+  outputStream.open(fileName, append ? fstream::app : fstream::out);
   
-  for (string line : lines) {
+  for (const string& line : lines) {
     outputStream << line << "\n";
   }
   
@@ -84,7 +224,7 @@ void OperationAccumulator::outputAddedFiles() const {
 bool OperationAccumulator::outputBasicInfo() const {
   if (FileSystemInterface::createDirectory(fileNames.at(FileName::MAIN_DIR))
       == -1) {
-    cout << "Could not initialize project!\n";
+    failure() << "Could not initialize project!\n";
     return false;
   }
   
@@ -113,24 +253,21 @@ bool OperationAccumulator::outputBasicInfo() const {
   return true;
 }
 
-void OperationAccumulator::outputTree() const {
-  vector<string> lines;
-  tree.getPrintableTree(lines);
-  outputVectorInfoToFile(fileNames.at(FileName::TREE_FILE), lines);
+ChangedPathFilters::Files OperationAccumulator::getPathFilterFiles() const {
+  ChangedPathFilters::Files files;
+  files.index = fileNames.at(FileName::PATH_FILTER_INDEX);
+  files.words = fileNames.at(FileName::PATH_FILTERS);
+  return files;
 }
 
-void OperationAccumulator::outputBranches() const {
-  const string branchFileName = fileNames.at(FileName::BRANCH_LIST);
-
-  ofstream outputStream;
-  outputStream.open(branchFileName, fstream::out);
-
-  for (const string& branch : branches) {
-    outputStream << branch << "\n";
-  }
-
-  outputStream.flush();
-  outputStream.close();
+Tree::Files OperationAccumulator::getTreeFiles() const {
+  Tree::Files files;
+  files.nodes = fileNames.at(FileName::TREE_FILE);
+  files.commitIndex = fileNames.at(FileName::COMMIT_INDEX);
+  files.branchTips = fileNames.at(FileName::BRANCH_TIPS);
+  files.branchList = fileNames.at(FileName::BRANCH_LIST);
+  files.journal = fileNames.at(FileName::TREE_JOURNAL);
+  return files;
 }
 
 bool OperationAccumulator::readAddedAndTrackedFiles() {
@@ -142,14 +279,14 @@ bool OperationAccumulator::readAddedAndTrackedFiles() {
 
   vector<string> lines;
   FileParser::readFile(fileNames.at(FileName::TRACKED_FILES), lines);
-  for (string fileName : lines) {
-    trackedFiles.push_back(fileName);
+  for (const string& fileName : lines) {
+    trackedFiles.insert(fileName);
   }
 
   lines.clear();
   FileParser::readFile(fileNames.at(FileName::ADDED_FILES), lines);
-  for (string fileName : lines) {
-    addedFiles.push_back(fileName);
+  for (const string& fileName : lines) {
+    addedFiles.insert(fileName);
   }
 
   return true;
@@ -212,32 +349,16 @@ bool OperationAccumulator::readBasicInfo() {
 }
 
 bool OperationAccumulator::readTree() {
-  if (!(FileSystemInterface::fileExists(fileNames.at(FileName::TREE_FILE)))) {
-    return false;
-  }
-
-  vector<string> lines;
-  FileParser::readFile(fileNames.at(FileName::TREE_FILE), lines);
-  
-  return tree.initializeTree(lines, curBranch, curCommit == NULL ?
-			     CommitHash::getNullHash() :
-			     curCommit->toString());
+  return tree.load(getTreeFiles(), curBranch, curCommit == NULL ?
+		   CommitHash::getNullHash() : curCommit->toString());
 }
 
-bool OperationAccumulator::readInBranches() {
-  if (!(FileSystemInterface::fileExists(fileNames.
-					  at(FileName::BRANCH_LIST)))) {
-    return false;
-  }
-
-  vector<string> lines;
-  FileParser::readFile(fileNames.at(FileName::BRANCH_LIST), lines);
-
-  for (const string& branchLine : lines) {
-    branches.insert(branchLine);
+void OperationAccumulator::readStatCache() {
+  // The index is only a cache, so if it's missing or unreadable we just start
+  // over with an empty one
+  if (FileSystemInterface::fileExists(fileNames.at(FileName::INDEX_FILE))) {
+    statCache.read(fileNames.at(FileName::INDEX_FILE));
   }
-
-  return true;
 }
 
 bool OperationAccumulator::initialize() {
@@ -247,68 +368,546 @@ bool OperationAccumulator::initialize() {
   }
 
   projectInit = true;
+
+  // Its history can't be carried over: the diffs of that format weren't
+  // taken against the files as they were committed
+  if (!FileSystemInterface::fileExists(fileNames.at(FileName::TREE_FILE)) &&
+      FileSystemInterface::fileExists(fileNames.at(FileName::OLD_TREE_FILE))) {
+    failure() << "Error! This project was made by an older version of KIL, " <<
+      "whose repository format is too old to be read." << endl;
+    return false;
+  }
   
   const string error = "Error! KIL information tampered with or missing!";
   
-  if (!readBasicInfo() || !readTree() || !readAddedAndTrackedFiles() ||
-      !readInBranches()) {
-     cout << error << endl;
+  // Says which part couldn't be read; fsck goes through the rest
+  string part;
+  if (!readBasicInfo()) {
+    part = "the project info";
+  } else if (!readTree()) {
+    part = "the commit tree";
+  } else if (!readAddedAndTrackedFiles()) {
+    part = "the lists of tracked and added files";
+  } else if (!config.read(fileNames.at(FileName::CONFIG_FILE))) {
+    part = "the settings";
+  } else if (!pathFilters.load(getPathFilterFiles())) {
+    part = "the changed path filters";
+  }
+  if (!part.empty()) {
+     failure() << error << " (Could not read " << part << ".)" << endl;
      return false;
   }
 
+  readStatCache();
+  readMergeState();
+
   return true;
 }
 
-void OperationAccumulator::saveState() const {
+void OperationAccumulator::saveState() {
   if (!projectInit) {
     return;
   }
 
+  // Only write out what has changed this session, so that a session which
+  // just looks around (eg. only 'status') leaves .kil untouched.
+  //
+  // The tree goes before the project info naming the commit we're on, so
+  // that stopping in between leaves us on one the tree already had.
+  if (tree.hasUnsavedChanges() && !tree.save(getTreeFiles())) {
+    failure() << "Error! Could not save the commit tree!" << endl;
+  }
 
-  if (!outputBasicInfo()) {
-    return;
+  if (basicInfoDirty) {
+    if (!outputBasicInfo()) {
+      return;
+    }
+    basicInfoDirty = false;
   }
 
-  // TODO:
-  // Check if any of these have been changes before blindly rewriting the info
-  outputTrackedFiles();
-  outputAddedFiles();
-  outputTree();
-  outputBranches();
+  if (trackedFilesDirty) {
+    outputTrackedFiles();
+    trackedFilesDirty = false;
+  }
+
+  if (addedFilesDirty) {
+    outputAddedFiles();
+    addedFilesDirty = false;
+  }
+
+  if (pathFilters.hasUnsavedChanges() &&
+      !pathFilters.save(getPathFilterFiles())) {
+    failure() << "Error! Could not save the changed path filters!" << endl;
+  }
+
+  if (config.hasUnsavedChanges() &&
+      !config.save(fileNames.at(FileName::CONFIG_FILE))) {
+    failure() << "Error! Could not save the settings!" << endl;
+  }
+
+  if (statCache.isDirty()) {
+    statCache.write(fileNames.at(FileName::INDEX_FILE));
+  }
+
+  if (mergeStateDirty) {
+    outputMergeState();
+    mergeStateDirty = false;
+  }
 }
 
 bool OperationAccumulator::isInitialized() const {
   return projectInit;
 }
 
+bool OperationAccumulator::takeFailure() {
+  const bool hadFailed = failed;
+  failed = false;
+  return hadFailed;
+}
+
+vector<string> OperationAccumulator::getStateFiles() const {
+  // Not the index, which only caches what's in the working directory
+  const FileName stateFiles[] = {
+    ADDED_FILES, BASIC_INFO, BRANCH_LIST, BRANCH_TIPS, COMMIT_INDEX,
+    CONFIG_FILE, MERGE_FILE, PATH_FILTER_INDEX, PATH_FILTERS, TRACKED_FILES,
+    TREE_FILE
+  };
+  vector<string> files;
+  for (const FileName file : stateFiles) {
+    files.push_back(fileNames.at(file));
+  }
+  return files;
+}
+
+ostream& OperationAccumulator::failure() const {
+  failed = true;
+  return cout;
+}
+
 string OperationAccumulator::getCurBranchName() const {
   return curBranch;
 }
 
-void OperationAccumulator::calculateRemovalsAndDiffs(
-    vector<string>& removedFiles,
+bool OperationAccumulator::hasCurrentCommit() const {
+  // Checking out a branch that was created before the initial commit, and
+  // has no commits of its own, takes us back to before any commit
+  return curCommit != NULL &&
+    curCommit->toString() != CommitHash::getNullHash();
+}
+
+string OperationAccumulator::getCommitAt(int node) const {
+  node = tree.findNearestCommit(node);
+  return node == Tree::NO_NODE ? CommitHash::getNullHash() :
+    to_string(tree.getCommit(node));
+}
+
+bool OperationAccumulator::getManifest(const string& commit,
+				       string& root) const {
+  if (commit == CommitHash::getNullHash()) {
+    root = "";
+    return true;
+  }
+
+  CommitInfo info;
+  if (!info.read(CommitInfo::getFileName(fileNames.at(COMMIT_DIR), commit)) ||
+      info.manifest.empty()) {
+    return false;
+  }
+
+  root = info.manifest;
+  return true;
+}
+
+bool OperationAccumulator::buildCurrentManifest(string& root) {
+  if (getManifest(hasCurrentCommit() ? curCommit->toString() :
+		  CommitHash::getNullHash(), root)) {
+    return true;
+  }
+
+  // The current commit was made before manifests were, so this once its
+  // manifest is worked out from scratch. The index knows what most of the
+  // files' contents were at the last commit; only the rest are rebuilt.
+  const CommitContents * contents = getCurrentContents();
+  if (contents == NULL) {
+    return false;
+  }
+
+  map<string, Manifest::Entry> files;
+  for (const auto& file : contents->getFiles()) {
+    Manifest::Entry& entry = files[file.first];
+    entry.isDirectory = false;
+    entry.commit = file.second.modifiedIn.empty() ? file.second.addedIn :
+      file.second.modifiedIn.back();
+
+    const StatCache::Entry * cacheEntry = statCache.find(file.first);
+    if (cacheEntry != NULL) {
+      entry.hash = cacheEntry->hash;
+      continue;
+    }
+
+    vector<Line> lines;
+    if (!contents->readFile(file.first, lines)) {
+      return false;
+    }
+    entry.hash = ContentHash::ofLines(lines);
+  }
+
+  return manifests.update("", files, root);
+}
+
+// The false positive rate new changed-path filters are sized for
+static const char * PATH_FILTER_RATE = "pathFilterRate";
+
+static bool parseFalsePositiveRate(const string& value, double& rate) {
+  char * end;
+  rate = strtod(value.c_str(), &end);
+  return !value.empty() && *end == '\0' && rate > 0 && rate < 1;
+}
+
+double OperationAccumulator::getPathFilterRate() const {
+  double rate;
+  return parseFalsePositiveRate(config.get(PATH_FILTER_RATE, ""), rate) ?
+    rate : ChangedPathFilters::DEFAULT_FALSE_POSITIVE_RATE;
+}
+
+void OperationAccumulator::addPathFilter(
+    const CommitHash& hash, const vector<string>& addedFiles,
+    const vector<string>& removedFiles,
+    const vector<pair<string, FileDiff> >& diffs) {
+  vector<string> changedFiles(addedFiles);
+  changedFiles.insert(changedFiles.end(), removedFiles.begin(),
+		      removedFiles.end());
+  for (const pair<string, FileDiff>& diff : diffs) {
+    changedFiles.push_back(diff.first);
+  }
+
+  pathFilters.add(atoi(hash.toString().c_str()), changedFiles,
+		  getPathFilterRate());
+}
+
+bool OperationAccumulator::buildCommitManifest(
+    const string& commit, const string& commitDirectory,
+    const vector<string>& addedFiles,
+    const vector<string>& removedFiles,
+    const vector<pair<string, FileDiff> >& diffs, string& root) {
+  string parentRoot;
+  if (!buildCurrentManifest(parentRoot)) {
+    return false;
+  }
+
+  // The pipeline staged the hashes of what went into the commit
+  map<string, Manifest::Entry> files;
+  for (const string& file : removedFiles) {
+    files[file].isDirectory = false;
+  }
+  vector<string> changedFiles = addedFiles;
+  for (const pair<string, FileDiff>& diff : diffs) {
+    changedFiles.push_back(diff.first);
+  }
+  for (const string& file : changedFiles) {
+    Manifest::Entry& entry = files[file];
+    entry.isDirectory = false;
+    entry.commit = commit;
+
+    const StatCache::Entry * cacheEntry = statCache.findStaged(file);
+    if (cacheEntry != NULL) {
+      entry.hash = cacheEntry->hash;
+    } else if (!ContentHash::ofFile(
+		   FileSystemInterface::appendPath(commitDirectory,
+						   file).c_str(), entry.hash)) {
+      return false;
+    }
+  }
+
+  return manifests.update(parentRoot, files, root);
+}
+
+// How commits store the files they change: "forward" keeps only the diff
+// against the version before, "reverse" also keeps the new version whole, as
+// the diffs can take it back
+static const char * STORAGE = "storage";
+static const char * FORWARD_STORAGE = "forward";
+static const char * REVERSE_STORAGE = "reverse";
+
+bool OperationAccumulator::usesReverseDeltas() const {
+  return config.get(STORAGE, FORWARD_STORAGE) == REVERSE_STORAGE;
+}
+
+void OperationAccumulator::dropReplacedFullCopies(
+    const string& commit,
+    const vector<pair<string, FileDiff> >& diffs) const {
+  string parentRoot;
+  if (diffs.empty() || !hasCurrentCommit() ||
+      !getManifest(curCommit->toString(), parentRoot)) {
+    return;
+  }
+
+  // Branches whose manifests we can't see might be on any version
+  vector<string> otherRoots;
+  for (const string& branch : tree.getBranchNames()) {
+    if (branch == curBranch) {
+      continue;
+    }
+    string root;
+    if (!getManifest(getCommitAt(tree.getBranchTip(branch)), root)) {
+      return;
+    }
+    otherRoots.push_back(root);
+  }
+
+  const string& commitDirectory = fileNames.at(COMMIT_DIR);
+  unordered_map<string, unordered_set<string> > addedFilesByCommit;
+  for (const pair<string, FileDiff>& diff : diffs) {
+    const string& path = diff.first;
+    Manifest::Entry entry;
+    // Until the new version has its copy, the old one is the newest there is
+    if (!manifests.findFile(parentRoot, path, entry) ||
+	!FileSystemInterface::fileExists(
+	    FileSystemInterface::appendPath(
+		CommitContents::getFullCopyDirectory(commitDirectory, commit),
+		path).c_str())) {
+      continue;
+    }
+    const string& older = entry.commit;
+
+    bool stillInUse = false;
+    for (const string& root : otherRoots) {
+      Manifest::Entry otherEntry;
+      if (manifests.findFile(root, path, otherEntry) &&
+	  otherEntry.commit == older) {
+	stillInUse = true;
+	break;
+      }
+    }
+    if (stillInUse) {
+      continue;
+    }
+
+    // A commit's snapshot of a file it added is a full copy as well
+    if (addedFilesByCommit.count(older) == 0) {
+      CommitInfo info;
+      info.read(CommitInfo::getFileName(commitDirectory, older));
+      addedFilesByCommit[older].insert(info.addedFiles.begin(),
+				       info.addedFiles.end());
+    }
+    CommitContents::replaceFullCopy(commitDirectory, path, older,
+				    addedFilesByCommit[older].count(path) != 0,
+				    commit);
+  }
+}
+
+const CommitContents * OperationAccumulator::getCurrentContents() const {
+  if (!curContents) {
+    unique_ptr<CommitContents> contents(
+	new CommitContents(fileNames.at(COMMIT_DIR)));
+    if (!contents->load(curCommit == NULL ? CommitHash::getNullHash() :
+			curCommit->toString())) {
+      return NULL;
+    }
+    curContents = move(contents);
+  }
+
+  return curContents.get();
+}
+
+bool OperationAccumulator::readPreviousVersion(
+    const string& fileName, vector<Line>& lines,
+    const string * manifestRoot) const {
+  // The manifest names the commit that wrote the version, which has a full
+  // copy of it if it was made with reverse deltas
+  Manifest::Entry entry;
+  if (manifestRoot != NULL &&
+      manifests.findFile(*manifestRoot, fileName, entry) &&
+      CommitContents::readFullCopy(fileNames.at(COMMIT_DIR), fileName,
+				   entry.commit, lines)) {
+    return true;
+  }
+
+  // The commit directory only has the file itself if it was added in the
+  // last commit; otherwise the last version has to be rebuilt from diffs
+  const CommitContents * contents = getCurrentContents();
+  return contents != NULL && contents->readFile(fileName, lines);
+}
+
+bool OperationAccumulator::readCommittedVersion(const string& fileName,
+						vector<Line>& lines) const {
+  string root;
+  Manifest::Entry entry;
+  if (hasCurrentCommit() && getManifest(curCommit->toString(), root)) {
+    if (!manifests.findFile(root, fileName, entry)) {
+      return false;
+    }
+
+    if (FileSystemInterface::fileExists(fileName.c_str())) {
+      FileParser::readFile(fileName.c_str(), lines);
+      if (ContentHash::ofLines(lines) == entry.hash) {
+	return true;
+      }
+      lines.clear();
+    }
+    return readPreviousVersion(fileName, lines, &root);
+  }
+
+  return readPreviousVersion(fileName, lines);
+}
+
+bool OperationAccumulator::matchesLastCommit(const string& fileName) const {
+  vector<Line> previousLines;
+  vector<Line> currentLines;
+  if (!readPreviousVersion(fileName, previousLines)) {
+    return false;
+  }
+  FileParser::readFile(fileName.c_str(), currentLines);
+
+  if (previousLines.size() != currentLines.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < currentLines.size(); ++i) {
+    if (!previousLines[i].equals(currentLines[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool OperationAccumulator::getFilesToExamine(vector<string>& files) const {
+  vector<string> changedPaths;
+  if (watcher.getChangedPaths(changedPaths)) {
+    for (const string& path : changedPaths) {
+      if (isTrackedFile(path)) {
+	files.push_back(path);
+      } else {
+	// Not ours to worry about
+	watcher.markClean(path);
+      }
+    }
+    return false;
+  }
+
+  // Either we aren't watching, or the watcher has lost track, so everything
+  // needs looking at
+  watchTrackedAndAddedFiles();
+  files.assign(trackedFiles.begin(), trackedFiles.end());
+  return true;
+}
+
+void OperationAccumulator::watchTrackedAndAddedFiles() const {
+  if (!watcher.isRunning()) {
+    return;
+  }
+
+  for (const string& file : trackedFiles) {
+    watcher.watchPath(file);
+  }
+  for (const string& file : addedFiles) {
+    watcher.watchPath(file);
+  }
+}
+
+void OperationAccumulator::processPipelineResults(
+    const vector<CommitPipeline::Result>& results,
+    vector<string>& verifiedAddedFiles, vector<string>& removedFiles,
     vector<pair<string, FileDiff> >& diffs) const {
-  for (const string& trackedFile : trackedFiles) {
-    if (FileSystemInterface::fileExists(trackedFile.c_str())) {
-      // calculate the location of the previous diff
-      // path to version of file in previous commit will be commithash/filepath
-      string previousCommitFileName =
-	FileSystemInterface::appendPath(fileNames.at(COMMIT_DIR),
-					curCommit->toString());
-      previousCommitFileName =
-	FileSystemInterface::appendPath(previousCommitFileName, trackedFile);
-      FileDiff diff =
-	DiffInterface::calculateFileDiff(
-	    previousCommitFileName.c_str(), trackedFile.c_str());
-      if (!diff.isEmptyDiff()) {
-	diffs.push_back(make_pair(trackedFile, diff));
+  for (const CommitPipeline::Result& result : results) {
+    const string& path = result.path;
+
+    switch (result.outcome) {
+    case CommitPipeline::UNCHANGED:
+      watcher.markClean(path);
+      break;
+    case CommitPipeline::CONTENTS_UNCHANGED:
+      statCache.record(path, result.info, result.hash);
+      watcher.markClean(path);
+      break;
+    case CommitPipeline::MODIFIED:
+      diffs.push_back(make_pair(path, *result.diff));
+      // Becomes the file's entry if these changes get committed
+      statCache.stage(path, result.info, result.hash);
+      watcher.markChanged(path);
+      break;
+    case CommitPipeline::REMOVED:
+      // An added file that has since been deleted is simply not committed
+      if (trackedFiles.contains(path)) {
+	removedFiles.push_back(path);
+	watcher.markChanged(path);
       }
-    } else {
-      removedFiles.push_back(trackedFile);
+      break;
+    case CommitPipeline::ADDED:
+      verifiedAddedFiles.push_back(path);
+      if (!result.hash.empty()) {
+	statCache.stage(path, result.info, result.hash);
+      }
+      break;
+    case CommitPipeline::FAILED:
+      failure() << "Could not snapshot file " << path << "!" << endl;
+      watcher.markChanged(path);
+      break;
+    case CommitPipeline::NO_PREVIOUS_VERSION:
+      failure() << "Could not rebuild the last committed version of file " <<
+	path << "!" << endl;
+      watcher.markChanged(path);
+      break;
     }
   }
 }
 
+void OperationAccumulator::runPipeline(
+    const vector<string>& addedFilesToCommit,
+    function<string()> getCommitDirectory,
+    function<string()> getFullCopyDirectory,
+    vector<string>& verifiedAddedFiles, vector<string>& removedFiles,
+    vector<pair<string, FileDiff> >& diffs) const {
+  statCache.clearStaged();
+
+  vector<string> filesToExamine;
+  const bool fullScan = getFilesToExamine(filesToExamine);
+
+  string manifestRoot;
+  const bool haveManifest = getManifest(
+      getCommitAt(tree.getCurrentNode()), manifestRoot);
+  CommitPipeline pipeline(
+      statCache,
+      [this, haveManifest, &manifestRoot](const string& fileName,
+					   string& hash) {
+	Manifest::Entry entry;
+	if (!haveManifest ||
+	    !manifests.findFile(manifestRoot, fileName, entry)) {
+	  return false;
+	}
+	hash = entry.hash;
+	return true;
+      },
+      [this, haveManifest, &manifestRoot](const string& fileName,
+					   vector<Line>& lines) {
+	return readPreviousVersion(fileName, lines,
+				   haveManifest ? &manifestRoot : NULL);
+      });
+  vector<CommitPipeline::Result> results;
+  pipeline.run(addedFilesToCommit, filesToExamine, getCommitDirectory,
+	       getFullCopyDirectory, results);
+
+  lastPipelineStats = pipeline.getStats();
+  lastPipelineWasCommit = (bool) getCommitDirectory;
+  havePipelineStats = true;
+  if (pipeline.getWriteStats(lastCommitWriteStats)) {
+    haveCommitStats = true;
+  }
+
+  processPipelineResults(results, verifiedAddedFiles, removedFiles, diffs);
+
+  if (fullScan) {
+    watcher.finishFullRescan();
+  }
+}
+
+void OperationAccumulator::calculateRemovalsAndDiffs(
+    vector<string>& removedFiles,
+    vector<pair<string, FileDiff> >& diffs) const {
+  vector<string> verifiedAddedFiles;
+  runPipeline(vector<string>(), function<string()>(), function<string()>(),
+	      verifiedAddedFiles, removedFiles, diffs);
+}
+
 void OperationAccumulator::createNewCommitDirectory(
     const string& newCommitDirectoryPath) const {
   if (!initialCommitPerformed) {
@@ -332,11 +931,11 @@ string OperationAccumulator::calculateFileLocationForHash(
 }
 
 void OperationAccumulator::updateParentCommit(
-    const CommitHash& childHash) const {
+    const CommitHash& parentHash, const CommitHash& childHash) const {
   size_t MIN_LINES_INFO = 8;
   size_t CHILD_COMMIT_LINE = 4;
   
-  const string path = calculateFileLocationForHash(*curCommit);
+  const string path = calculateFileLocationForHash(parentHash);
   vector<string> fileContents;
   FileParser::readFile(path.c_str(), fileContents);
   
@@ -357,7 +956,8 @@ void OperationAccumulator::updateParentCommit(
       childHash.toString() + "]";
   }
 
-  FileWriter::writeFile(path.c_str(), fileContents);
+  // Replaced rather than rewritten, as a clone may share the file
+  FileWriter::replaceFile(path, fileContents);
 }
 
 void OperationAccumulator::writeBasicCommitInfo(
@@ -368,7 +968,7 @@ void OperationAccumulator::writeBasicCommitInfo(
   output << "commitMessage=\"" << commitMessage << "\"\n";
   output << "branch=" << curBranch << "\n";
   output << "parentCommit=";
-  if (initialCommitPerformed) {
+  if (hasCurrentCommit()) {
     output << curCommit->toString();
   } else {
     output << "ROOT";
@@ -377,112 +977,95 @@ void OperationAccumulator::writeBasicCommitInfo(
   output << "childCommits=[]\n";
 }
 
-static vector<string>::const_iterator vectorContains(
-    const vector<string>& myVector, string element) {
-  for (vector<string>::const_iterator it = myVector.begin();
-       it != myVector.end(); ++it) {
-    if ((*it) == element) {
-      return it;
-    }
-  }
-
-  return myVector.end();
-}
-
 void OperationAccumulator::removeDeletedFilesFromLists(const vector<string>&
 						       removedFiles) {
   for (const string& removedFile : removedFiles) {
-    vector<string>::const_iterator location =
-      vectorContains(trackedFiles, removedFile);
-    if (location != trackedFiles.end()) {
-      trackedFiles.erase(location);
-    }
-
-    location = vectorContains(addedFiles, removedFile);
-    if (location != addedFiles.end()) {
-      addedFiles.erase(location);
-    }
-  }
-}
-
-void OperationAccumulator::writeOutAddedFiles(
-    ofstream& output, const vector<string>& addedFiles,
-    const string& newCommitDirectoryPath) const {
-  output << "addedFiles [" << addedFiles.size() << "]\n";
-  for (string addedFile : addedFiles) {
-      cout << "Created file " << addedFile << endl;
-      output << addedFile << "\n";
-  }
-
-  for (const string& newFile : addedFiles) {
-      vector<string> directories;
-      FileSystemInterface::parseDirectoryStructure(newFile, directories);
-      FileSystemInterface::createDirectories(newCommitDirectoryPath, directories);
-      vector<string> fileLines;
-      FileParser::readFile(newFile.c_str(), fileLines);
-      FileWriter::writeFile(
-          FileSystemInterface::appendPath(newCommitDirectoryPath, newFile).c_str(),
-	                                  fileLines);
+    trackedFiles.remove(removedFile);
+    addedFiles.remove(removedFile);
   }
 }
 
 void OperationAccumulator::writeOutCommit(
-    const string& commitMessage, const vector<string>& addedFiles,
+    const string& commitMessage, CommitHash * hash,
+    const vector<string>& addedFiles,
     const vector<string>& removedFiles,
     const vector<pair<string, FileDiff> >& diffs) {
-  CommitHash * hash = new CommitHash();
-
+  // The contents of the commit have already been written into its directory,
+  // all that's left is the commit's own info file
   string newCommitDirectoryPath =
     FileSystemInterface::appendPath(fileNames.at(COMMIT_DIR),
 				    hash->toString().c_str());
-  
-  createNewCommitDirectory(newCommitDirectoryPath);
-  
+
   ofstream output;
   string newCommitFileName =
     FileSystemInterface::appendPath(newCommitDirectoryPath,
 				    hash->toString().c_str());
   writeBasicCommitInfo(output, newCommitFileName, *hash, commitMessage);
-  
-  writeOutAddedFiles(output, addedFiles, newCommitDirectoryPath);
+
+  output << "addedFiles [" << addedFiles.size() << "]\n";
+  for (const string& addedFile : addedFiles) {
+      cout << "Created file " << addedFile << endl;
+      output << addedFile << "\n";
+  }
   
   // now write out the removed files
   output << "removedFiles [" << removedFiles.size() << "]\n";
-  for (string removedFile : removedFiles) {
+  for (const string& removedFile : removedFiles) {
     cout << "Removed file " << removedFile << endl;
     output << removedFile << "\n";
+    statCache.remove(removedFile);
   }
 
   // Now remove the removed files from our added/tracked file lists
-  removeDeletedFilesFromLists(removedFiles);
+  if (!removedFiles.empty()) {
+    removeDeletedFilesFromLists(removedFiles);
+    trackedFilesDirty = true;
+    addedFilesDirty = true;
+  }
   
   // write out which files have diffs
   output << "diffs [" << diffs.size() << "]\n";
   
-  // now write out the diffs
   for (const pair<string, FileDiff>& diffInfo : diffs) {
     cout << "Updating file " << diffInfo.first << " with " <<
       diffInfo.second.getNumInsertions() << " insertions and " <<
       diffInfo.second.getNumDeletions() << " deletions" << endl;
-    vector<string> directories;
-    FileSystemInterface::parseDirectoryStructure(diffInfo.first, directories);
-    FileSystemInterface::createDirectories(newCommitDirectoryPath,
-					   directories);
-    diffInfo.second.
-      print(FileSystemInterface::appendPath(newCommitDirectoryPath,
-					    diffInfo.first));
+    output << diffInfo.first << "\n";
+  }
+
+  // Merges are stored relative to the current branch's side, and note the
+  // other side's commit here
+  if (isMerging()) {
+    output << "mergeParent=" << mergeCommit << "\n";
+  }
+
+  addPathFilter(*hash, addedFiles, removedFiles, diffs);
+
+  string manifest;
+  if (buildCommitManifest(hash->toString(), newCommitDirectoryPath,
+			  addedFiles, removedFiles, diffs, manifest)) {
+    output << "manifest=" << manifest << "\n";
+  } else {
+    failure() << "Could not record the manifest of the commit!" << endl;
   }
 
   output.flush();
   output.close();
 
-  if (initialCommitPerformed) {
+  if (hasCurrentCommit()) {
     // update the parent commit
-    updateParentCommit(*hash);
+    updateParentCommit(*curCommit, *hash);
+  }
+  if (usesReverseDeltas()) {
+    dropReplacedFullCopies(hash->toString(), diffs);
+  }
+  if (isMerging()) {
+    updateParentCommit(CommitHash(mergeCommit), *hash);
   }
 
   delete curCommit;
   curCommit = hash;
+  curContents.reset();
 }
 
 void OperationAccumulator::getAddedFiles(vector<string>&
@@ -498,38 +1081,100 @@ void OperationAccumulator::getAddedFiles(vector<string>&
 
 bool OperationAccumulator::commit(const string& commitMessage,
 				  const bool addFlag) {  
-  vector<string> verifiedAddedFiles;
-  
+  vector<string> addedFilesToCommit;
   if (addFlag) {
-    getAddedFiles(verifiedAddedFiles);
+    addedFilesToCommit.assign(addedFiles.begin(), addedFiles.end());
   }
 
-  // Now found out which file have been deleted, and gets the diffs for the
-  // files that have been changed
+  // The new commit's hash and directory are only created once there turns
+  // out to be something to put in it
+  CommitHash * hash = NULL;
+  function<string()> getCommitDirectory = [this, &hash]() {
+    hash = new CommitHash();
+    string newCommitDirectoryPath =
+      FileSystemInterface::appendPath(fileNames.at(COMMIT_DIR),
+				      hash->toString().c_str());
+    createNewCommitDirectory(newCommitDirectoryPath);
+    return newCommitDirectoryPath;
+  };
+  function<string()> getFullCopyDirectory;
+  if (usesReverseDeltas()) {
+    getFullCopyDirectory = [this, &hash]() {
+      const string directory = CommitContents::getFullCopyDirectory(
+	  fileNames.at(COMMIT_DIR), hash->toString());
+      vector<string> directories;
+      FileSystemInterface::parseDirectoryStructure(directory + "/",
+						   directories);
+      FileSystemInterface::createDirectories("", directories);
+      return directory;
+    };
+  }
+
+  // Snapshot the added files, find out which files have been deleted, and
+  // write out the diffs for the files that have been changed
+  vector<string> verifiedAddedFiles;
   vector<string> removedFiles;
   vector<pair<string, FileDiff> > diffs;
-  calculateRemovalsAndDiffs(removedFiles, diffs);
+  runPipeline(addedFilesToCommit, getCommitDirectory, getFullCopyDirectory,
+	      verifiedAddedFiles, removedFiles, diffs);
 
+  // A merge gets its commit even if it left the files as they were, so
+  // that the history records it
   if (verifiedAddedFiles.size() == 0 && removedFiles.size() == 0 &&
-      diffs.size() == 0) {
+      diffs.size() == 0 && !isMerging()) {
     return false;
   }
 
+  if (hash == NULL) {
+    // Only removals, so nothing has been written yet
+    getCommitDirectory();
+  }
+
   // We're going to output this info now
-  writeOutCommit(commitMessage, verifiedAddedFiles, removedFiles, diffs);
+  writeOutCommit(commitMessage, hash, verifiedAddedFiles, removedFiles, diffs);
+
+  // The committed contents are now what the index should compare against
+  statCache.applyStaged();
+  for (const string& file : verifiedAddedFiles) {
+    watcher.markClean(file);
+  }
+  for (const string& file : removedFiles) {
+    watcher.markClean(file);
+  }
+  for (const pair<string, FileDiff>& diff : diffs) {
+    watcher.markClean(diff.first);
+  }
 
   // Update internal state
   if (addFlag) {
-    for (string addedFile : verifiedAddedFiles) {
-      trackedFiles.push_back(addedFile);
-    }
     addedFiles.clear();
+    for (const string& addedFile : verifiedAddedFiles) {
+      trackedFiles.insert(addedFile);
+    }
+    // Anything we couldn't snapshot stays added
+    for (const string& file : addedFilesToCommit) {
+      if (!trackedFiles.contains(file) &&
+	  FileSystemInterface::fileExists(file.c_str())) {
+	addedFiles.insert(file);
+      }
+    }
+    trackedFilesDirty = true;
+    addedFilesDirty = true;
   }
 
+  // curCommit and lastHash have changed
   initialCommitPerformed = true;
+  basicInfoDirty = true;
 
   // curCommit has now been updated
-  tree.addCommit(*curCommit);
+  if (isMerging()) {
+    tree.addCommit(*curCommit, tree.findCommit(mergeCommit));
+    mergeBranch.clear();
+    mergeCommit.clear();
+    mergeStateDirty = true;
+  } else {
+    tree.addCommit(*curCommit);
+  }
   
   return true;
 }
@@ -543,6 +1188,11 @@ void OperationAccumulator::getStatus() const {
   vector<pair<string, FileDiff> > diffs;
   calculateRemovalsAndDiffs(removedFiles, diffs);
 
+  if (isMerging()) {
+    cout << "Merging branch " << mergeBranch << ", " <<
+      unresolvedConflicts.size() << " files still in conflict." << endl;
+  }
+
   if (verifiedAddedFiles.size() == 0 && removedFiles.size() == 0 &&
       diffs.size() == 0) {
     cout << "No new changes to be commited!" << endl;
@@ -563,16 +1213,175 @@ void OperationAccumulator::getStatus() const {
   }
 }
 
+void OperationAccumulator::printDiff() const {
+  vector<string> verifiedAddedFiles;
+  getAddedFiles(verifiedAddedFiles);
+
+  vector<string> removedFiles;
+  vector<pair<string, FileDiff> > diffs;
+  calculateRemovalsAndDiffs(removedFiles, diffs);
+
+  string root;
+  const string * manifestRoot = hasCurrentCommit() &&
+    getManifest(curCommit->toString(), root) ? &root : NULL;
+
+  // Only one file's contents are held at a time
+  for (const string& addedFile : verifiedAddedFiles) {
+    vector<Line> lines;
+    FileParser::readFile(addedFile.c_str(), lines);
+    UnifiedDiff::printAdded(cout, addedFile, lines);
+  }
+
+  for (const pair<string, FileDiff>& diff : diffs) {
+    vector<Line> lines;
+    if (!readPreviousVersion(diff.first, lines, manifestRoot)) {
+      failure() << "Could not rebuild the last committed version of file " <<
+	diff.first << "!" << endl;
+      continue;
+    }
+    UnifiedDiff::print(cout, diff.first, lines, diff.second);
+  }
+
+  for (const string& removedFile : removedFiles) {
+    vector<Line> lines;
+    if (!readPreviousVersion(removedFile, lines, manifestRoot)) {
+      failure() << "Could not rebuild the last committed version of file " <<
+	removedFile << "!" << endl;
+      continue;
+    }
+    UnifiedDiff::printRemoved(cout, removedFile, lines);
+  }
+}
+
+void OperationAccumulator::printDiff(const string& first,
+				     const string& second) const {
+  int firstNode, secondNode;
+  if (!findNodes(first, second, firstNode, secondNode)) {
+    return;
+  }
+
+  unordered_set<string> changedFiles;
+  if (!findChangedFiles(firstNode, secondNode, changedFiles)) {
+    failure() << "Error! Could not read the history of the commits!" << endl;
+    return;
+  }
+  vector<string> files(changedFiles.begin(), changedFiles.end());
+  sort(files.begin(), files.end());
+
+  CommitDiff diff(fileNames.at(COMMIT_DIR), manifests);
+  if (!diff.print(getCommitAt(firstNode), getCommitAt(secondNode), files,
+		  cout)) {
+    failure() << "Error! Could not read the history of the commits!" << endl;
+  }
+}
+
+void OperationAccumulator::printLog(size_t maxCommits, const string& path,
+				   size_t pageSize,
+				   function<bool()> showNextPage) const {
+  const int start = tree.findNearestCommit(tree.getCurrentNode());
+  if (start == Tree::NO_NODE) {
+    cout << "No commits yet on branch " << curBranch << "." << endl;
+    return;
+  }
+
+  // Output is left to the stream's buffer to flush, other than once a page
+  // is out, so a long log doesn't cost a write for every line
+  HistoryWalk walk(tree, fileNames.at(COMMIT_DIR), manifests, start, path,
+		   &pathFilters);
+  CommitInfo commit;
+  size_t numPrinted = 0;
+  while ((maxCommits == 0 || numPrinted < maxCommits) && walk.next(commit)) {
+    if (pageSize != 0 && numPrinted != 0 && numPrinted % pageSize == 0) {
+      cout << flush;
+      if (!showNextPage()) {
+	return;
+      }
+    }
+
+    cout << "commit " << commit.hash << " on " << commit.branch << "\n";
+    if (!commit.mergeParent.empty()) {
+      cout << "Merge: " << commit.parent << " " << commit.mergeParent << "\n";
+    }
+    cout << "\n    " << commit.message << "\n\n";
+    ++numPrinted;
+  }
+
+  if (!path.empty()) {
+    lastWalkStats = walk.getStats();
+    haveWalkStats = true;
+  }
+
+  if (walk.failed()) {
+    failure() << "Error! Could not read the history of the commits!" << endl;
+  } else if (numPrinted == 0) {
+    cout << "No commits on branch " << curBranch << " changed " << path <<
+      "." << endl;
+  } else {
+    cout << flush;
+  }
+}
+
+void OperationAccumulator::blame(const string& fileName) const {
+  vector<Line> lines;
+  if (!readCommittedVersion(fileName, lines)) {
+    failure() << "File " << fileName << " is not in the last commit!" << endl;
+    return;
+  }
+
+  Blame blame(tree, fileNames.at(COMMIT_DIR), fileNames.at(BLAME_DIR),
+	      manifests, pathFilters);
+  vector<Blame::Range> ranges;
+  const bool blamed = blame.run(fileName, tree.getCurrentNode(), lines.size(),
+				ranges);
+  lastBlameStats = blame.getStats();
+  haveBlameStats = true;
+  if (!blamed) {
+    failure() << "Error! Could not read the history of " << fileName << "!" <<
+      endl;
+    return;
+  }
+
+  size_t commitWidth = 0;
+  for (const Blame::Range& range : ranges) {
+    commitWidth = max(commitWidth, range.commit.size());
+  }
+  const size_t lineWidth = to_string(lines.size()).size();
+
+  for (const Blame::Range& range : ranges) {
+    for (unsigned int i = range.start; i < range.start + range.length; ++i) {
+      const string lineNumber = to_string(i + 1);
+      cout << range.commit << string(commitWidth - range.commit.size(), ' ') <<
+	" " << string(lineWidth - lineNumber.size(), ' ') << lineNumber <<
+	") " << lines[i].getString() << "\n";
+    }
+  }
+  cout << flush;
+}
+
 void OperationAccumulator::createNewBranch(const string& newBranchName) {
+  if (isMerging()) {
+    failure() << "Please finish the merge in progress first!" << endl;
+    return;
+  }
+
   if (!cleanState()) {
-    cout << "Please commit changes before checking out new branch!" << endl;
+    failure() << "Please commit changes before checking out new branch!" <<
+      endl;
+    return;
+  }
+
+  // Moving an existing branch here would leave its commits unreachable, for
+  // gc to delete
+  if (tree.getBranchTip(newBranchName) != Tree::NO_NODE) {
+    failure() << "A branch named " << newBranchName <<
+      " already exists! Use checkout " << newBranchName << "." << endl;
     return;
   }
   
   // Tell our tree there is a new branch
   curBranch = newBranchName;
   tree.registerNewBranch(newBranchName);
-  branches.insert(newBranchName);
+  basicInfoDirty = true;
 }
 
 bool OperationAccumulator::filesHaveBeenAdded() const {
@@ -586,20 +1395,46 @@ bool OperationAccumulator::filesHaveBeenAdded() const {
 }
 
 bool OperationAccumulator::filesHaveBeenRemovedOrModified() const {
-  for (const string& trackedFile : trackedFiles) {
-    if (FileSystemInterface::fileExists(trackedFile.c_str())) {
-      string previousCommitFileName =
-	FileSystemInterface::appendPath(fileNames.at(COMMIT_DIR),
-					curCommit->toString());
-      previousCommitFileName =
-	FileSystemInterface::appendPath(previousCommitFileName, trackedFile);
-      if (!FileParser::compareFiles(previousCommitFileName.c_str(),
-				   trackedFile.c_str())) {
+  vector<string> filesToExamine;
+  const bool fullScan = getFilesToExamine(filesToExamine);
+
+  for (const string& trackedFile : filesToExamine) {
+    struct stat info;
+    if (!FileSystemInterface::getFileInfo(trackedFile.c_str(), info)) {
+      watcher.markChanged(trackedFile);
+      return true;
+    }
+
+    if (statCache.isUnchanged(trackedFile, info)) {
+      watcher.markClean(trackedFile);
+      continue;
+    }
+
+    const StatCache::Entry * entry = statCache.find(trackedFile);
+    if (entry != NULL) {
+      string hash;
+      if (!ContentHash::ofFile(trackedFile.c_str(), hash) ||
+	  hash != entry->hash) {
+	watcher.markChanged(trackedFile);
 	return true;
       }
+      statCache.record(trackedFile, info, hash);
     } else {
-      return true;
+      if (!matchesLastCommit(trackedFile)) {
+	watcher.markChanged(trackedFile);
+	return true;
+      }
+
+      string hash;
+      if (ContentHash::ofFile(trackedFile.c_str(), hash)) {
+	statCache.record(trackedFile, info, hash);
+      }
     }
+    watcher.markClean(trackedFile);
+  }
+
+  if (fullScan) {
+    watcher.finishFullRescan();
   }
 
   return false;
@@ -615,16 +1450,864 @@ bool OperationAccumulator::cleanState() const {
 
 void OperationAccumulator::switchBranch(const string& branchName) {
   // Check if the branch exists!
-  if (branches.count(branchName) == 0) {
-    cout << "No branch named " << branchName << " found!" << endl;
+  if (tree.getBranchTip(branchName) == Tree::NO_NODE) {
+    failure() << "No branch named " << branchName << " found!" << endl;
     return;
   }
   
+  if (isMerging()) {
+    failure() << "Please finish the merge in progress first!" << endl;
+    return;
+  }
+
   // Check there are no uncommitted changes!
   if (!cleanState()) {
-    cout << "Please commit changes before checking out branch!" << endl;
+    failure() << "Please commit changes before checking out branch!" << endl;
+    return;
+  }
+
+  if (branchName == curBranch) {
+    cout << "Already on branch " << branchName << "." << endl;
+    return;
+  }
+
+  // Nothing but the files that differ needs looking at, or touching
+  const int targetTip = tree.getBranchTip(branchName);
+  unordered_set<string> changedFiles;
+  if (!findChangedFiles(tree.getCurrentNode(), targetTip, changedFiles)) {
+    failure() << "Error! Could not read the history of the branches!" << endl;
+    return;
+  }
+
+  const string targetCommit = getCommitAt(targetTip);
+  CommitContents current(fileNames.at(COMMIT_DIR));
+  CommitContents target(fileNames.at(COMMIT_DIR));
+  if (!current.load(getCommitAt(tree.getCurrentNode()), &changedFiles) ||
+      !target.load(targetCommit, &changedFiles)) {
+    failure() << "Error! Could not read the history of the branches!" << endl;
+    return;
+  }
+
+  TreeCheckout::Result result;
+  TreeCheckout(current, target, statCache).run(result);
+  recordRestoredFiles(result);
+
+  curBranch = branchName;
+  tree.switchToBranch(branchName);
+  if (initialCommitPerformed) {
+    delete curCommit;
+    curCommit = new CommitHash(targetCommit);
+  }
+  curContents.reset();
+  basicInfoDirty = true;
+
+  cout << "Switched to branch " << branchName << " (" <<
+    result.updatedFiles.size() << " files updated, " <<
+    result.removedFiles.size() << " removed)." << endl;
+}
+
+void OperationAccumulator::recordRestoredFiles(
+    const TreeRestore::Result& result) {
+  // The files we wrote match the new commit, so the stat cache can vouch
+  // for them straight away
+  vector<const TreeRestore::UpdatedFile *> files;
+  for (const TreeRestore::UpdatedFile& file : result.updatedFiles) {
+    files.push_back(&file);
+  }
+  for (const TreeRestore::UpdatedFile& file : result.verifiedFiles) {
+    files.push_back(&file);
+  }
+  for (const TreeRestore::UpdatedFile * file : files) {
+    if (trackedFiles.insert(file->path)) {
+      watcher.watchPath(file->path);
+      trackedFilesDirty = true;
+    }
+    statCache.record(file->path, file->info, file->hash);
+    watcher.markClean(file->path);
+  }
+  for (const string& file : result.removedFiles) {
+    if (trackedFiles.remove(file)) {
+      trackedFilesDirty = true;
+    }
+    statCache.remove(file);
+    watcher.markClean(file);
+  }
+  // Whatever is left of these shows up as changed
+  for (const string& file : result.failedFiles) {
+    failure() << "Could not update file " << file << "!" << endl;
+    watcher.markChanged(file);
+  }
+}
+
+bool OperationAccumulator::restoreFiles(const string& commit,
+					const unordered_set<string>& paths,
+					TreeRestore::Result& result) const {
+  const string& commitDirectory = fileNames.at(COMMIT_DIR);
+  const bool isCurrentCommit = commit == getCommitAt(tree.getCurrentNode());
+  CommitContents contents(commitDirectory);
+  const CommitContents * source = NULL;
+  string root;
+  const bool haveManifest = getManifest(commit, root);
+  if (!haveManifest) {
+    source = isCurrentCommit ? getCurrentContents() :
+      contents.load(commit, &paths) ? &contents : NULL;
+    if (source == NULL) {
+      return false;
+    }
+  }
+
+  // The manifest is looked at up front, as it isn't safe to share between
+  // threads; it says what each file should hash to, and which commit has a
+  // full copy of it if any does
+  vector<TreeRestore::File> files;
+  unordered_map<string, string> writtenIn;
+  for (const string& path : paths) {
+    TreeRestore::File file;
+    file.path = path;
+    Manifest::Entry entry;
+    if (haveManifest) {
+      file.remove = !manifests.findFile(root, path, entry);
+      if (!file.remove) {
+	file.hash = entry.hash;
+	writtenIn[path] = entry.commit;
+      }
+    } else {
+      file.remove = source->find(path) == NULL;
+    }
+
+    // Files that were never committed are none of our business
+    if (file.remove && !trackedFiles.contains(path)) {
+      continue;
+    }
+    files.push_back(file);
+  }
+  sort(files.begin(), files.end(),
+       [](const TreeRestore::File& first, const TreeRestore::File& second) {
+	 return first.path < second.path;
+       });
+
+  // Anything without a full copy is rebuilt, and the history is only read
+  // the first time that's needed (the current commit's may well have been
+  // already)
+  once_flag loadOnce;
+  TreeRestore([&](const string& path, vector<Line>& lines) {
+      unordered_map<string, string>::const_iterator it = writtenIn.find(path);
+      if (it != writtenIn.end() &&
+	  CommitContents::readFullCopy(commitDirectory, path, it->second,
+				       lines)) {
+	return true;
+      }
+
+      call_once(loadOnce, [&]() {
+	  if (source == NULL) {
+	    source = isCurrentCommit ? getCurrentContents() :
+	      contents.load(commit, &paths) ? &contents : NULL;
+	  }
+	});
+      return source != NULL && source->readFile(path, lines);
+    }, statCache).run(files, result);
+  return true;
+}
+
+void OperationAccumulator::undo(const string& fileName) {
+  if (isMerging()) {
+    failure() << "Please finish the merge in progress first!" << endl;
+    return;
+  }
+
+  const bool allFiles = fileName.empty();
+  if (!allFiles && addedFiles.remove(fileName)) {
+    addedFilesDirty = true;
+    cout << "File " << fileName << " is no longer added." << endl;
+    return;
+  }
+  if (!allFiles && !isTrackedFile(fileName)) {
+    failure() << "File " << fileName << " is not being tracked!" << endl;
+    return;
+  }
+
+  // Only the files that have changed since the last commit need looking at,
+  // and they're found the same way status finds them
+  unordered_set<string> paths;
+  if (allFiles) {
+    vector<string> removedFiles;
+    vector<pair<string, FileDiff> > diffs;
+    calculateRemovalsAndDiffs(removedFiles, diffs);
+    paths.insert(removedFiles.begin(), removedFiles.end());
+    for (const pair<string, FileDiff>& diff : diffs) {
+      paths.insert(diff.first);
+    }
+  } else {
+    paths.insert(fileName);
+  }
+
+  TreeRestore::Result result;
+  if (!restoreFiles(getCommitAt(tree.getCurrentNode()), paths, result)) {
+    failure() << "Error! Could not read the history of the branch!" << endl;
+    return;
+  }
+  recordRestoredFiles(result);
+
+  size_t numAdded = 0;
+  if (allFiles) {
+    numAdded = addedFiles.size();
+    addedFiles.clear();
+    addedFilesDirty = true;
+  }
+
+  cout << result.updatedFiles.size() << " files restored";
+  if (numAdded != 0) {
+    cout << ", " << numAdded << " no longer added";
+  }
+  cout << "." << endl;
+}
+
+void OperationAccumulator::reset(const string& branchOrCommit, bool hard) {
+  if (isMerging()) {
+    failure() << "Please finish the merge in progress first!" << endl;
+    return;
+  }
+
+  const int targetNode = tree.findNode(branchOrCommit);
+  if (targetNode == Tree::NO_NODE) {
+    failure() << "No branch or commit named " << branchOrCommit << " found!" <<
+      endl;
+    return;
+  }
+
+  const int currentNode = tree.getCurrentNode();
+  const string targetCommit = getCommitAt(targetNode);
+  if (targetCommit == CommitHash::getNullHash() ||
+      !tree.isAncestor(targetNode, currentNode)) {
+    failure() << "Can only reset to a commit in the history of branch " <<
+      curBranch << "!" << endl;
+    return;
+  }
+
+  // Only files that differ between the two commits can change
+  unordered_set<string> paths;
+  if (!findChangedFiles(currentNode, targetNode, paths)) {
+    failure() << "Error! Could not read the history of the branch!" << endl;
     return;
   }
 
-  // If we're here, we can actually switch branches!
+  TreeRestore::Result result;
+  if (hard) {
+    // Along with any that have changed since the last commit
+    vector<string> removedFiles;
+    vector<pair<string, FileDiff> > diffs;
+    calculateRemovalsAndDiffs(removedFiles, diffs);
+    paths.insert(removedFiles.begin(), removedFiles.end());
+    for (const pair<string, FileDiff>& diff : diffs) {
+      paths.insert(diff.first);
+    }
+
+    if (!restoreFiles(targetCommit, paths, result)) {
+      failure() << "Error! Could not read the history of the branch!" << endl;
+      return;
+    }
+    recordRestoredFiles(result);
+    addedFiles.clear();
+    addedFilesDirty = true;
+  } else {
+    CommitContents target(fileNames.at(COMMIT_DIR));
+    string root;
+    const bool haveManifest = getManifest(targetCommit, root);
+    if (!haveManifest && !target.load(targetCommit, &paths)) {
+      failure() << "Error! Could not read the history of the branch!" << endl;
+      return;
+    }
+
+    // The working copies stay as they are, so they now show up as changed
+    // from the commit. Files it doesn't have need adding again.
+    for (const string& path : paths) {
+      Manifest::Entry entry;
+      const bool inTarget = haveManifest ?
+	manifests.findFile(root, path, entry) : target.find(path) != NULL;
+      if (inTarget) {
+	if (trackedFiles.insert(path)) {
+	  watcher.watchPath(path);
+	}
+      } else if (trackedFiles.remove(path) &&
+		 FileSystemInterface::fileExists(path.c_str())) {
+	addedFiles.insert(path);
+      }
+      statCache.remove(path);
+      watcher.markChanged(path);
+    }
+    trackedFilesDirty = true;
+    addedFilesDirty = true;
+  }
+
+  tree.moveCurrentBranch(targetNode);
+  delete curCommit;
+  curCommit = new CommitHash(targetCommit);
+  curContents.reset();
+  basicInfoDirty = true;
+
+  cout << "Branch " << curBranch << " is now at commit " << targetCommit;
+  if (hard) {
+    cout << " (" << result.updatedFiles.size() << " files updated, " <<
+      result.removedFiles.size() << " removed)";
+  }
+  cout << "." << endl;
+}
+
+void OperationAccumulator::collectGarbage(unsigned int budgetMs) {
+  // The other side of a merge in progress is kept as well
+  vector<string> keep;
+  if (isMerging()) {
+    keep.push_back(mergeCommit);
+  }
+
+  GarbageCollector collector(tree, fileNames.at(COMMIT_DIR),
+			     manifests.getObjectDirectory(),
+			     fileNames.at(BLAME_DIR));
+  const bool collected = collector.run(keep, budgetMs);
+  // A directory it still has might have just been removed, and it would
+  // take its word that it's there rather than write it again
+  manifests.clearCache();
+  if (!collected) {
+    failure() << "Error! Could not read the history, so nothing was removed!" <<
+      endl;
+    return;
+  }
+
+  const GarbageCollector::Stats& stats = collector.getStats();
+  cout << stats.reachableCommits << " commits are reachable (found in " <<
+    stats.markMs << "ms). Removed " << stats.commitsRemoved << " of " <<
+    stats.unreachableCommits << " unreachable commits and " <<
+    stats.objectsRemoved << " manifest directories in " << stats.totalMs <<
+    "ms." << endl;
+  if (stats.versionsRebuilt != 0 || stats.fullCopiesReplaced != 0) {
+    cout << "  full copies written for versions stored against removed " <<
+      "commits: " << stats.versionsRebuilt << endl;
+    cout << "  full copies replaced by reverse deltas: " <<
+      stats.fullCopiesReplaced << endl;
+  }
+  if (stats.versionsUnreadable != 0) {
+    failure() << "Could not read " << stats.versionsUnreadable << " versions, " <<
+      "so the commits they're stored against were kept." << endl;
+  } else if (!stats.finished) {
+    cout << "Stopped at the time budget; run gc again to carry on." << endl;
+  }
+}
+
+void OperationAccumulator::checkIntegrity(bool redrawProgress) const {
+  // On a terminal the progress is redrawn in place; otherwise (eg. into a
+  // log) there's a line as each step finishes
+  const bool interactive = redrawProgress && isatty(STDOUT_FILENO);
+  mutex outputMutex;
+  IntegrityCheck check(tree, fileNames.at(COMMIT_DIR),
+		       manifests.getObjectDirectory(), pathFilters);
+  check.run([&](const IntegrityCheck::Progress& progress, bool finished) {
+      if (!interactive && !finished) {
+	return;
+      }
+      lock_guard<mutex> lock(outputMutex);
+      cout << (interactive ? "\r" : "") << "Checking " << progress.step <<
+	": " << progress.done << "/" << progress.total;
+      if (finished) {
+	cout << ", done." << endl;
+      } else {
+	cout << flush;
+      }
+    });
+
+  const vector<string>& problems = check.getProblems();
+  for (const string& problem : problems) {
+    cout << "  " << problem << endl;
+  }
+
+  const IntegrityCheck::Stats& stats = check.getStats();
+  cout << "Checked " << stats.commitsChecked << " commits, " <<
+    stats.directoriesChecked << " manifest directories and " <<
+    stats.versionsChecked << " file versions in " << stats.totalMs << "ms." <<
+    endl;
+  if (stats.unreachableCommits != 0) {
+    cout << stats.unreachableCommits << " commits no branch leads back to " <<
+      "are still stored; gc removes them." << endl;
+  }
+  if (problems.empty()) {
+    cout << "No problems found." << endl;
+  } else {
+    failure() << problems.size() << " problems found." << endl;
+  }
+}
+
+bool OperationAccumulator::findChangedFiles(
+    int first, int second, unordered_set<string>& files) const {
+  // Manifests only differ under directories where files do
+  string firstManifest;
+  string secondManifest;
+  vector<Manifest::Change> changes;
+  if (getManifest(getCommitAt(first), firstManifest) &&
+      getManifest(getCommitAt(second), secondManifest) &&
+      manifests.compare(firstManifest, secondManifest, changes)) {
+    for (const Manifest::Change& change : changes) {
+      files.insert(change.path);
+    }
+    return true;
+  }
+
+  // Otherwise, only files changed by commits made since the two histories
+  // forked can differ
+  const int fork = tree.findFirstParentFork(first, second);
+  return addFilesChangedSince(first, fork, files) &&
+    addFilesChangedSince(second, fork, files);
+}
+
+bool OperationAccumulator::addFilesChangedSince(
+    int node, int ancestor, unordered_set<string>& files) const {
+  for (; node != ancestor && node != Tree::NO_NODE;
+       node = tree.getParent(node)) {
+    if (tree.isBranchNode(node)) {
+      continue;
+    }
+
+    CommitInfo info;
+    if (!info.read(CommitInfo::getFileName(
+	    fileNames.at(COMMIT_DIR), to_string(tree.getCommit(node))))) {
+      return false;
+    }
+    files.insert(info.addedFiles.begin(), info.addedFiles.end());
+    files.insert(info.removedFiles.begin(), info.removedFiles.end());
+    files.insert(info.modifiedFiles.begin(), info.modifiedFiles.end());
+  }
+
+  return true;
+}
+
+bool OperationAccumulator::startWatching() {
+  if (!watcher.start()) {
+    return false;
+  }
+
+  watchTrackedAndAddedFiles();
+  return true;
+}
+
+void OperationAccumulator::stopWatching() {
+  watcher.stop();
+}
+
+void OperationAccumulator::printStats() const {
+  if (havePipelineStats) {
+    cout << "Last " << (lastPipelineWasCommit ? "commit" : "status check") <<
+      " pipeline (queue depth " << lastPipelineStats.queueDepth << "):" <<
+      endl;
+    for (const CommitPipeline::StageStats& stage : lastPipelineStats.stages) {
+      cout << "  " << stage.name << ": " << stage.itemsProcessed <<
+	" files, busy " << stage.busyMs << "ms, waiting for input " <<
+	stage.waitingForInputMs << "ms, waiting for output " <<
+	stage.waitingForOutputMs << "ms" << endl;
+    }
+    cout << "  most files queued after each stage:";
+    for (size_t highWaterMark : lastPipelineStats.queueHighWaterMarks) {
+      cout << " " << highWaterMark;
+    }
+    cout << endl;
+  }
+
+  if (haveWalkStats) {
+    // Of the commits that didn't touch the path, how many the filters let
+    // through all the same
+    const HistoryWalk::Stats& walk = lastWalkStats;
+    const size_t untouched = walk.commitsSkipped + walk.falsePositives;
+    cout << "Last log of a path read " << walk.commitsRead <<
+      " commits, and passed over " << walk.commitsSkipped <<
+      " on the word of their changed path filters" << endl;
+    cout << "  false positives: " << walk.falsePositives;
+    if (untouched != 0) {
+      cout << " (" << 100.0 * walk.falsePositives / untouched << "%)";
+    }
+    cout << ", filters made for " << 100 * getPathFilterRate() << "%" <<
+      endl;
+  }
+
+  if (haveBlameStats) {
+    cout << "Last blame read " << lastBlameStats.commitsRead <<
+      " commits and " << lastBlameStats.diffsRead << " diffs";
+    if (!lastBlameStats.cachedCommit.empty()) {
+      cout << ", then picked up the cached blame of commit " <<
+	lastBlameStats.cachedCommit;
+    }
+    cout << endl;
+  }
+
+  // Tracked and added files share their copies of the paths
+  cout << "Paths held: " << pathPool.size() << " (" << trackedFiles.size() <<
+    " tracked, " << addedFiles.size() << " added)" << endl;
+
+  if (!haveCommitStats) {
+    cout << "No commits made this session." << endl;
+    return;
+  }
+
+  const BatchFileWriter::Stats& stats = lastCommitWriteStats;
+  cout << "Last commit wrote " << stats.filesWritten << " files into " <<
+    stats.directoriesCreated << " new directories" << endl;
+  cout << "  mkdir calls: " << stats.mkdirCalls << endl;
+  cout << "  open calls:  " << stats.openCalls << endl;
+  cout << "  write calls: " << stats.writeCalls << endl;
+  cout << "  snapshots copied in the kernel: " << stats.filesCopied <<
+    " (of which reflinked: " << stats.filesCloned << ")" << endl;
+  cout << "  full copies hard linked to snapshots: " << stats.filesLinked <<
+    endl;
+}
+
+string OperationAccumulator::describeNode(int node) const {
+  const int commitNode = tree.findNearestCommit(node);
+  if (commitNode == Tree::NO_NODE) {
+    return "the start of the project (no commits)";
+  }
+
+  return "commit " + to_string(tree.getCommit(commitNode)) + " on " +
+    tree.getBranch(commitNode);
+}
+
+bool OperationAccumulator::findNodes(const string& first, const string& second,
+				     int& firstNode, int& secondNode) const {
+  firstNode = tree.findNode(first);
+  secondNode = tree.findNode(second);
+
+  if (firstNode == Tree::NO_NODE || secondNode == Tree::NO_NODE) {
+    failure() << "No branch or commit named " <<
+      (firstNode == Tree::NO_NODE ? first : second) << " found!" << endl;
+    return false;
+  }
+
+  return true;
+}
+
+void OperationAccumulator::printMergeBase(const string& first,
+					  const string& second) const {
+  int firstNode, secondNode;
+  if (!findNodes(first, second, firstNode, secondNode)) {
+    return;
+  }
+
+  size_t nodesVisited;
+  const int mergeBase = tree.findMergeBase(firstNode, secondNode,
+					   &nodesVisited);
+  if (mergeBase == Tree::NO_NODE) {
+    cout << first << " and " << second << " have no common ancestor." << endl;
+  } else {
+    cout << "Merge base of " << first << " and " << second << ": " <<
+      describeNode(mergeBase) << endl;
+  }
+  cout << "  visited " << nodesVisited << " of " << tree.getNumNodes() <<
+    " nodes" << endl;
+}
+
+void OperationAccumulator::printIsAncestor(const string& ancestor,
+					   const string& descendant) const {
+  int ancestorNode, descendantNode;
+  if (!findNodes(ancestor, descendant, ancestorNode, descendantNode)) {
+    return;
+  }
+
+  size_t nodesVisited;
+  const bool result = tree.isAncestor(ancestorNode, descendantNode,
+				      &nodesVisited);
+  cout << ancestor << (result ? " is " : " is not ") << "an ancestor of " <<
+    descendant << endl;
+  cout << "  visited " << nodesVisited << " of " << tree.getNumNodes() <<
+    " nodes" << endl;
+}
+
+void OperationAccumulator::printManifest(const string& branchOrCommit) const {
+  const int node = tree.findNode(branchOrCommit);
+  if (node == Tree::NO_NODE) {
+    failure() << "No branch or commit named " << branchOrCommit << " found!" <<
+      endl;
+    return;
+  }
+
+  // Everything in a manifest is new compared to no files at all
+  string root;
+  vector<Manifest::Change> files;
+  if (!getManifest(getCommitAt(node), root)) {
+    cout << describeNode(node) << " has no manifest." << endl;
+    return;
+  }
+  if (!manifests.compare("", root, files)) {
+    failure() << "Error! Could not read the manifest of " << branchOrCommit <<
+      "!" << endl;
+    return;
+  }
+
+  cout << "Manifest " << (root.empty() ? "(empty)" : root) << " of " <<
+    describeNode(node) << ", " << files.size() << " files:" << endl;
+  for (const Manifest::Change& file : files) {
+    Manifest::Entry entry;
+    manifests.findFile(root, file.path, entry);
+    cout << "  " << entry.hash << " " << file.path << " (from commit " <<
+      entry.commit << ")" << endl;
+  }
+}
+
+void OperationAccumulator::printPathFilters() const {
+  const ChangedPathFilters::Summary summary = pathFilters.summarize();
+  const size_t numCommits = initialCommitPerformed ?
+    atoi(CommitHash::getLatestGeneratedHash().toString().c_str()) + 1 : 0;
+
+  cout << "Changed path filters for " << summary.commitsWithFilters <<
+    " of " << numCommits << " commits" << endl;
+  cout << "  too many paths changed to keep one: " <<
+    summary.commitsTooLarge << endl;
+  if (summary.pathsAdded != 0) {
+    cout << "  bits per path: " <<
+      (double) summary.bitsUsed / summary.pathsAdded << endl;
+  }
+  cout << "  new filters are made for a false positive rate of " <<
+    100 * getPathFilterRate() << "%" << endl;
+}
+
+void OperationAccumulator::printSetting(const string& name) const {
+  if (!name.empty() && name != PATH_FILTER_RATE && name != STORAGE) {
+    failure() << "No setting named " << name << "!" << endl;
+    return;
+  }
+
+  if (name.empty() || name == PATH_FILTER_RATE) {
+    cout << PATH_FILTER_RATE << "=" << getPathFilterRate() << endl;
+  }
+  if (name.empty() || name == STORAGE) {
+    cout << STORAGE << "=" <<
+      (usesReverseDeltas() ? REVERSE_STORAGE : FORWARD_STORAGE) << endl;
+  }
+}
+
+void OperationAccumulator::changeSetting(const string& name,
+					 const string& value) {
+  if (name == STORAGE) {
+    if (value != FORWARD_STORAGE && value != REVERSE_STORAGE) {
+      cout << "Storage is either " << FORWARD_STORAGE << " or " <<
+	REVERSE_STORAGE << "." << endl;
+      return;
+    }
+
+    config.set(name, value);
+    if (value == REVERSE_STORAGE) {
+      cout << "Commits from now on keep each file they change whole, and " <<
+	"the versions before as reverse deltas." << endl;
+    } else {
+      cout << "Commits from now on only keep diffs against the versions " <<
+	"before." << endl;
+    }
+    return;
+  }
+
+  if (name != PATH_FILTER_RATE) {
+    failure() << "No setting named " << name << "!" << endl;
+    return;
+  }
+
+  double rate;
+  if (!parseFalsePositiveRate(value, rate)) {
+    failure() << "The false positive rate must be between 0 and 1." << endl;
+    return;
+  }
+
+  config.set(name, value);
+  cout << "Commits from now on get filters with a false positive rate of " <<
+    100 * rate << "%." << endl;
+}
+
+void OperationAccumulator::readMergeState() {
+  if (!FileSystemInterface::fileExists(fileNames.at(FileName::MERGE_FILE))) {
+    return;
+  }
+
+  // mergeBranch=<branch>
+  // mergeCommit=<their commit>
+  // conflicts [n]
+  // <n unresolved files>
+  vector<string> lines;
+  FileParser::readFile(fileNames.at(FileName::MERGE_FILE), lines);
+
+  size_t numConflicts;
+  if (lines.size() < 3 || lines[0].find("mergeBranch=") != 0 ||
+      lines[1].find("mergeCommit=") != 0 ||
+      sscanf(lines[2].c_str(), "conflicts [%zu]", &numConflicts) != 1 ||
+      lines.size() != 3 + numConflicts) {
+    cout << "Error! Merge state tampered with, ignoring it." << endl;
+    return;
+  }
+
+  mergeBranch = lines[0].substr(12);
+  mergeCommit = lines[1].substr(12);
+  unresolvedConflicts.assign(lines.begin() + 3, lines.end());
+}
+
+void OperationAccumulator::outputMergeState() const {
+  if (!isMerging()) {
+    remove(fileNames.at(FileName::MERGE_FILE));
+    return;
+  }
+
+  vector<string> lines;
+  lines.push_back("mergeBranch=" + mergeBranch);
+  lines.push_back("mergeCommit=" + mergeCommit);
+  lines.push_back("conflicts [" + to_string(unresolvedConflicts.size()) +
+		  "]");
+  lines.insert(lines.end(), unresolvedConflicts.begin(),
+	       unresolvedConflicts.end());
+  FileWriter::writeFile(fileNames.at(FileName::MERGE_FILE), lines);
+}
+
+bool OperationAccumulator::isMerging() const {
+  return !mergeCommit.empty();
+}
+
+bool OperationAccumulator::hasUnresolvedConflicts() const {
+  return !unresolvedConflicts.empty();
+}
+
+void OperationAccumulator::merge(const string& branchName) {
+  if (isMerging()) {
+    failure() << "Please finish the merge in progress first!" << endl;
+    return;
+  }
+
+  if (branchName == curBranch) {
+    failure() << "Cannot merge a branch into itself!" << endl;
+    return;
+  }
+
+  const int theirTip = tree.getBranchTip(branchName);
+  if (theirTip == Tree::NO_NODE) {
+    failure() << "No branch named " << branchName << " found!" << endl;
+    return;
+  }
+
+  if (!cleanState()) {
+    failure() << "Please commit changes before merging!" << endl;
+    return;
+  }
+
+  const int theirNode = tree.findNearestCommit(theirTip);
+  if (theirNode == Tree::NO_NODE ||
+      tree.isAncestor(theirNode, tree.getCurrentNode())) {
+    cout << "Already up to date with " << branchName << "." << endl;
+    return;
+  }
+
+  const int baseNode = tree.findNearestCommit(
+      tree.findMergeBase(tree.getCurrentNode(), theirNode));
+  const string baseCommit = baseNode == Tree::NO_NODE ?
+    CommitHash::getNullHash() : to_string(tree.getCommit(baseNode));
+  const string theirCommit = to_string(tree.getCommit(theirNode));
+
+  CommitContents base(fileNames.at(COMMIT_DIR));
+  CommitContents theirs(fileNames.at(COMMIT_DIR));
+  const CommitContents * ours = getCurrentContents();
+  if (ours == NULL || !base.load(baseCommit) || !theirs.load(theirCommit)) {
+    failure() << "Error! Could not read the history of the branches!" << endl;
+    return;
+  }
+
+  TreeMerge::Result result;
+  TreeMerge(base, *ours, theirs, curBranch, branchName).run(result);
+
+  // Files that couldn't be merged are left for the user to sort out, like
+  // any other conflict
+  vector<string> conflictedFiles = result.conflictedFiles;
+  for (const string& file : result.failedFiles) {
+    failure() << "Could not merge file " << file << "!" << endl;
+    conflictedFiles.push_back(file);
+  }
+  for (const string& file : result.conflictedFiles) {
+    cout << "Conflict in file " << file << endl;
+  }
+
+  finishMerge(branchName, theirCommit, result.newFiles, conflictedFiles);
+}
+
+void OperationAccumulator::finishMerge(const string& theirBranch,
+				       const string& theirCommit,
+				       const vector<string>& newFiles,
+				       const vector<string>& conflictedFiles) {
+  mergeBranch = theirBranch;
+  mergeCommit = theirCommit;
+  unresolvedConflicts = conflictedFiles;
+  mergeStateDirty = true;
+
+  // Files only they had become ours with the merge commit
+  for (const string& file : newFiles) {
+    if (addedFiles.insert(file)) {
+      watcher.watchPath(file);
+    }
+  }
+  addedFilesDirty = addedFilesDirty || !newFiles.empty();
+
+  if (!unresolvedConflicts.empty()) {
+    cout << "Merge stopped with " << unresolvedConflicts.size() <<
+      " conflicted files. Resolve them, then commit to finish the merge." <<
+      endl;
+    return;
+  }
+
+  commit("Merged branch " + theirBranch + " into " + curBranch, true);
+}
+
+void OperationAccumulator::listConflicts() const {
+  if (!isMerging()) {
+    cout << "No merge in progress." << endl;
+    return;
+  }
+
+  if (unresolvedConflicts.empty()) {
+    cout << "All conflicts merging " << mergeBranch <<
+      " are resolved. Commit to finish the merge." << endl;
+    return;
+  }
+
+  cout << "Unresolved conflicts merging " << mergeBranch << ":" << endl;
+  for (const string& file : unresolvedConflicts) {
+    cout << "  " << file << endl;
+  }
+}
+
+void OperationAccumulator::resolve(const string& fileName) {
+  if (!isMerging()) {
+    cout << "No merge in progress." << endl;
+    return;
+  }
+
+  bool found = false;
+  vector<string> stillConflicted;
+  for (const string& file : unresolvedConflicts) {
+    if (!fileName.empty() && file != fileName) {
+      stillConflicted.push_back(file);
+      continue;
+    }
+    found = true;
+
+    // Deleting the file is a resolution too
+    vector<string> lines;
+    FileParser::readFile(file.c_str(), lines);
+    if (ThreeWayMerge::hasConflictMarkers(lines)) {
+      failure() << "File " << file << " still has conflict markers!" << endl;
+      stillConflicted.push_back(file);
+      continue;
+    }
+
+    cout << "Resolved file " << file << endl;
+  }
+
+  if (!found && !fileName.empty()) {
+    failure() << "File " << fileName << " has no unresolved conflicts!" << endl;
+    return;
+  }
+
+  if (stillConflicted.size() != unresolvedConflicts.size()) {
+    unresolvedConflicts.swap(stillConflicted);
+    mergeStateDirty = true;
+  }
+
+  if (unresolvedConflicts.empty()) {
+    cout << "All conflicts resolved. Commit to finish the merge." << endl;
+  }
 }
@@ -0,0 +1,30 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "ParallelRunner.h"
+
+using namespace std;
+
+void ParallelRunner::forEach(size_t numItems,
+			     const function<void(size_t)>& work) {
+  atomic<size_t> nextItem(0);
+  auto worker = [numItems, &work, &nextItem]() {
+    for (size_t i = nextItem++; i < numItems; i = nextItem++) {
+      work(i);
+    }
+  };
+
+  // The calling thread is one of the workers
+  const size_t numThreads =
+    min<size_t>(max(thread::hardware_concurrency(), 1u), numItems);
+  vector<thread> threads;
+  for (size_t i = 1; i < numThreads; ++i) {
+    threads.push_back(thread(worker));
+  }
+  worker();
+  for (thread& workerThread : threads) {
+    workerThread.join();
+  }
+}
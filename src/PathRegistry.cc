@@ -0,0 +1,99 @@
+#include "PathRegistry.h"
+
+using namespace std;
+
+const string * PathPool::intern(const string& path) {
+  // The keys of an unordered_map stay put as it grows
+  unordered_map<string, size_t>::iterator it =
+    paths.insert(make_pair(path, 0)).first;
+  ++it->second;
+  return &it->first;
+}
+
+void PathPool::release(const string * path) {
+  unordered_map<string, size_t>::iterator it = paths.find(*path);
+  if (--it->second == 0) {
+    paths.erase(it);
+  }
+}
+
+size_t PathPool::size() const {
+  return paths.size();
+}
+
+PathRegistry::PathRegistry(PathPool& pool) : pool(pool) {}
+
+bool PathRegistry::contains(const string& path) const {
+  return positions.count(&path) != 0;
+}
+
+bool PathRegistry::insert(const string& path) {
+  if (contains(path)) {
+    return false;
+  }
+
+  const string * internedPath = pool.intern(path);
+  positions[internedPath] = orderedPaths.size();
+  orderedPaths.push_back(internedPath);
+  return true;
+}
+
+bool PathRegistry::remove(const string& path) {
+  unordered_map<const string *, size_t, PathHash, PathEqual>::iterator it =
+    positions.find(&path);
+  if (it == positions.end()) {
+    return false;
+  }
+
+  // path may be the pooled copy itself, so it goes last
+  const string * internedPath = it->first;
+  orderedPaths[it->second] = NULL;
+  positions.erase(it);
+
+  // Don't let the holes outnumber the paths
+  if (orderedPaths.size() > 2 * positions.size() + 16) {
+    compact();
+  }
+
+  pool.release(internedPath);
+  return true;
+}
+
+void PathRegistry::compact() {
+  size_t nextPosition = 0;
+  for (const string * path : orderedPaths) {
+    if (path != NULL) {
+      positions[path] = nextPosition;
+      orderedPaths[nextPosition] = path;
+      ++nextPosition;
+    }
+  }
+
+  orderedPaths.resize(nextPosition);
+}
+
+void PathRegistry::clear() {
+  for (const string * path : orderedPaths) {
+    if (path != NULL) {
+      pool.release(path);
+    }
+  }
+  orderedPaths.clear();
+  positions.clear();
+}
+
+size_t PathRegistry::size() const {
+  return positions.size();
+}
+
+bool PathRegistry::empty() const {
+  return positions.empty();
+}
+
+PathRegistry::const_iterator PathRegistry::begin() const {
+  return const_iterator(orderedPaths.begin(), orderedPaths.end());
+}
+
+PathRegistry::const_iterator PathRegistry::end() const {
+  return const_iterator(orderedPaths.end(), orderedPaths.end());
+}
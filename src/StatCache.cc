@@ -0,0 +1,197 @@
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+
+#include "StatCache.h"
+
+using namespace std;
+
+// How recently a file must have been modified, at the time we stat it, for its
+// entry to be treated as racily clean. This comfortably covers the timestamp
+// granularity of the filesystems we care about.
+static const long long RACY_WINDOW_NS = 1000000000LL;
+
+StatCache::StatCache() : dirty(false) {}
+
+long long StatCache::getMtimeNs(const struct stat& info) {
+  return (long long) info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+}
+
+static long long getCurrentTimeNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+StatCache::Entry StatCache::makeEntry(const struct stat& info,
+				      const string& hash) {
+  Entry entry;
+  entry.size = info.st_size;
+  entry.mtimeNs = getMtimeNs(info);
+  entry.inode = info.st_ino;
+  entry.hash = hash;
+
+  if (entry.mtimeNs >= getCurrentTimeNs() - RACY_WINDOW_NS) {
+    // Too fresh to vouch for the contents; force a re-hash next time
+    entry.size = -1;
+  }
+
+  return entry;
+}
+
+// Each line of the index is
+//   <size> <mtimeNs> <inode> <hash> <path>
+// with the path last, since it may contain spaces
+bool StatCache::read(const char * fileName) {
+  ifstream input(fileName);
+  if (!input) {
+    return false;
+  }
+
+  // Only replace what we have once the whole index has parsed
+  unordered_map<string, Entry> readEntries;
+
+  string line;
+  while (getline(input, line)) {
+    const char * cursor = line.c_str();
+    char * end;
+
+    Entry entry;
+    entry.size = strtoll(cursor, &end, 10);
+    if (end == cursor || *end != ' ') {
+      return false;
+    }
+    cursor = end + 1;
+
+    entry.mtimeNs = strtoll(cursor, &end, 10);
+    if (end == cursor || *end != ' ') {
+      return false;
+    }
+    cursor = end + 1;
+
+    entry.inode = strtoull(cursor, &end, 10);
+    if (end == cursor || *end != ' ') {
+      return false;
+    }
+    cursor = end + 1;
+
+    const char * hashEnd = cursor;
+    while (*hashEnd != ' ' && *hashEnd != '\0') {
+      ++hashEnd;
+    }
+    if (hashEnd == cursor || *hashEnd != ' ' || *(hashEnd + 1) == '\0') {
+      return false;
+    }
+
+    entry.hash.assign(cursor, hashEnd);
+    readEntries[string(hashEnd + 1)] = entry;
+  }
+
+  entries.swap(readEntries);
+  dirty = false;
+  return true;
+}
+
+bool StatCache::write(const char * fileName) {
+  // Write to the side and rename into place, so an interrupted write can't
+  // leave a truncated index behind
+  const string tempFileName = string(fileName) + ".tmp";
+
+  ofstream output(tempFileName.c_str(), fstream::out | fstream::trunc);
+  if (!output) {
+    return false;
+  }
+
+  for (const pair<const string, Entry>& pathAndEntry : entries) {
+    const Entry& entry = pathAndEntry.second;
+    output << entry.size << " " << entry.mtimeNs << " " << entry.inode << " "
+	   << entry.hash << " " << pathAndEntry.first << "\n";
+  }
+
+  output.close();
+  if (!output || rename(tempFileName.c_str(), fileName) != 0) {
+    return false;
+  }
+
+  dirty = false;
+  return true;
+}
+
+bool StatCache::isDirty() const {
+  return dirty;
+}
+
+const StatCache::Entry * StatCache::find(const string& path) const {
+  unordered_map<string, Entry>::const_iterator it = entries.find(path);
+  if (it == entries.end()) {
+    return NULL;
+  }
+
+  return &(it->second);
+}
+
+const StatCache::Entry * StatCache::findStaged(const string& path) const {
+  unordered_map<string, Entry>::const_iterator it = stagedEntries.find(path);
+  if (it == stagedEntries.end()) {
+    return NULL;
+  }
+
+  return &(it->second);
+}
+
+bool StatCache::isUnchanged(const string& path,
+			    const struct stat& info) const {
+  const Entry * entry = find(path);
+  if (entry == NULL || entry->size < 0) {
+    return false;
+  }
+
+  return entry->size == info.st_size && entry->mtimeNs == getMtimeNs(info) &&
+    entry->inode == info.st_ino;
+}
+
+static bool sameEntry(const StatCache::Entry& first,
+		      const StatCache::Entry& second) {
+  return first.size == second.size && first.mtimeNs == second.mtimeNs &&
+    first.inode == second.inode && first.hash == second.hash;
+}
+
+void StatCache::record(const string& path, const struct stat& info,
+		       const string& hash) {
+  const Entry entry = makeEntry(info, hash);
+  unordered_map<string, Entry>::iterator it = entries.find(path);
+  if (it != entries.end() && sameEntry(it->second, entry)) {
+    return;
+  }
+
+  entries[path] = entry;
+  dirty = true;
+}
+
+void StatCache::stage(const string& path, const struct stat& info,
+		      const string& hash) {
+  stagedEntries[path] = makeEntry(info, hash);
+}
+
+void StatCache::applyStaged() {
+  for (const pair<const string, Entry>& pathAndEntry : stagedEntries) {
+    entries[pathAndEntry.first] = pathAndEntry.second;
+  }
+
+  if (!stagedEntries.empty()) {
+    dirty = true;
+  }
+  stagedEntries.clear();
+}
+
+void StatCache::clearStaged() {
+  stagedEntries.clear();
+}
+
+void StatCache::remove(const string& path) {
+  if (entries.erase(path) != 0) {
+    dirty = true;
+  }
+  stagedEntries.erase(path);
+}
@@ -0,0 +1,138 @@
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FileSystemInterface.h"
+#include "ParallelRunner.h"
+#include "StoreLinker.h"
+
+using namespace std;
+
+StoreLinker::StoreLinker() :
+  filesLinked(0), filesCloned(0), filesCopied(0), directoriesCreated(0) {
+}
+
+bool StoreLinker::collect(const string& source, const string& destination,
+			  const string& relativePath, vector<string>& files) {
+  const string sourcePath =
+    FileSystemInterface::appendPath(source, relativePath);
+  const string destinationPath =
+    FileSystemInterface::appendPath(destination, relativePath);
+  if (FileSystemInterface::createDirectory(destinationPath.c_str()) != 0) {
+    return false;
+  }
+  ++directoriesCreated;
+
+  DIR * directory = opendir(sourcePath.c_str());
+  if (directory == NULL) {
+    return false;
+  }
+
+  // Only the directories have to be made as we go; the files are linked
+  // afterwards, all together
+  vector<string> subdirectories;
+  struct dirent * entry;
+  while ((entry = readdir(directory)) != NULL) {
+    const string name = entry->d_name;
+    if (name == "." || name == "..") {
+      continue;
+    }
+
+    const string path = FileSystemInterface::appendPath(relativePath, name);
+    bool isDirectory = entry->d_type == DT_DIR;
+    if (entry->d_type == DT_UNKNOWN) {
+      // Not every file system fills the type in
+      struct stat info;
+      isDirectory = lstat(FileSystemInterface::appendPath(source, path).c_str(),
+			  &info) == 0 && S_ISDIR(info.st_mode);
+    }
+
+    if (isDirectory) {
+      subdirectories.push_back(path);
+    } else {
+      files.push_back(path);
+    }
+  }
+  closedir(directory);
+
+  for (const string& subdirectory : subdirectories) {
+    if (!collect(source, destination, subdirectory, files)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool StoreLinker::linkDirectory(const string& sourceDirectory,
+				const string& destinationDirectory) {
+  vector<string> files;
+  if (!collect(sourceDirectory, destinationDirectory, "", files)) {
+    return false;
+  }
+
+  atomic<bool> failed(false);
+  ParallelRunner::forEach(files.size(), [&](size_t i) {
+      if (failed) {
+	return;
+      }
+
+      const string source =
+	FileSystemInterface::appendPath(sourceDirectory, files[i]);
+      const string destination =
+	FileSystemInterface::appendPath(destinationDirectory, files[i]);
+      if (link(source.c_str(), destination.c_str()) == 0) {
+	++filesLinked;
+	return;
+      }
+
+      // Eg. across file systems, or on one without hard links
+      if (!copyFile(source, destination)) {
+	failed = true;
+      }
+    });
+  return !failed;
+}
+
+bool StoreLinker::copyFile(const string& source, const string& destination,
+			   bool& cloned) {
+  int sourceFd = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+  if (sourceFd == -1) {
+    return false;
+  }
+
+  int destinationFd = open(destination.c_str(),
+			   O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (destinationFd == -1) {
+    close(sourceFd);
+    return false;
+  }
+
+  bool copied = FileSystemInterface::copyFileContents(sourceFd, destinationFd,
+						      cloned);
+  close(sourceFd);
+  close(destinationFd);
+  return copied;
+}
+
+bool StoreLinker::copyFile(const string& source, const string& destination) {
+  bool cloned;
+  if (!copyFile(source, destination, cloned)) {
+    return false;
+  }
+
+  ++filesCopied;
+  if (cloned) {
+    ++filesCloned;
+  }
+  return true;
+}
+
+StoreLinker::Stats StoreLinker::getStats() const {
+  Stats stats;
+  stats.directoriesCreated = directoriesCreated;
+  stats.filesLinked = filesLinked;
+  stats.filesCloned = filesCloned;
+  stats.filesCopied = filesCopied;
+  return stats;
+}
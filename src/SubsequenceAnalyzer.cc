@@ -1,129 +1,81 @@
-#include "DiffApplier.h"
+#include <algorithm>
+
 #include "DiffBuilder.h"
 #include "DiffElement.h"
 #include "SubsequenceAnalyzer.h"
 
 using namespace std;
 
-static void getDeltas(const vector<Line>& subsequence,
-		      const vector<Line>& alternateString,
-		      DiffBuilder& builder, ElementType type) {
-    vector<Line>::const_iterator altIt = alternateString.begin();
-    vector<Line>::const_iterator subsequenceIt = subsequence.begin();
-
-    // Everything contained in newString but not in subsequence is an inserted
-    // line
-    while (subsequenceIt != subsequence.end()) {
-      if ((*subsequenceIt).equals(*altIt)) {
-          ++subsequenceIt;
-          ++altIt;
-      } else {
-          if (type == INSERTION) {
-	    builder.registerInsertedLine(subsequenceIt->getNumber(),
-					 altIt->getString());
-          } else {
-            builder.registerDeletedLine(altIt->getNumber(), altIt->getString());
-          }
-          ++altIt;
-      }
+// Lines the two files share at the start and end can't be part of any change,
+// so only the lines between them go into the table. Besides saving time, this
+// keeps the table small when a large file has only had a few lines changed.
+static void trimCommonLines(const vector<Line>& s, const vector<Line>& t,
+			    size_t& prefix, size_t& suffix) {
+    prefix = 0;
+    while (prefix < s.size() && prefix < t.size() &&
+	   s[prefix].equals(t[prefix])) {
+        ++prefix;
     }
-    
-    while (altIt != alternateString.end()) {
-      if (type == INSERTION) {
-	unsigned int index = 0;
-	if (subsequence.size() != 0) {
-	  if (subsequenceIt == subsequence.end()) {
-	    --subsequenceIt;
-	  }
-	  index = subsequenceIt->getNumber();
-	}
-	builder.registerInsertedLine(index, altIt->getString());
-      } else {
-        builder.registerDeletedLine(altIt->getNumber(), altIt->getString());
-      }
-      ++altIt;
+
+    suffix = 0;
+    while (suffix < s.size() - prefix && suffix < t.size() - prefix &&
+	   s[s.size() - 1 - suffix].equals(t[t.size() - 1 - suffix])) {
+        ++suffix;
     }
 }
 
-static FileDiff getSubsequence(int ** grid, const vector<Line>& s,
-			       const vector<Line>& t,
-			       vector<Line>& subsequence) {
-    int sLen = s.size();
-    int tLen = t.size();
+FileDiff SubsequenceAnalyzer::calculateDiff(const vector<Line>& s,
+					    const vector<Line>& t) {
+    size_t prefix, suffix;
+    trimCommonLines(s, t, prefix, suffix);
+
+    const size_t sLen = s.size() - prefix - suffix;
+    const size_t tLen = t.size() - prefix - suffix;
+
+    // grid[i][j] is the length of the longest common subsequence of the
+    // remaining lines t[i..] and s[j..]
+    const size_t width = sLen + 1;
+    vector<unsigned int> grid((tLen + 1) * width, 0);
+
+    for (size_t i = tLen; i-- > 0;) {
+        for (size_t j = sLen; j-- > 0;) {
+            if (t[prefix + i].equals(s[prefix + j])) {
+                grid[i * width + j] = grid[(i + 1) * width + j + 1] + 1;
+            } else {
+                grid[i * width + j] = max(grid[(i + 1) * width + j],
+					  grid[i * width + j + 1]);
+            }
+        }
+    }
 
-    int i = 0;
-    int j = 0;
+    // Walk the table, recording each line of t that isn't part of the
+    // subsequence as inserted before the line of s we've got up to, and each
+    // line of s that isn't as deleted
+    DiffBuilder builder;
+    size_t i = 0;
+    size_t j = 0;
 
     while (i < tLen && j < sLen) {
-        if (s[j].equals(t[i])) {
-            subsequence.push_back(s[j]);
+        if (s[prefix + j].equals(t[prefix + i])) {
             ++i;
             ++j;
-        } else if (grid[i + 1][j] >= grid[i][j+1]) {
+        } else if (grid[(i + 1) * width + j] >= grid[i * width + j + 1]) {
+            builder.registerInsertedLine(prefix + j,
+					 t[prefix + i].getString());
             ++i;
         } else {
+            builder.registerDeletedLine(prefix + j, s[prefix + j].getString());
             ++j;
         }
     }
 
-    DiffBuilder builder;
-    
-    getDeltas(subsequence, t, builder, INSERTION);
-    getDeltas(subsequence, s, builder, DELETION);
-
-    FileDiff d = builder.build();    
-    return d;
-}
-
-static FileDiff subsequenceLength(const vector<Line>& s, const vector<Line>& t,
-				  vector<Line>& subsequence) {
-    int sLen = s.size();
-    int tLen = t.size();
-
-    int ** grid = new int * [tLen + 1];
-
-    for (int i = 0; i <= tLen; ++i) {
-        grid[i] = new int[sLen + 1];
+    for (; i < tLen; ++i) {
+        builder.registerInsertedLine(prefix + sLen, t[prefix + i].getString());
     }
 
-    for (int i = 0; i <= tLen; ++i) {
-        for (int j = 0; j <= sLen; ++j) {
-            grid[i][j] = 7;
-        }
+    for (; j < sLen; ++j) {
+        builder.registerDeletedLine(prefix + j, s[prefix + j].getString());
     }
 
-    for (int i = 0; i <= tLen; ++i) {
-        grid[i][sLen] = 0;
-    }
-
-    for (int j = 0; j <= sLen; ++j) {
-        grid[tLen][j] = 0;
-    }
-
-    for (int i = tLen - 1; i >= 0; --i) {
-        for (int j = sLen - 1; j >= 0; --j) {
-            if (t[i].equals(s[j])) {
-                grid[i][j] = grid[i + 1][j + 1] + 1;
-            } else {
-                grid[i][j] = max(grid[i + 1][j], grid[i][j + 1]);
-            }
-        }
-    }
-    
-    FileDiff result = getSubsequence(grid, s, t, subsequence);
-    
-    for (int i = 0; i <= tLen; ++i) {
-        delete[] grid[i];
-    }
-
-    delete[] grid;
-
-    return result;
-}
-
-FileDiff SubsequenceAnalyzer::calculateDiff(const vector<Line>& s,
-					    const vector<Line>& t) {
-    vector<Line> subsequence;
-    FileDiff d = subsequenceLength(s, t, subsequence);
-    return d;
+    return builder.build();
 }
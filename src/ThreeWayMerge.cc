@@ -0,0 +1,200 @@
+#include "SubsequenceAnalyzer.h"
+#include "ThreeWayMerge.h"
+
+using namespace std;
+
+static const string OURS_MARKER = "<<<<<<<";
+static const string SEPARATOR_MARKER = "=======";
+static const string THEIRS_MARKER = ">>>>>>>";
+
+void ThreeWayMerge::getHunks(const FileDiff& diff, vector<Hunk>& hunks) {
+  // Deletions and insertions are each in base order. Deleted lines and the
+  // insertions made before, within or straight after them form one hunk.
+  const vector<DiffElement>& deletions = diff.getDeletions();
+  const vector<DiffElement>& insertions = diff.getInsertions();
+  size_t nextDeletion = 0;
+  size_t nextInsertion = 0;
+
+  while (nextDeletion < deletions.size() ||
+	 nextInsertion < insertions.size()) {
+    Hunk hunk;
+    if (nextDeletion < deletions.size() &&
+	(nextInsertion == insertions.size() ||
+	 deletions[nextDeletion].getBaseStartingLine() <
+	 insertions[nextInsertion].getBaseStartingLine())) {
+      hunk.baseStart = deletions[nextDeletion].getBaseStartingLine();
+    } else {
+      hunk.baseStart = insertions[nextInsertion].getBaseStartingLine();
+    }
+    hunk.baseEnd = hunk.baseStart;
+
+    while (true) {
+      if (nextInsertion < insertions.size() &&
+	  insertions[nextInsertion].getBaseStartingLine() == hunk.baseEnd) {
+	const vector<string>& lines = insertions[nextInsertion].getLines();
+	hunk.lines.insert(hunk.lines.end(), lines.begin(), lines.end());
+	++nextInsertion;
+      } else if (nextDeletion < deletions.size() &&
+		 deletions[nextDeletion].getBaseStartingLine() ==
+		 hunk.baseEnd) {
+	hunk.baseEnd += deletions[nextDeletion].getNumLines();
+	++nextDeletion;
+      } else {
+	break;
+      }
+    }
+
+    hunks.push_back(hunk);
+  }
+}
+
+// Whether changes to the two ranges of the base can't both be made. Two
+// insertions at the same place conflict, as there's no telling which should
+// go first, but an insertion only conflicts with a replacement if it's
+// strictly inside it.
+bool ThreeWayMerge::overlap(unsigned int firstStart, unsigned int firstEnd,
+			    unsigned int secondStart, unsigned int secondEnd) {
+  if (firstStart == firstEnd && secondStart == secondEnd) {
+    return firstStart == secondStart;
+  }
+
+  if (firstStart == firstEnd) {
+    return secondStart < firstStart && firstStart < secondEnd;
+  }
+
+  if (secondStart == secondEnd) {
+    return firstStart < secondStart && secondStart < firstEnd;
+  }
+
+  return firstStart < secondEnd && secondStart < firstEnd;
+}
+
+// The base lines [start, end) with hunks [firstHunk, lastHunk) of one side,
+// all of which lie within them, applied
+void ThreeWayMerge::applyHunks(const vector<Line>& base, unsigned int start,
+			       unsigned int end, const vector<Hunk>& hunks,
+			       size_t firstHunk, size_t lastHunk,
+			       vector<string>& lines) {
+  unsigned int baseLine = start;
+  for (size_t i = firstHunk; i < lastHunk; ++i) {
+    for (; baseLine < hunks[i].baseStart; ++baseLine) {
+      lines.push_back(base[baseLine].getString());
+    }
+    lines.insert(lines.end(), hunks[i].lines.begin(), hunks[i].lines.end());
+    baseLine = hunks[i].baseEnd;
+  }
+
+  for (; baseLine < end; ++baseLine) {
+    lines.push_back(base[baseLine].getString());
+  }
+}
+
+size_t ThreeWayMerge::merge(const vector<Line>& base,
+			    const vector<Line>& ours,
+			    const vector<Line>& theirs,
+			    const string& ourLabel, const string& theirLabel,
+			    vector<string>& merged) {
+  vector<Hunk> ourHunks;
+  vector<Hunk> theirHunks;
+  getHunks(SubsequenceAnalyzer::calculateDiff(base, ours), ourHunks);
+  getHunks(SubsequenceAnalyzer::calculateDiff(base, theirs), theirHunks);
+
+  // One pass over both sides' hunks in base order. A hunk that overlaps
+  // nothing on the other side is copied in; otherwise it starts a conflict
+  // region, which grows until no more hunks from either side overlap it.
+  size_t conflicts = 0;
+  unsigned int baseLine = 0;
+  size_t nextOurs = 0;
+  size_t nextTheirs = 0;
+
+  while (nextOurs < ourHunks.size() || nextTheirs < theirHunks.size()) {
+    // Take whichever hunk comes first, insertions before replacements
+    // starting at the same line
+    bool takeOurs = nextTheirs == theirHunks.size();
+    if (!takeOurs && nextOurs < ourHunks.size()) {
+      const Hunk& our = ourHunks[nextOurs];
+      const Hunk& their = theirHunks[nextTheirs];
+      takeOurs = our.baseStart < their.baseStart ||
+	(our.baseStart == their.baseStart && our.baseStart == our.baseEnd);
+    }
+
+    const Hunk& first = takeOurs ? ourHunks[nextOurs] : theirHunks[nextTheirs];
+    unsigned int start = first.baseStart;
+    unsigned int end = first.baseEnd;
+    const size_t firstOurs = nextOurs;
+    const size_t firstTheirs = nextTheirs;
+    (takeOurs ? nextOurs : nextTheirs)++;
+
+    bool grew = true;
+    while (grew) {
+      grew = false;
+      if (nextOurs < ourHunks.size() &&
+	  overlap(start, end, ourHunks[nextOurs].baseStart,
+		  ourHunks[nextOurs].baseEnd)) {
+	end = max(end, ourHunks[nextOurs].baseEnd);
+	++nextOurs;
+	grew = true;
+      }
+      if (nextTheirs < theirHunks.size() &&
+	  overlap(start, end, theirHunks[nextTheirs].baseStart,
+		  theirHunks[nextTheirs].baseEnd)) {
+	end = max(end, theirHunks[nextTheirs].baseEnd);
+	++nextTheirs;
+	grew = true;
+      }
+    }
+
+    for (; baseLine < start; ++baseLine) {
+      merged.push_back(base[baseLine].getString());
+    }
+    baseLine = end;
+
+    const bool oursChanged = nextOurs != firstOurs;
+    const bool theirsChanged = nextTheirs != firstTheirs;
+    if (!oursChanged || !theirsChanged) {
+      // Only one side touched these lines
+      const vector<Hunk>& hunks = oursChanged ? ourHunks : theirHunks;
+      applyHunks(base, start, end, hunks,
+		 oursChanged ? firstOurs : firstTheirs,
+		 oursChanged ? nextOurs : nextTheirs, merged);
+      continue;
+    }
+
+    vector<string> ourLines;
+    vector<string> theirLines;
+    applyHunks(base, start, end, ourHunks, firstOurs, nextOurs, ourLines);
+    applyHunks(base, start, end, theirHunks, firstTheirs, nextTheirs,
+	       theirLines);
+
+    if (ourLines == theirLines) {
+      // Both sides made the same change
+      merged.insert(merged.end(), ourLines.begin(), ourLines.end());
+      continue;
+    }
+
+    ++conflicts;
+    merged.push_back(OURS_MARKER + " " + ourLabel);
+    merged.insert(merged.end(), ourLines.begin(), ourLines.end());
+    merged.push_back(SEPARATOR_MARKER);
+    merged.insert(merged.end(), theirLines.begin(), theirLines.end());
+    merged.push_back(THEIRS_MARKER + " " + theirLabel);
+  }
+
+  for (; baseLine < base.size(); ++baseLine) {
+    merged.push_back(base[baseLine].getString());
+  }
+
+  return conflicts;
+}
+
+bool ThreeWayMerge::hasConflictMarkers(const vector<string>& lines) {
+  for (const string& line : lines) {
+    if (line.compare(0, OURS_MARKER.size(), OURS_MARKER) == 0 ||
+	line == SEPARATOR_MARKER ||
+	line.compare(0, THEIRS_MARKER.size(), THEIRS_MARKER) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -1,118 +1,450 @@
+#include <algorithm>
 #include <assert.h>
-#include <iostream>
+#include <cstdlib>
+#include <fstream>
 #include <queue>
+#include <unordered_set>
+#include <utility>
 
-#include "CommitNode.h"
+#include "FileSystemInterface.h"
 #include "Tree.h"
 
 using namespace std;
 
-Tree::Tree() : root(NULL), curNode(NULL) {}
+const int Tree::NO_NODE;
+const int Tree::NO_COMMIT;
 
-Tree::~Tree() {
-  delete root;
+Tree::Tree() : nodes("KILNODES", 2), nodesByCommit("KILCMTIX", 1),
+	       branchTips("KILTIPS", 1), numSavedBranches(0),
+	       curNode(NO_NODE) {}
+
+unsigned int Tree::getBranchId(const string& branch) {
+  unordered_map<string, unsigned int>::const_iterator it =
+    branchIdsByName.find(branch);
+  if (it != branchIdsByName.end()) {
+    return it->second;
+  }
+
+  const unsigned int branchId = branchNames.size();
+  branchNames.push_back(branch);
+  branchIdsByName[branch] = branchId;
+  branchTips.append(NO_NODE);
+  return branchId;
+}
+
+int Tree::addNode(unsigned int branchId, int commit, int parent) {
+  const int node = nodes.size();
+
+  Node newNode;
+  newNode.parent = parent;
+  newNode.firstChild = NO_NODE;
+  newNode.lastChild = NO_NODE;
+  newNode.nextSibling = NO_NODE;
+  newNode.branchId = branchId;
+  newNode.commit = commit;
+  newNode.mergeParent = NO_NODE;
+  newNode.generation = 1;
+
+  if (parent != NO_NODE) {
+    newNode.generation = nodes.get(parent).generation + 1;
+  }
+  nodes.append(newNode);
+
+  if (parent != NO_NODE) {
+    Node parentNode = nodes.get(parent);
+    if (parentNode.lastChild == NO_NODE) {
+      parentNode.firstChild = node;
+    } else {
+      Node lastChild = nodes.get(parentNode.lastChild);
+      lastChild.nextSibling = node;
+      nodes.set(parentNode.lastChild, lastChild);
+    }
+    parentNode.lastChild = node;
+    nodes.set(parent, parentNode);
+  }
+
+  branchTips.set(branchId, node);
+  if (commit != NO_COMMIT) {
+    while (nodesByCommit.size() <= (size_t) commit) {
+      nodesByCommit.append(NO_NODE);
+    }
+    nodesByCommit.set(commit, node);
+  }
+
+  return node;
 }
 
 void Tree::initialize(const string& firstBranch) {
-  root = new TreeNode(firstBranch);
-  curNode = root;
+  curNode = addNode(getBranchId(firstBranch), NO_COMMIT, NO_NODE);
 }
 
 void Tree::registerNewBranch(const string& newBranch) {
-  assert(curNode != NULL);
-  TreeNode * newBranchNode = new TreeNode(newBranch);
-  curNode->registerChild(newBranchNode);
-  curNode = newBranchNode;
+  assert(curNode != NO_NODE);
+  // Reusing an existing branch's id would move its tip, losing its commits
+  assert(branchIdsByName.count(newBranch) == 0);
+  curNode = addNode(getBranchId(newBranch), NO_COMMIT, curNode);
 }
 
-void Tree::addCommit(const CommitHash& commit) {
-  assert(curNode != NULL);
-  CommitNode * newCommitNode = new CommitNode(curNode->getBranch(), commit);
-  curNode->registerChild(newCommitNode);
-  curNode = newCommitNode;
+bool Tree::switchToBranch(const string& branch) {
+  const int node = getBranchTip(branch);
+  if (!isValidNode(node)) {
+    return false;
+  }
+
+  curNode = node;
+  return true;
 }
 
-void Tree::getPrintableTree(vector<string>& lines) const {
-  // breadth first representation of a tree
-  assert(root != NULL);
+void Tree::moveCurrentBranch(int node) {
+  assert(curNode != NO_NODE);
+  const unsigned int branchId = nodes.get(curNode).branchId;
+  if (nodes.get(node).branchId != branchId) {
+    curNode = addNode(branchId, NO_COMMIT, node);
+    return;
+  }
 
-  queue<TreeNode*> nodesToProcess;
-  nodesToProcess.push(root);
+  curNode = node;
+  branchTips.set(branchId, node);
+}
 
-  while (!nodesToProcess.empty()) {
-    // look at the node in the front, and push back all of its children
-    TreeNode * node = nodesToProcess.front();
+void Tree::addCommit(const CommitHash& commit, int mergeParent) {
+  assert(curNode != NO_NODE);
+  curNode = addNode(nodes.get(curNode).branchId,
+		    atoi(commit.toString().c_str()), curNode);
 
-    for (TreeNode * childNode : node->getChildren()) {
-      nodesToProcess.push(childNode);
-    }
-    
-    lines.push_back(node->toString());
-    nodesToProcess.pop();
+  if (mergeParent != NO_NODE) {
+    Node node = nodes.get(curNode);
+    node.mergeParent = mergeParent;
+    node.generation = max(node.generation,
+			  nodes.get(mergeParent).generation + 1);
+    nodes.set(curNode, node);
   }
 }
 
+bool Tree::hasUnsavedChanges() const {
+  return nodes.hasUnsavedChanges() || nodesByCommit.hasUnsavedChanges() ||
+    branchTips.hasUnsavedChanges() || numSavedBranches < branchNames.size();
+}
+
+void Tree::getBranchListWrites(const char * fileName,
+			       vector<WriteJournal::Write>& writes) const {
+  if (numSavedBranches == branchNames.size()) {
+    return;
+  }
+
+  // Appended to what's there already
+  struct stat info;
+  WriteJournal::Write write;
+  write.fileName = fileName;
+  write.offset = FileSystemInterface::getFileInfo(fileName, info) ?
+    info.st_size : 0;
+  for (size_t i = numSavedBranches; i < branchNames.size(); ++i) {
+    write.data += branchNames[i] + "\n";
+  }
+  writes.push_back(write);
+}
+
+bool Tree::save(const Files& files) {
+  // Otherwise stopping part way could leave, say, a node on disk that the
+  // commit index or its branch's tip don't know about
+  vector<WriteJournal::Write> writes;
+  getBranchListWrites(files.branchList, writes);
+  nodes.getUnsavedWrites(files.nodes, writes);
+  nodesByCommit.getUnsavedWrites(files.commitIndex, writes);
+  branchTips.getUnsavedWrites(files.branchTips, writes);
+  if (!WriteJournal::apply(files.journal, writes)) {
+    return false;
+  }
+
+  numSavedBranches = branchNames.size();
+  nodes.markSaved();
+  nodesByCommit.markSaved();
+  branchTips.markSaved();
+  return true;
+}
+
+int Tree::findCommit(const string& commit) const {
+  char * end;
+  long commitId = strtol(commit.c_str(), &end, 10);
+  if (commit.empty() || *end != '\0' || commitId < 0 ||
+      (size_t) commitId >= nodesByCommit.size()) {
+    return NO_NODE;
+  }
+
+  return nodesByCommit.get(commitId);
+}
+
+int Tree::getBranchTip(const string& branch) const {
+  unordered_map<string, unsigned int>::const_iterator it =
+    branchIdsByName.find(branch);
+  return it == branchIdsByName.end() ? NO_NODE : branchTips.get(it->second);
+}
+
+const vector<string>& Tree::getBranchNames() const {
+  return branchNames;
+}
+
+// Indices read from disk aren't trusted until they've been looked at
+bool Tree::isValidNode(int node) const {
+  return node >= 0 && (size_t) node < nodes.size() &&
+    nodes.get(node).branchId < branchNames.size();
+}
+
 bool Tree::determineCurrentNode(const string& branch, const string& commit) {
-  queue<TreeNode*> nodes;
-  nodes.push(root);
-
-  while (!nodes.empty()) {
-    TreeNode * node = nodes.front();
-    if (node->isNewBranchNode()) {
-      if (node->getBranch() == branch) {
-	curNode = node;
-	return true;
-      }
-    } else if (node->getBranch() == branch &&
-	       node->getCommitString() == commit) {
-      curNode = node;
-      return true;
-    }
+  // We're either on a commit made on this branch, or on a branch with no
+  // commits of its own yet, in which case we're on its branch node
+  int node = findCommit(commit);
+  if (!isValidNode(node) || getBranch(node) != branch) {
+    node = getBranchTip(branch);
+  }
 
-    for (TreeNode * childNode : node->getChildren()) {
-      nodes.push(childNode);
+  if (!isValidNode(node)) {
+    return false;
+  }
+
+  curNode = node;
+  return true;
+}
+
+bool Tree::readBranchList(const char * fileName) {
+  ifstream input(fileName);
+  if (!input) {
+    return false;
+  }
+
+  string branch;
+  while (getline(input, branch)) {
+    if (branch.empty() || branchIdsByName.count(branch) != 0) {
+      return false;
     }
+    branchIdsByName[branch] = branchNames.size();
+    branchNames.push_back(branch);
+  }
 
-    nodes.pop();
+  numSavedBranches = branchNames.size();
+  return true;
+}
+
+bool Tree::load(const Files& files, const string& branch,
+		const string& commit) {
+  if (!WriteJournal::replay(files.journal) ||
+      !readBranchList(files.branchList) || !nodes.open(files.nodes) ||
+      !nodesByCommit.open(files.commitIndex) ||
+      !branchTips.open(files.branchTips)) {
+    return false;
+  }
+
+  // Nothing else is checked up front, as that would mean visiting every
+  // node; these are just the sizes the files have to agree on
+  if (nodes.size() == 0 || branchTips.size() != branchNames.size()) {
+    return false;
   }
 
-  return false;
+  return determineCurrentNode(branch, commit);
 }
 
-bool Tree::initializeTree(const vector<string>& lines,
-			  const string& branch, const string& commit) {
-  queue<TreeNode*> processingNodeQueue;
-  queue<TreeNode*> relationshipNodeQueue;
-  
-  // Read the info in into two queues
-  for (const string& line : lines) {
-    TreeNode * node = TreeNode::createTreeNodeFromString(line);
-    if (node == NULL) {
-      return false;
+int Tree::findNode(const string& branchOrCommit) const {
+  const int node = getBranchTip(branchOrCommit);
+  if (node != NO_NODE) {
+    return node;
+  }
+
+  const int commitNode = findCommit(branchOrCommit);
+  return isValidNode(commitNode) ? commitNode : NO_NODE;
+}
+
+int Tree::findNearestCommit(int node) const {
+  // Branch nodes are only ever first-parent links in a chain, so there's no
+  // need to look at merge parents here
+  while (node != NO_NODE && isBranchNode(node)) {
+    node = getParent(node);
+  }
+  return node;
+}
+
+void Tree::getParents(int node, int parents[2]) const {
+  const Node& record = nodes.get(node);
+  parents[0] = record.parent;
+  parents[1] = record.mergeParent;
+}
+
+namespace {
+  // Which of the two starting nodes a node has been reached from
+  enum Reach {
+    FROM_FIRST = 1,
+    FROM_SECOND = 2,
+    FROM_BOTH = FROM_FIRST | FROM_SECOND
+  };
+
+  typedef pair<unsigned int, int> QueuedNode;
+}
+
+int Tree::findMergeBase(int first, int second, size_t * nodesVisited) const {
+  // Nodes come off the queue youngest generation first, so by the time one
+  // does, every path down to it from either starting node has already been
+  // followed. The first one reached from both is then a common ancestor
+  // with no other common ancestor below it.
+  priority_queue<QueuedNode> queue;
+  unordered_map<int, unsigned char> reached;
+
+  reached[first] |= FROM_FIRST;
+  reached[second] |= FROM_SECOND;
+  queue.push(QueuedNode(getGeneration(first), first));
+  if (second != first) {
+    queue.push(QueuedNode(getGeneration(second), second));
+  }
+
+  size_t visited = 0;
+  int mergeBase = NO_NODE;
+  while (!queue.empty()) {
+    const int node = queue.top().second;
+    queue.pop();
+    ++visited;
+
+    const unsigned char reach = reached[node];
+    if (reach == FROM_BOTH) {
+      mergeBase = node;
+      break;
     }
 
-    processingNodeQueue.push(node);
-    relationshipNodeQueue.push(node);
+    int parents[2];
+    getParents(node, parents);
+    for (int parent : parents) {
+      if (parent == NO_NODE) {
+	continue;
+      }
+
+      unordered_map<int, unsigned char>::iterator it = reached.find(parent);
+      if (it == reached.end()) {
+	reached[parent] = reach;
+	queue.push(QueuedNode(getGeneration(parent), parent));
+      } else {
+	it->second |= reach;
+      }
+    }
   }
 
-  relationshipNodeQueue.pop();
+  if (nodesVisited != NULL) {
+    *nodesVisited = visited;
+  }
+  return mergeBase;
+}
 
-  root = processingNodeQueue.front();
+bool Tree::isAncestor(int ancestor, int node, size_t * nodesVisited) const {
+  // Anything with a generation at or below the ancestor's can't lead back
+  // to it, other than the ancestor itself
+  const unsigned int targetGeneration = getGeneration(ancestor);
 
-  // Now, iterate through the processing queue
-  // Get numChildren for that node
-  // And take that many from the relationship queue to be its children
-  while (!processingNodeQueue.empty()) {
-    TreeNode * node = processingNodeQueue.front();
+  priority_queue<QueuedNode> queue;
+  unordered_set<int> queued;
+  queue.push(QueuedNode(getGeneration(node), node));
+  queued.insert(node);
 
-    size_t numChildren = node->getNumChildren();
-    for (size_t i = 0; i < numChildren; ++i) {
-      node->registerChild(relationshipNodeQueue.front());
-      relationshipNodeQueue.pop();
+  size_t visited = 0;
+  bool found = false;
+  while (!queue.empty()) {
+    const int current = queue.top().second;
+    queue.pop();
+    ++visited;
+
+    if (current == ancestor) {
+      found = true;
+      break;
     }
 
-    processingNodeQueue.pop();
+    int parents[2];
+    getParents(current, parents);
+    for (int parent : parents) {
+      if (parent != NO_NODE && getGeneration(parent) >= targetGeneration &&
+	  queued.insert(parent).second) {
+	queue.push(QueuedNode(getGeneration(parent), parent));
+      }
+    }
   }
 
-  return determineCurrentNode(branch, commit);
+  if (nodesVisited != NULL) {
+    *nodesVisited = visited;
+  }
+  return found;
+}
+
+vector<bool> Tree::findReachable(const vector<int>& extraNodes) const {
+  vector<int> toVisit = extraNodes;
+  for (size_t branchId = 0; branchId < branchNames.size(); ++branchId) {
+    toVisit.push_back(branchTips.get(branchId));
+  }
+
+  vector<bool> reachable(getNumNodes(), false);
+  while (!toVisit.empty()) {
+    const int node = toVisit.back();
+    toVisit.pop_back();
+    if (!isValidNode(node) || reachable[node]) {
+      continue;
+    }
+    reachable[node] = true;
+
+    int parents[2];
+    getParents(node, parents);
+    toVisit.push_back(parents[0]);
+    toVisit.push_back(parents[1]);
+  }
+  return reachable;
+}
+
+size_t Tree::getNumNodes() const {
+  return nodes.size();
+}
+
+int Tree::findFirstParentFork(int first, int second) const {
+  // First parents alone form a tree. Generations increase along every parent
+  // link, so the older of two different nodes can't be below the younger
+  // one, and stepping the younger one up never walks past the fork.
+  while (first != second && first != NO_NODE && second != NO_NODE) {
+    const unsigned int firstGeneration = getGeneration(first);
+    const unsigned int secondGeneration = getGeneration(second);
+    if (firstGeneration >= secondGeneration) {
+      first = getParent(first);
+    }
+    if (secondGeneration >= firstGeneration) {
+      second = getParent(second);
+    }
+  }
+
+  return first == second ? first : NO_NODE;
+}
+
+int Tree::getCurrentNode() const {
+  return curNode;
+}
+
+int Tree::getParent(int node) const {
+  return nodes.get(node).parent;
+}
+
+int Tree::getFirstChild(int node) const {
+  return nodes.get(node).firstChild;
+}
+
+int Tree::getNextSibling(int node) const {
+  return nodes.get(node).nextSibling;
+}
+
+const string& Tree::getBranch(int node) const {
+  return branchNames[nodes.get(node).branchId];
+}
+
+bool Tree::isBranchNode(int node) const {
+  return nodes.get(node).commit == NO_COMMIT;
+}
+
+int Tree::getCommit(int node) const {
+  return nodes.get(node).commit;
+}
+
+int Tree::getMergeParent(int node) const {
+  return nodes.get(node).mergeParent;
+}
+
+unsigned int Tree::getGeneration(int node) const {
+  return nodes.get(node).generation;
 }
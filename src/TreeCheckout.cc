@@ -0,0 +1,46 @@
+#include <algorithm>
+
+#include "TreeCheckout.h"
+
+using namespace std;
+
+TreeCheckout::TreeCheckout(const CommitContents& current,
+			   const CommitContents& target,
+			   const StatCache& statCache) :
+  current(current), target(target), statCache(statCache) {}
+
+void TreeCheckout::planFiles(vector<TreeRestore::File>& files) const {
+  for (const auto& file : target.getFiles()) {
+    const CommitContents::FileVersion * currentVersion =
+      current.find(file.first);
+    if (currentVersion == NULL || *currentVersion != file.second) {
+      TreeRestore::File restore;
+      restore.path = file.first;
+      restore.remove = false;
+      files.push_back(restore);
+    }
+  }
+
+  for (const auto& file : current.getFiles()) {
+    if (target.find(file.first) == NULL) {
+      TreeRestore::File restore;
+      restore.path = file.first;
+      restore.remove = true;
+      files.push_back(restore);
+    }
+  }
+
+  sort(files.begin(), files.end(),
+       [](const TreeRestore::File& first, const TreeRestore::File& second) {
+	 return first.path < second.path;
+       });
+}
+
+void TreeCheckout::run(Result& result) const {
+  vector<TreeRestore::File> files;
+  planFiles(files);
+
+  TreeRestore([this](const string& path, vector<Line>& lines) {
+      return target.readFile(path, lines);
+    }, statCache).run(files, result);
+}
@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cstdio>
+#include <unordered_set>
+
+#include "FileParser.h"
+#include "FileWriter.h"
+#include "ParallelRunner.h"
+#include "ThreeWayMerge.h"
+#include "TreeMerge.h"
+
+using namespace std;
+
+TreeMerge::TreeMerge(const CommitContents& base, const CommitContents& ours,
+		     const CommitContents& theirs, const string& ourLabel,
+		     const string& theirLabel) :
+  base(base), ours(ours), theirs(theirs), ourLabel(ourLabel),
+  theirLabel(theirLabel) {}
+
+static bool sameVersion(const CommitContents::FileVersion * first,
+			const CommitContents::FileVersion * second) {
+  if (first == NULL || second == NULL) {
+    return first == second;
+  }
+  return *first == *second;
+}
+
+void TreeMerge::planJobs(vector<Job>& jobs) const {
+  unordered_set<string> paths;
+  for (const CommitContents * contents : { &base, &ours, &theirs }) {
+    for (const auto& file : contents->getFiles()) {
+      paths.insert(file.first);
+    }
+  }
+
+  for (const string& path : paths) {
+    const CommitContents::FileVersion * baseVersion = base.find(path);
+    const CommitContents::FileVersion * ourVersion = ours.find(path);
+    const CommitContents::FileVersion * theirVersion = theirs.find(path);
+
+    // Either nobody changed it, both made the same change, or only we did
+    if (sameVersion(ourVersion, theirVersion) ||
+	sameVersion(theirVersion, baseVersion)) {
+      continue;
+    }
+
+    Job job;
+    job.path = path;
+    job.oursHasFile = ourVersion != NULL;
+    job.outcome = DONE;
+
+    if (sameVersion(ourVersion, baseVersion)) {
+      job.action = theirVersion == NULL ? REMOVE : TAKE_THEIRS;
+    } else if (ourVersion == NULL) {
+      // Added by them, or deleted by us and changed by them
+      job.action = baseVersion == NULL ? TAKE_THEIRS : TAKE_THEIRS_CONFLICT;
+    } else if (theirVersion == NULL) {
+      job.action = KEEP_OURS_CONFLICT;
+    } else {
+      // Changed by both, or added by both
+      job.action = MERGE;
+    }
+
+    jobs.push_back(job);
+  }
+
+  // Report files in a predictable order
+  sort(jobs.begin(), jobs.end(), [](const Job& first, const Job& second) {
+      return first.path < second.path;
+    });
+}
+
+static vector<string> toStrings(const vector<Line>& lines) {
+  vector<string> strings;
+  strings.reserve(lines.size());
+  for (const Line& line : lines) {
+    strings.push_back(line.getString());
+  }
+  return strings;
+}
+
+void TreeMerge::runJob(Job& job) const {
+  switch (job.action) {
+  case KEEP_OURS_CONFLICT:
+    job.outcome = CONFLICTED;
+    return;
+  case REMOVE:
+    job.outcome = remove(job.path.c_str()) == 0 ? DONE : FAILED;
+    return;
+  default:
+    break;
+  }
+
+  vector<Line> theirLines;
+  if (!theirs.readFile(job.path, theirLines)) {
+    job.outcome = FAILED;
+    return;
+  }
+
+  if (job.action != MERGE) {
+    job.outcome = FileWriter::replaceFile(job.path, toStrings(theirLines)) ?
+      (job.action == TAKE_THEIRS_CONFLICT ? CONFLICTED : DONE) : FAILED;
+    return;
+  }
+
+  // Our version is the one in the working directory; files both sides added
+  // independently are merged as if from an empty base
+  vector<Line> baseLines;
+  vector<Line> ourLines;
+  if (base.find(job.path) != NULL && !base.readFile(job.path, baseLines)) {
+    job.outcome = FAILED;
+    return;
+  }
+  FileParser::readFile(job.path.c_str(), ourLines);
+
+  vector<string> merged;
+  const size_t conflicts = ThreeWayMerge::merge(baseLines, ourLines,
+						theirLines, ourLabel,
+						theirLabel, merged);
+  if (!FileWriter::replaceFile(job.path, merged)) {
+    job.outcome = FAILED;
+  } else {
+    job.outcome = conflicts == 0 ? DONE : CONFLICTED;
+  }
+}
+
+void TreeMerge::run(Result& result) const {
+  vector<Job> jobs;
+  planJobs(jobs);
+
+  ParallelRunner::forEach(jobs.size(), [this, &jobs](size_t i) {
+      runJob(jobs[i]);
+    });
+
+  for (const Job& job : jobs) {
+    if (job.outcome == FAILED) {
+      result.failedFiles.push_back(job.path);
+      continue;
+    }
+
+    if (job.action == REMOVE) {
+      result.removedFiles.push_back(job.path);
+    } else if (job.action != KEEP_OURS_CONFLICT) {
+      result.updatedFiles.push_back(job.path);
+      if (!job.oursHasFile) {
+	result.newFiles.push_back(job.path);
+      }
+    }
+
+    if (job.outcome == CONFLICTED) {
+      result.conflictedFiles.push_back(job.path);
+    }
+  }
+}
@@ -0,0 +1,119 @@
+#include <cstdio>
+
+#include "ContentHash.h"
+#include "FileSystemInterface.h"
+#include "FileWriter.h"
+#include "ParallelRunner.h"
+#include "TreeRestore.h"
+
+using namespace std;
+
+TreeRestore::TreeRestore(
+    function<bool(const string&, vector<Line>&)> readVersion,
+    const StatCache& statCache) :
+  readVersion(readVersion), statCache(statCache) {}
+
+bool TreeRestore::isAlreadyWritten(const string& path,
+				   const string& hash) const {
+  const StatCache::Entry * entry = statCache.find(path);
+  struct stat info;
+  return entry != NULL && entry->hash == hash &&
+    FileSystemInterface::getFileInfo(path.c_str(), info) &&
+    statCache.isUnchanged(path, info);
+}
+
+void TreeRestore::runJob(Job& job) const {
+  const File& wanted = *job.wanted;
+  job.file.path = wanted.path;
+
+  if (wanted.remove) {
+    // Already gone is as good as removed
+    if (remove(wanted.path.c_str()) != 0 &&
+	FileSystemInterface::fileExists(wanted.path.c_str())) {
+      job.outcome = FAILED;
+      return;
+    }
+    FileSystemInterface::removeEmptyDirectories(wanted.path);
+    job.outcome = REMOVED;
+    return;
+  }
+
+  if (!wanted.hash.empty()) {
+    if (isAlreadyWritten(wanted.path, wanted.hash)) {
+      job.outcome = ALREADY_UP_TO_DATE;
+      return;
+    }
+
+    // Hashing the file is cheaper than rebuilding the version to compare
+    if (FileSystemInterface::getFileInfo(wanted.path.c_str(),
+					 job.file.info) &&
+	ContentHash::ofFile(wanted.path.c_str(), job.file.hash) &&
+	job.file.hash == wanted.hash) {
+      job.outcome = VERIFIED;
+      return;
+    }
+  }
+
+  vector<Line> lines;
+  if (!readVersion(wanted.path, lines)) {
+    job.outcome = FAILED;
+    return;
+  }
+
+  job.file.hash = ContentHash::ofLines(lines);
+  if (!wanted.hash.empty() && job.file.hash != wanted.hash) {
+    // The version didn't come out as recorded
+    job.outcome = FAILED;
+    return;
+  }
+  // Versions built differently can still have the same contents, eg. a file
+  // both branches made the same change to
+  if (wanted.hash.empty() && isAlreadyWritten(wanted.path, job.file.hash)) {
+    job.outcome = ALREADY_UP_TO_DATE;
+    return;
+  }
+
+  vector<string> strings;
+  strings.reserve(lines.size());
+  for (const Line& line : lines) {
+    strings.push_back(line.getString());
+  }
+
+  if (!FileWriter::replaceFile(wanted.path, strings) ||
+      !FileSystemInterface::getFileInfo(wanted.path.c_str(),
+					job.file.info)) {
+    job.outcome = FAILED;
+    return;
+  }
+  job.outcome = WRITTEN;
+}
+
+void TreeRestore::run(const vector<File>& files, Result& result) const {
+  vector<Job> jobs(files.size());
+  for (size_t i = 0; i < files.size(); ++i) {
+    jobs[i].wanted = &files[i];
+  }
+
+  ParallelRunner::forEach(jobs.size(), [this, &jobs](size_t i) {
+      runJob(jobs[i]);
+    });
+
+  for (const Job& job : jobs) {
+    switch (job.outcome) {
+    case WRITTEN:
+      result.updatedFiles.push_back(job.file);
+      break;
+    case VERIFIED:
+      result.verifiedFiles.push_back(job.file);
+      break;
+    case REMOVED:
+      result.removedFiles.push_back(job.file.path);
+      break;
+    case ALREADY_UP_TO_DATE:
+      break;
+    case FAILED:
+      result.failedFiles.push_back(job.file.path);
+      break;
+    }
+  }
+}
@@ -0,0 +1,164 @@
+#include <algorithm>
+
+#include "UnifiedDiff.h"
+
+using namespace std;
+
+namespace {
+  struct Operation {
+    // ' ', '-' or '+'
+    char type;
+    const string * text;
+  };
+
+  // How a hunk's range is written; an empty range is given by the line
+  // before it
+  string describeRange(size_t firstLine, size_t numLines) {
+    return to_string(numLines == 0 ? firstLine : firstLine + 1) + "," +
+      to_string(numLines);
+  }
+}
+
+void UnifiedDiff::printHeader(ostream& output, const string& path,
+			      bool oldExists, bool newExists) {
+  output << "diff --kil a/" << path << " b/" << path << "\n";
+  output << "--- " << (oldExists ? "a/" + path : "/dev/null") << "\n";
+  output << "+++ " << (newExists ? "b/" + path : "/dev/null") << "\n";
+}
+
+void UnifiedDiff::print(ostream& output, const string& path,
+			const vector<Line>& oldFile, const FileDiff& diff) {
+  // The old file's lines, with the deleted ones marked and the inserted ones
+  // placed before the line they're numbered with
+  vector<string> oldLines;
+  oldLines.reserve(oldFile.size());
+  for (const Line& line : oldFile) {
+    oldLines.push_back(line.getString());
+  }
+
+  const vector<DiffElement>& insertions = diff.getInsertions();
+  const vector<DiffElement>& deletions = diff.getDeletions();
+  size_t nextInsertion = 0;
+  size_t nextDeletion = 0;
+  vector<Operation> operations;
+  for (size_t lineNumber = 0; lineNumber <= oldLines.size(); ++lineNumber) {
+    for (; nextInsertion < insertions.size() &&
+	   insertions[nextInsertion].getBaseStartingLine() == lineNumber;
+	 ++nextInsertion) {
+      for (const string& line : insertions[nextInsertion].getLines()) {
+	Operation operation = { '+', &line };
+	operations.push_back(operation);
+      }
+    }
+
+    if (lineNumber == oldLines.size()) {
+      break;
+    }
+
+    Operation operation = { ' ', &oldLines[lineNumber] };
+    if (nextDeletion < deletions.size() &&
+	deletions[nextDeletion].getBaseStartingLine() <= lineNumber) {
+      operation.type = '-';
+      const DiffElement& deletion = deletions[nextDeletion];
+      if (lineNumber + 1 ==
+	  deletion.getBaseStartingLine() + deletion.getNumLines()) {
+	++nextDeletion;
+      }
+    }
+    operations.push_back(operation);
+  }
+
+  // Deletions are listed before the insertions that replace them
+  for (size_t i = 0; i < operations.size(); ) {
+    size_t end = i;
+    while (end < operations.size() && operations[end].type != ' ') {
+      ++end;
+    }
+    stable_partition(operations.begin() + i, operations.begin() + end,
+		     [](const Operation& operation) {
+		       return operation.type == '-';
+		     });
+    i = end + 1;
+  }
+
+  // Changes closer together than twice the context share a hunk
+  size_t oldLine = 0;
+  size_t newLine = 0;
+  size_t i = 0;
+  bool printedHeader = false;
+  while (i < operations.size()) {
+    if (operations[i].type == ' ') {
+      ++oldLine;
+      ++newLine;
+      ++i;
+      continue;
+    }
+
+    size_t start = i;
+    size_t context = 0;
+    while (start > 0 && context < CONTEXT_LINES) {
+      --start;
+      ++context;
+    }
+
+    size_t end = i;
+    size_t unchangedRun = 0;
+    while (end < operations.size() &&
+	   unchangedRun <= 2 * CONTEXT_LINES) {
+      unchangedRun = operations[end].type == ' ' ? unchangedRun + 1 : 0;
+      ++end;
+    }
+    // Leave at most the trailing context
+    if (unchangedRun > CONTEXT_LINES) {
+      end -= unchangedRun - CONTEXT_LINES;
+    }
+
+    size_t numOld = 0;
+    size_t numNew = 0;
+    for (size_t j = start; j < end; ++j) {
+      numOld += operations[j].type != '+';
+      numNew += operations[j].type != '-';
+    }
+
+    if (!printedHeader) {
+      printHeader(output, path, true, true);
+      printedHeader = true;
+    }
+    output << "@@ -" << describeRange(oldLine - context, numOld) << " +" <<
+      describeRange(newLine - context, numNew) << " @@\n";
+    for (size_t j = start; j < end; ++j) {
+      output << operations[j].type << *operations[j].text << "\n";
+    }
+
+    for (; i < end; ++i) {
+      oldLine += operations[i].type != '+';
+      newLine += operations[i].type != '-';
+    }
+  }
+}
+
+void UnifiedDiff::printAdded(ostream& output, const string& path,
+			     const vector<Line>& newFile) {
+  printHeader(output, path, false, true);
+  if (newFile.empty()) {
+    return;
+  }
+
+  output << "@@ -0,0 +1," << newFile.size() << " @@\n";
+  for (const Line& line : newFile) {
+    output << "+" << line.getString() << "\n";
+  }
+}
+
+void UnifiedDiff::printRemoved(ostream& output, const string& path,
+			       const vector<Line>& oldFile) {
+  printHeader(output, path, true, false);
+  if (oldFile.empty()) {
+    return;
+  }
+
+  output << "@@ -1," << oldFile.size() << " +0,0 @@\n";
+  for (const Line& line : oldFile) {
+    output << "-" << line.getString() << "\n";
+  }
+}
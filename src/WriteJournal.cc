@@ -0,0 +1,173 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "WriteJournal.h"
+
+using namespace std;
+
+// The journal is a magic number, then each write as
+//   <name length (32 bits)><name><offset (64 bits)><length (64 bits)><data>
+// then a zero name length and a hash of everything before it, which is only
+// there if the journal was written in full.
+namespace {
+  const char MAGIC[8] = { 'K', 'I', 'L', 'J', 'R', 'N', 'L', '1' };
+
+  // 64-bit FNV-1a
+  uint64_t hashOf(const char * data, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i) {
+      hash ^= (unsigned char) data[i];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  template <typename Number>
+  void appendNumber(string& output, Number number) {
+    output.append((const char *) &number, sizeof(number));
+  }
+
+  template <typename Number>
+  bool readNumber(const string& input, size_t& position, Number& number) {
+    if (input.size() - position < sizeof(number)) {
+      return false;
+    }
+    memcpy(&number, input.data() + position, sizeof(number));
+    position += sizeof(number);
+    return true;
+  }
+
+  bool writeAll(int fd, const char * data, size_t length, off_t offset) {
+    while (length > 0) {
+      ssize_t written = pwrite(fd, data, length, offset);
+      if (written <= 0) {
+	return false;
+      }
+      data += written;
+      length -= written;
+      offset += written;
+    }
+    return true;
+  }
+
+  // The writes in a journal, false if it wasn't written in full
+  bool parseJournal(const string& journal,
+		    vector<WriteJournal::Write>& writes) {
+    if (journal.compare(0, sizeof(MAGIC), MAGIC, sizeof(MAGIC)) != 0) {
+      return false;
+    }
+
+    size_t position = sizeof(MAGIC);
+    for (;;) {
+      uint32_t nameLength;
+      if (!readNumber(journal, position, nameLength)) {
+	return false;
+      }
+      if (nameLength == 0) {
+	break;
+      }
+
+      WriteJournal::Write write;
+      uint64_t offset;
+      uint64_t length;
+      if (journal.size() - position < nameLength) {
+	return false;
+      }
+      write.fileName = journal.substr(position, nameLength);
+      position += nameLength;
+      if (!readNumber(journal, position, offset) ||
+	  !readNumber(journal, position, length) ||
+	  journal.size() - position < length) {
+	return false;
+      }
+      write.offset = offset;
+      write.data = journal.substr(position, length);
+      position += length;
+      writes.push_back(write);
+    }
+
+    const size_t hashedLength = position;
+    uint64_t hash;
+    return readNumber(journal, position, hash) &&
+      position == journal.size() &&
+      hash == hashOf(journal.data(), hashedLength);
+  }
+}
+
+bool WriteJournal::write(const vector<Write>& writes) {
+  for (const Write& write : writes) {
+    int fd = open(write.fileName.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC,
+		  0644);
+    if (fd == -1) {
+      return false;
+    }
+
+    const bool written = writeAll(fd, write.data.data(), write.data.size(),
+				  write.offset);
+    close(fd);
+    if (!written) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool WriteJournal::apply(const char * journalFile,
+			 const vector<Write>& writes) {
+  if (writes.empty()) {
+    return true;
+  }
+
+  string journal(MAGIC, sizeof(MAGIC));
+  for (const Write& write : writes) {
+    appendNumber(journal, (uint32_t) write.fileName.size());
+    journal += write.fileName;
+    appendNumber(journal, (uint64_t) write.offset);
+    appendNumber(journal, (uint64_t) write.data.size());
+    journal += write.data;
+  }
+  appendNumber(journal, (uint32_t) 0);
+  appendNumber(journal, hashOf(journal.data(), journal.size()));
+
+  ofstream output(journalFile, ofstream::binary | ofstream::trunc);
+  output.write(journal.data(), journal.size());
+  output.close();
+  if (!output) {
+    remove(journalFile);
+    return false;
+  }
+
+  if (!write(writes)) {
+    return false;
+  }
+
+  remove(journalFile);
+  return true;
+}
+
+bool WriteJournal::replay(const char * journalFile) {
+  ifstream input(journalFile, ifstream::binary);
+  if (!input) {
+    return true;
+  }
+
+  ostringstream contents;
+  contents << input.rdbuf();
+  input.close();
+
+  // One cut short was never acted on
+  vector<Write> writes;
+  if (parseJournal(contents.str(), writes) && !write(writes)) {
+    return false;
+  }
+
+  remove(journalFile);
+  return true;
+}
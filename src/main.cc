@@ -1,14 +1,118 @@
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include "CommandServer.h"
 #include "Interpretor.h"
 #include "OperationAccumulator.h"
 
-int main() {
+using namespace std;
+
+static void printUsage() {
+  cerr << "Usage: vcs                     (commands from stdin, with prompts)\n"
+    "       vcs [--json] <command> [arguments]\n"
+    "       vcs [--json] --batch [file]   (a command per line; stdin if no "
+    "file or -)\n"
+    "       vcs --serve [idle seconds]    (keeps the project loaded for the "
+    "above)" << endl;
+}
+
+// The arguments as the interpretor would have read them. The shell has
+// taken off the quotes, so arguments with spaces in them get them back, as
+// does a commit message, which is always quoted.
+static string buildCommand(int argc, char * argv[], int first) {
+  const bool isCommit = strcmp(argv[first], "commit") == 0;
+  string command;
+  for (int i = first; i < argc; ++i) {
+    const string arg = argv[i];
+    if (i != first) {
+      command += ' ';
+    }
+    if ((arg.find_first_of(" \t") != string::npos ||
+	 (isCommit && i != first && arg != "-a")) && arg[0] != '"') {
+      command += '"' + arg + '"';
+    } else {
+      command += arg;
+    }
+  }
+  return command;
+}
+
+int main(int argc, char * argv[]) {
   OperationAccumulator accumulator;
-  if (!accumulator.initialize()) {
+  if (argc == 1) {
+    if (!accumulator.initialize()) {
+      return 1;
+    }
+
+    Interpretor interpretor(accumulator);
+    interpretor.interpret();
+    accumulator.saveState();
+    return 0;
+  }
+
+  if (strcmp(argv[1], "--serve") == 0) {
+    unsigned int idleSeconds = CommandServer::DEFAULT_IDLE_SECONDS;
+    if (argc > 3 ||
+	(argc == 3 && (idleSeconds = strtoul(argv[2], NULL, 10)) == 0)) {
+      printUsage();
+      return 2;
+    }
+    return CommandServer(idleSeconds).run() ? 0 : 1;
+  }
+
+  int next = 1;
+  Interpretor::OutputFormat format = Interpretor::TEXT;
+  if (strcmp(argv[next], "--json") == 0) {
+    format = Interpretor::JSON_LINES;
+    ++next;
+  }
+  const bool batch = next < argc && strcmp(argv[next], "--batch") == 0;
+  if (next == argc || (batch && argc - next > 2) ||
+      (!batch && argv[next][0] == '-')) {
+    printUsage();
+    return 2;
+  }
+
+  const bool fromStdin = batch &&
+    (next + 1 == argc || strcmp(argv[next + 1], "-") == 0);
+  ifstream file;
+  if (batch && !fromStdin) {
+    file.open(argv[next + 1]);
+    if (!file) {
+      cerr << "Could not open " << argv[next + 1] << "!" << endl;
+      return 1;
+    }
+  }
+  istream& batchInput = fromStdin ? cin : file;
+
+  // A server already has the project loaded, so the commands are just sent
+  // to it (all together, as it reads them all before running any)
+  const int server = CommandServer::openConnection();
+  if (server != -1) {
+    string commands;
+    if (batch) {
+      commands.assign(istreambuf_iterator<char>(batchInput),
+		      istreambuf_iterator<char>());
+    } else {
+      commands = buildCommand(argc, argv, next) + "\n";
+    }
+    return CommandServer::forward(server, commands, format) ? 0 : 1;
+  }
+
+  // Otherwise the project is loaded and saved once here, however many
+  // commands there are, and each is run as it's read
+  Interpretor interpretor(accumulator, format);
+  if (!interpretor.load()) {
+    return 1;
+  }
+  const bool succeeded = batch ? interpretor.executeBatch(batchInput) :
+    interpretor.execute(buildCommand(argc, argv, next));
+  if (!interpretor.save()) {
     return 1;
   }
-  
-  Interpretor interpretor(accumulator);
-  interpretor.interpret();
-  accumulator.saveState();
-  return 0;
+  return succeeded ? 0 : 1;
 }